@@ -0,0 +1,474 @@
+/* Front-end throughput benchmark: lexes and parses deterministic synthetic .bpl programs of several shapes (many small
+ * functions, deep nesting, long expression chains, comment heavy code, hex literals and a mix of all of them) and
+ * reports MB/s and tokens/s of the lexer and nodes/s of the parser. A separate workload with one syntax error in every
+ * few statements measures how fast the parser reports errors and recovers from them. Every number is the best of n
+ * rounds.
+ * Usage: compiler_bench [--json] [--size=<bytes per workload>] [--errors=<n>] [--rounds=<n>] [--seed=<n>]
+ * With --json a single json object is printed instead of the table, for tracking the numbers over time.
+ */
+
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define DEFAULT_WORKLOAD_SIZE (4 << 20)
+#define DEFAULT_ROUNDS 5
+#define DEFAULT_SEED 42
+#define MAX_NESTING_DEPTH 48
+#define LONG_EXPRESSION_OPERANDS 256
+#define DEFAULT_SYNTAX_ERRORS 10000
+
+typedef enum class Shape {
+    functions,
+    deep_nesting,
+    long_expressions,
+    comments,
+    hex_literals,
+    mixed,
+} Shape;
+
+static char const *const shape_names[] = {"functions", "deep_nesting", "long_expressions", "comments", "hex_literals", "mixed"};
+
+/// deterministic program generator, the same seed and size always produce the same program
+typedef struct Generator {
+    std::mt19937 rng;
+    std::string out;
+    uint32_t n_functions = 0;
+    // names usable in the body of the function that is being generated
+    std::vector<std::string> vars;
+
+    uint32_t pick(uint32_t n) {
+        return rng() % n;
+    }
+
+    void indent(uint32_t depth) {
+        out.append(4 * depth, ' ');
+    }
+
+    void number(bool hex) {
+        if (hex) {
+            static char const hex_digits[] = "0123456789abcdefABCDEF";
+            out += "0x";
+            for (uint32_t len = 1 + pick(4); len; len--)
+                out += hex_digits[pick(22)];
+        } else {
+            out += std::to_string(1 + pick(250));
+        }
+    }
+
+    void operand(bool hex_heavy, bool allow_parens, bool allow_neg, uint32_t nesting) {
+        uint32_t kind = pick(10);
+        if (kind < 4) {
+            out += vars[pick(vars.size())];
+        } else if (kind < 7 || nesting > 2) {
+            number(hex_heavy || kind == 6);
+        } else if (kind == 7 && n_functions) {
+            // calls only go to functions generated before this one
+            out += "f" + std::to_string(pick(n_functions)) + "(";
+            expression(1 + pick(3), hex_heavy, nesting + 1);
+            out += ", ";
+            expression(1 + pick(2), hex_heavy, nesting + 1);
+            out += ")";
+        } else if (kind == 8 && allow_parens) {
+            out += "(";
+            expression(2 + pick(3), hex_heavy, nesting + 1);
+            out += ")";
+        } else {
+            out += (allow_neg ? "-" : "") + vars[pick(vars.size())];
+        }
+    }
+
+    /// a chain of n_operands operands; the whole expression is never wrapped in parens
+    void expression(uint32_t n_operands, bool hex_heavy = false, uint32_t nesting = 0) {
+        static char const *const ops[] = {" + ", " - ", " * ", " / ", " % "};
+        uint32_t op = 0;
+        for (uint32_t i = 0; i < n_operands; i++) {
+            if (i)
+                out += ops[op = pick(5)];
+            // the parser cannot handle a negation right after a binary minus (`a - -b`) yet
+            operand(hex_heavy, i > 0, op != 1, nesting);
+        }
+    }
+
+    void comment(uint32_t depth) {
+        static char const *const words[] = {"todo", "the", "value", "of", "x", "is", "fn", "let", "0x1f", "(", "}", "//"};
+        indent(depth);
+        out += "//";
+        for (uint32_t n = 3 + pick(12); n; n--) {
+            out += ' ';
+            out += words[pick(12)];
+        }
+        out += '\n';
+    }
+
+    void simpleStatement(uint32_t depth, bool hex_heavy) {
+        indent(depth);
+        switch (pick(3)) {
+            case 0:
+                out += vars[pick(vars.size())] + " = ";
+                expression(2 + pick(4), hex_heavy);
+                out += ";\n";
+                break;
+            case 1:
+                out += "print(";
+                expression(1 + pick(3), hex_heavy);
+                out += ");\n";
+                break;
+            default: {
+                std::string name = "v" + std::to_string(vars.size());
+                out += "let " + name + " = ";
+                expression(1 + pick(4), hex_heavy);
+                out += ";\n";
+                vars.push_back(std::move(name));
+            }
+        }
+    }
+
+    /// if/else and while blocks nested `remaining` levels deep
+    void nestedBlock(uint32_t depth, uint32_t remaining) {
+        // variables declared inside the block go out of scope with it
+        size_t n_vars = vars.size();
+        indent(depth);
+        bool is_if = pick(3) != 0;
+        // a condition of more than one operand has to be parenthesized
+        out += is_if ? "if (" : "while (";
+        expression(2 + pick(3));
+        out += ") {\n";
+        simpleStatement(depth + 1, false);
+        if (remaining)
+            nestedBlock(depth + 1, remaining - 1);
+        indent(depth);
+        out += "}";
+        if (is_if) {
+            out += " else {\n";
+            simpleStatement(depth + 1, false);
+            indent(depth);
+            out += "}";
+        }
+        out += '\n';
+        vars.resize(n_vars);
+    }
+
+    /// a statement with exactly one syntax error, the parser must report it and go on with the next statement
+    void brokenStatement(uint32_t depth) {
+        indent(depth);
+        switch (pick(5)) {
+            case 0:
+                out += "let = ";
+                expression(1 + pick(3));
+                out += ";\n";
+                break;
+            case 1:
+                out += vars[pick(vars.size())] + " = ";
+                expression(1 + pick(3));
+                out += " + ;\n";
+                break;
+            case 2:
+                out += "print(";
+                expression(1 + pick(2));
+                out += ",, ";
+                expression(1 + pick(2));
+                out += ");\n";
+                break;
+            case 3:
+                out += "return ";
+                expression(1 + pick(3));
+                out += " * * 2;\n";
+                break;
+            default:
+                out += "if (";
+                expression(2 + pick(2));
+                out += ") { ";
+                expression(1 + pick(2));
+                out += " } else;\n";
+        }
+    }
+
+    /// a function that mixes correct statements with n_errors broken ones
+    void brokenFunction(uint32_t n_errors) {
+        vars = {"a", "b"};
+        out += "fn f" + std::to_string(n_functions) + "(a, b) {\n";
+        for (uint32_t i = 0; i < n_errors; i++) {
+            simpleStatement(1, false);
+            brokenStatement(1);
+        }
+        indent(1);
+        out += "return a;\n}\n\n";
+        n_functions++;
+    }
+
+    void function(Shape shape) {
+        if (shape == Shape::mixed)
+            shape = static_cast<Shape>(n_functions % static_cast<uint32_t>(Shape::mixed));
+        bool hex_heavy = shape == Shape::hex_literals;
+
+        if (shape == Shape::comments)
+            for (uint32_t n = 2 + pick(4); n; n--)
+                comment(0);
+        vars = {"a", "b"};
+        out += pick(4) ? "fn " : "extern fn ";
+        out += "f" + std::to_string(n_functions) + "(a, b) {\n";
+        switch (shape) {
+            case Shape::deep_nesting:
+                simpleStatement(1, false);
+                nestedBlock(1, MAX_NESTING_DEPTH / 2 + pick(MAX_NESTING_DEPTH / 2));
+                break;
+            case Shape::long_expressions:
+                indent(1);
+                out += "let v2 = ";
+                expression(LONG_EXPRESSION_OPERANDS / 2 + pick(LONG_EXPRESSION_OPERANDS / 2));
+                out += ";\n";
+                vars.push_back("v2");
+                break;
+            case Shape::comments:
+                for (uint32_t n = 4 + pick(4); n; n--) {
+                    comment(1);
+                    comment(1);
+                    simpleStatement(1, false);
+                }
+                break;
+            default:
+                for (uint32_t n = 3 + pick(6); n; n--)
+                    simpleStatement(1, hex_heavy);
+                if (pick(2))
+                    nestedBlock(1, pick(3));
+        }
+        indent(1);
+        out += "return ";
+        expression(1 + pick(3), hex_heavy);
+        out += ";\n}\n\n";
+        n_functions++;
+    }
+} Generator;
+
+std::string generateProgram(Shape shape, uint32_t size, uint32_t seed) {
+    Generator gen = {.rng = std::mt19937(seed + static_cast<uint32_t>(shape))};
+    gen.out.reserve(size + 4096);
+    gen.out += "let glob;\n\n";
+    while (gen.out.size() < size)
+        gen.function(shape);
+    return std::move(gen.out);
+}
+
+std::string generateBrokenProgram(uint32_t n_errors, uint32_t seed) {
+    Generator gen = {.rng = std::mt19937(seed)};
+    gen.out += "let glob;\n\n";
+    for (uint32_t remaining = n_errors; remaining;) {
+        uint32_t n = std::min(remaining, 1 + gen.pick(4));
+        gen.brokenFunction(n);
+        remaining -= n;
+    }
+    return std::move(gen.out);
+}
+
+/// number of ast nodes, counted on the json dump (every node has exactly one "kind")
+uint64_t countNodes(ast::Block const *block) {
+    std::string json = block->toJsonString();
+    uint64_t n = 0;
+    for (size_t pos = json.find("\"kind\": "); pos != std::string::npos; pos = json.find("\"kind\": ", pos + 1))
+        n++;
+    return n;
+}
+
+template<typename F>
+double bestSeconds(uint32_t rounds, F &&run) {
+    double best = 1e300;
+    for (uint32_t r = 0; r < rounds; r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        run();
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+    }
+    return best;
+}
+
+typedef struct WorkloadResult {
+    char const *name;
+    uint64_t bytes;
+    uint64_t tokens;
+    uint64_t nodes;
+    double tokenize_secs;
+    double lex_secs;
+    double parse_secs;
+    double stream_parse_secs;
+} WorkloadResult;
+
+WorkloadResult runWorkload(Shape shape, uint32_t size, uint32_t seed, uint32_t rounds) {
+    std::string program = generateProgram(shape, size, seed);
+    StringRef const file = {.start = "bench.bpl", .length = 9};
+    StringRef const code = {.start = program.c_str(), .length = static_cast<uint32_t>(program.size())};
+
+    WorkloadResult result = {
+        .name = shape_names[static_cast<uint32_t>(shape)],
+        .bytes = program.size(),
+    };
+
+    result.tokenize_secs = bestSeconds(rounds, [&]() {
+        auto tokens = token::tokenize(file, code);
+        result.tokens = tokens.size();
+    });
+    result.lex_secs = bestSeconds(rounds, [&]() {
+        auto tokens = token::lex(file, code);
+    });
+
+    auto const tokens = token::lex(file, code);
+    std::vector<parser::Error> errors;
+    ast::Arena arena;
+    ast::Ptr<ast::Block> block;
+    result.parse_secs = bestSeconds(rounds, [&]() {
+        // freeing the previous round's tree is part of the measurement
+        arena.reset();
+        errors.clear();
+        block = parser::parse(file, tokens, &errors, &arena);
+    });
+    if (!errors.empty()) {
+        std::cerr << "generated " << result.name << " program does not parse: " << errors.front().msg << std::endl;
+        std::exit(1);
+    }
+    result.nodes = countNodes(block.get());
+
+    result.stream_parse_secs = bestSeconds(rounds, [&]() {
+        arena.reset();
+        token::LexCursor cursor = token::newLexCursor(code);
+        block = parser::parse(file, &cursor, &errors, &arena);
+    });
+    return result;
+}
+
+typedef struct ErrorRecoveryResult {
+    uint64_t bytes;
+    uint64_t errors;
+    double parse_secs;
+    double stream_parse_secs;
+} ErrorRecoveryResult;
+
+ErrorRecoveryResult runErrorRecovery(uint32_t n_errors, uint32_t seed, uint32_t rounds) {
+    std::string program = generateBrokenProgram(n_errors, seed);
+    StringRef const file = {.start = "bench.bpl", .length = 9};
+    StringRef const code = {.start = program.c_str(), .length = static_cast<uint32_t>(program.size())};
+    ErrorRecoveryResult result = {.bytes = program.size()};
+
+    auto const tokens = token::lex(file, code);
+    std::vector<parser::Error> errors;
+    ast::Arena arena;
+    result.parse_secs = bestSeconds(rounds, [&]() {
+        arena.reset();
+        errors.clear();
+        parser::parse(file, tokens, &errors, &arena);
+    });
+    result.errors = errors.size();
+    if (result.errors != n_errors) {
+        std::cerr << "parser reported " << result.errors << " errors for " << n_errors << " broken statements" << std::endl;
+        std::exit(1);
+    }
+
+    result.stream_parse_secs = bestSeconds(rounds, [&]() {
+        arena.reset();
+        errors.clear();
+        token::LexCursor cursor = token::newLexCursor(code);
+        parser::parse(file, &cursor, &errors, &arena);
+    });
+    return result;
+}
+
+void printTable(std::vector<WorkloadResult> const &results, ErrorRecoveryResult const &recovery) {
+    std::cout << std::left << std::setw(18) << "workload"
+        << std::right << std::setw(10) << "MB"
+        << std::setw(12) << "tokens"
+        << std::setw(12) << "nodes"
+        << std::setw(16) << "tokenize MB/s"
+        << std::setw(16) << "tokenize Mtok/s"
+        << std::setw(12) << "lex MB/s"
+        << std::setw(14) << "lex Mtok/s"
+        << std::setw(16) << "parse Mnodes/s"
+        << std::setw(20) << "lex+parse Mnodes/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto const &r : results) {
+        double mb = r.bytes / 1e6;
+        std::cout << std::left << std::setw(18) << r.name
+            << std::right << std::setw(10) << mb
+            << std::setw(12) << r.tokens
+            << std::setw(12) << r.nodes
+            << std::setw(16) << mb / r.tokenize_secs
+            << std::setw(16) << r.tokens / r.tokenize_secs / 1e6
+            << std::setw(12) << mb / r.lex_secs
+            << std::setw(14) << r.tokens / r.lex_secs / 1e6
+            << std::setw(16) << r.nodes / r.parse_secs / 1e6
+            << std::setw(20) << r.nodes / r.stream_parse_secs / 1e6 << std::endl;
+    }
+    std::cout << std::endl << "error recovery: " << recovery.errors << " syntax errors in " << recovery.bytes / 1e6 << " MB"
+        << ", parse " << recovery.parse_secs * 1e3 << " ms (" << recovery.errors / recovery.parse_secs / 1e6 << " M errors/s)"
+        << ", lex+parse " << recovery.stream_parse_secs * 1e3 << " ms" << std::endl;
+}
+
+void printJson(std::vector<WorkloadResult> const &results, ErrorRecoveryResult const &recovery, uint32_t size, uint32_t seed, uint32_t rounds) {
+    std::cout << std::setprecision(6) << "{\"benchmark\": \"compiler_bench\", \"size\": " << size << ", \"seed\": " << seed
+        << ", \"rounds\": " << rounds << ", \"workloads\": [";
+    for (uint32_t i = 0; i < results.size(); i++) {
+        auto const &r = results[i];
+        double mb = r.bytes / 1e6;
+        std::cout << (i ? ", " : "")
+            << "{\"name\": \"" << r.name << "\""
+            << ", \"bytes\": " << r.bytes
+            << ", \"tokens\": " << r.tokens
+            << ", \"nodes\": " << r.nodes
+            << ", \"tokenize_mb_per_s\": " << mb / r.tokenize_secs
+            << ", \"tokenize_tokens_per_s\": " << r.tokens / r.tokenize_secs
+            << ", \"lex_mb_per_s\": " << mb / r.lex_secs
+            << ", \"lex_tokens_per_s\": " << r.tokens / r.lex_secs
+            << ", \"parse_nodes_per_s\": " << r.nodes / r.parse_secs
+            << ", \"stream_parse_nodes_per_s\": " << r.nodes / r.stream_parse_secs
+            << "}";
+    }
+    std::cout << "], \"error_recovery\": {\"bytes\": " << recovery.bytes
+        << ", \"errors\": " << recovery.errors
+        << ", \"parse_secs\": " << recovery.parse_secs
+        << ", \"stream_parse_secs\": " << recovery.stream_parse_secs
+        << "}}" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    bool json = false;
+    uint32_t size = DEFAULT_WORKLOAD_SIZE;
+    uint32_t rounds = DEFAULT_ROUNDS;
+    uint32_t seed = DEFAULT_SEED;
+    uint32_t n_errors = DEFAULT_SYNTAX_ERRORS;
+    for (int i = 1; i < argc; i++) {
+        char const *arg = argv[i];
+        if (!std::strcmp(arg, "--json"))
+            json = true;
+        else if (!std::strncmp(arg, "--size=", 7))
+            size = std::strtoul(arg + 7, nullptr, 10);
+        else if (!std::strncmp(arg, "--errors=", 9))
+            n_errors = std::strtoul(arg + 9, nullptr, 10);
+        else if (!std::strncmp(arg, "--rounds=", 9))
+            rounds = std::max(1ul, std::strtoul(arg + 9, nullptr, 10));
+        else if (!std::strncmp(arg, "--seed=", 7))
+            seed = std::strtoul(arg + 7, nullptr, 10);
+        else {
+            std::cerr << "usage: compiler_bench [--json] [--size=<bytes per workload>] [--errors=<n>] [--rounds=<n>] [--seed=<n>]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<WorkloadResult> results;
+    for (uint32_t s = 0; s <= static_cast<uint32_t>(Shape::mixed); s++)
+        results.push_back(runWorkload(static_cast<Shape>(s), size, seed, rounds));
+    ErrorRecoveryResult recovery = runErrorRecovery(n_errors, seed, rounds);
+
+    if (json)
+        printJson(results, recovery, size, seed, rounds);
+    else
+        printTable(results, recovery);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/* Micro-benchmark for keyword recognition in the lexer: compares the old approach (build a std::string per identifier
+ * character by character, then walk an if/else chain of keyword comparisons) against token::keywordOrIdent.
+ * Usage: keyword_bench [n_identifiers] [n_rounds]
+ */
+
+#include "lexer.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+token::TokenType oldKeywordOrIdent(StringRef slice) {
+    std::string ident;
+    for (uint32_t i = 0; i < slice.length; i++)
+        ident += slice.start[i];
+    if (ident == "fn") return token::TokenType::fn_kwd;
+    else if (ident == "if") return token::TokenType::if_kwd;
+    else if (ident == "else") return token::TokenType::else_kwd;
+    else if (ident == "while") return token::TokenType::while_kwd;
+    else if (ident == "for") return token::TokenType::for_kwd;
+    else if (ident == "return") return token::TokenType::return_kwd;
+    else if (ident == "let") return token::TokenType::let_kwd;
+    else if (ident == "extern") return token::TokenType::extern_kwd;
+    else if (ident == "externc") return token::TokenType::externc_kwd;
+    return token::TokenType::ident;
+}
+
+/// identifiers separated by spaces: roughly 1 in 4 is a keyword, the rest are random [a-z_][a-z0-9_]{0,15}
+std::string generateIdentifiers(uint32_t n, std::vector<StringRef> &out_slices) {
+    static char const *const kwds[] = {"fn", "if", "else", "while", "for", "return", "let", "extern", "externc"};
+    static char const ident_chars[] = "abcdefghijklmnopqrstuvwxyz_0123456789";
+    std::mt19937 rng(42);
+    std::string text;
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t start = text.size();
+        if (rng() % 4 == 0) {
+            text += kwds[rng() % 9];
+        } else {
+            text += ident_chars[rng() % 27];
+            for (uint32_t len = rng() % 16; len; len--)
+                text += ident_chars[rng() % 37];
+        }
+        ranges.emplace_back(start, text.size() - start);
+        text += ' ';
+    }
+    for (auto const &[start, length] : ranges)
+        out_slices.push_back(StringRef {.start = nullptr, .length = length});
+    // slices are fixed up after the text is done growing so the pointers stay valid
+    for (uint32_t i = 0; i < ranges.size(); i++)
+        out_slices[i].start = text.c_str() + ranges[i].first;
+    return text;
+}
+
+template<typename F>
+double identsPerSecond(std::vector<StringRef> const &slices, uint32_t rounds, F &&lookup, uint64_t &checksum) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+        for (auto const &slice : slices)
+            checksum += static_cast<uint64_t>(lookup(slice));
+    auto t1 = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(t1 - t0).count();
+    return static_cast<double>(slices.size()) * rounds / secs;
+}
+
+int main(int argc, char **argv) {
+    uint32_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    uint32_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10;
+
+    std::vector<StringRef> slices;
+    std::string text = generateIdentifiers(n, slices);
+
+    for (auto const &slice : slices) {
+        if (oldKeywordOrIdent(slice) != token::keywordOrIdent(slice)) {
+            std::cerr << "mismatch for identifier '" << std::string(slice.start, slice.length) << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    uint64_t old_checksum = 0;
+    uint64_t new_checksum = 0;
+    double before = identsPerSecond(slices, rounds, oldKeywordOrIdent, old_checksum);
+    double after = identsPerSecond(slices, rounds, token::keywordOrIdent, new_checksum);
+    if (old_checksum != new_checksum) {
+        std::cerr << "checksum mismatch" << std::endl;
+        return 1;
+    }
+
+    std::cout << "identifiers:           " << n << " x " << rounds << " rounds" << std::endl;
+    std::cout << "before (string+chain): " << before / 1e6 << " M idents/s" << std::endl;
+    std::cout << "after (perfect hash):  " << after / 1e6 << " M idents/s" << std::endl;
+    std::cout << "speedup:               " << after / before << "x" << std::endl;
+    return 0;
+}
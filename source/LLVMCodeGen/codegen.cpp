@@ -1,7 +1,9 @@
 /* This is the llvm codegen backend of the bpl compiler. Some key info about it:
- * All return types from functions are void pointers. Statements typically return nullptrs from their codegen,
- * except declarations, which return a pointer to an AllocaInst (stack allocation) downcasted to an llvm::Value pointer.
- * Why void pointers? I *might* add other codegen backends (mlir, custom?) in the future and therefore want to make the codegen opaque.
+ * It is an ast::Visitor (see ast_visitor.hpp) that returns llvm values. Statements typically return nullptrs,
+ * except declarations, which return the AllocaInst (stack allocation) of the declared variable.
+ * Nothing is emitted after a node that always returns (see ast::Expr::alwaysReturns): the node that contains it stops
+ * right there, and the value of such a node is nullptr because it is never used.
+ * Other backends (mlir, custom?) would be visitors of their own with their own result types.
  */
 
 #include "LLVMCodeGen/codegen.hpp"
@@ -45,8 +47,66 @@ char const *codegen::CodeGenException::what() {
     return m_message.c_str();
 }
 
-bool variableDefined(codegen::Context *ctx, std::string const &variable) {
-    return ctx->state->named_values.find(variable) != ctx->state->named_values.end() && !ctx->module->getNamedGlobal(variable);
+void codegen::SymbolTable::enterScope() {
+    m_scopes.push_back(m_undo_log.size());
+}
+
+void codegen::SymbolTable::leaveScope() {
+    uint32_t scope_start = m_scopes.back();
+    m_scopes.pop_back();
+    while (m_undo_log.size() > scope_start) {
+        m_locals[m_undo_log.back().name] = m_undo_log.back().previous;
+        m_undo_log.pop_back();
+    }
+}
+
+uint32_t codegen::SymbolTable::depth() const {
+    return m_scopes.size();
+}
+
+void codegen::SymbolTable::leaveScopesUntil(uint32_t depth) {
+    while (m_scopes.size() > depth)
+        leaveScope();
+}
+
+void codegen::SymbolTable::declare(symbol::Id name, llvm::AllocaInst *alloca) {
+    if (name >= m_locals.size())
+        m_locals.resize(symbol::count(), nullptr);
+    m_undo_log.push_back(Shadowed {.name = name, .previous = m_locals[name]});
+    m_locals[name] = alloca;
+}
+
+void codegen::SymbolTable::declareGlobal(symbol::Id name) {
+    if (name >= m_globals.size())
+        m_globals.resize(symbol::count(), false);
+    m_globals[name] = true;
+}
+
+llvm::AllocaInst *codegen::SymbolTable::local(symbol::Id name) const {
+    return name < m_locals.size() ? m_locals[name] : nullptr;
+}
+
+bool codegen::SymbolTable::isGlobal(symbol::Id name) const {
+    return name < m_globals.size() && m_globals[name];
+}
+
+void pushUnreachableWarning(codegen::Context *ctx, LocationInfo loc) {
+    ctx->warnings->push_back(codegen::Warning {
+        .loc = loc,
+        .msg = "unreachable code: every path before it returns from the function, so no code is generated for it",
+    });
+}
+
+void terminateFailedReturn(codegen::Context *ctx) {
+    if (!ctx->builder->GetInsertBlock()->getTerminator())
+        ctx->builder->CreateUnreachable();
+}
+
+llvm::AllocaInst *lookupVariable(codegen::Context *ctx, symbol::Id variable) {
+    // TODO globals cannot be referenced yet, and a local that has the name of a global is not usable either
+    if (ctx->state->symbols.isGlobal(variable))
+        return nullptr;
+    return ctx->state->symbols.local(variable);
 }
 
 void createPrototype(codegen::Context *ctx, ast::FunctionProto const *proto) {
@@ -57,11 +117,11 @@ void createPrototype(codegen::Context *ctx, ast::FunctionProto const *proto) {
     // auto calling_conv = proto->is_fastcc ? llvm::CallingConv::Fast : llvm::CallingConv::C;  // FIXME fastcc breaks it
     auto linkage_type = llvm::Function::ExternalLinkage;
     auto calling_conv = llvm::CallingConv::C;
-    llvm::Function *fn = llvm::Function::Create(fty, linkage_type, proto->name, ctx->module.get());
+    llvm::Function *fn = llvm::Function::Create(fty, linkage_type, symbol::name(proto->name), ctx->module.get());
     fn->setCallingConv(calling_conv);
     uint32_t i = 0;
     for (auto &arg : fn->args()) {
-        arg.setName(proto->args[i++]);
+        arg.setName(symbol::name(proto->args[i++]));
     }
 }
 
@@ -77,103 +137,104 @@ codegen::Context codegen::newContext(StringRef file, std::vector<codegen::Error>
     return result;
 }
 
-void *ast::Expr::codegen(void *ctx_) const {
-    throw std::runtime_error("called codegen on abstract class ast::Expr");
-}
+codegen::Codegen::Codegen(codegen::Context *ctx) : m_ctx(ctx)
+{}
 
-void *ast::Statement::codegen(void *ctx_) const {
-    throw std::runtime_error("called codegen on abstract class ast::Statement");
+void codegen::codegenAst(codegen::Context *ctx, ast::Block const *block) {
+    codegen::Codegen(ctx).visit(block);
 }
 
-void *ast::BinaryOp::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Value *lhs = static_cast<llvm::Value*>(m_lhs->codegen(ctx));
-    llvm::Value *rhs = static_cast<llvm::Value*>(m_rhs->codegen(ctx));
+llvm::Value *codegen::Codegen::visitBinaryOp(ast::BinaryOp const *node) {
+    llvm::Value *lhs = visit(node->getLhs());
+    if (node->getLhs()->alwaysReturns())
+        return nullptr;
+    llvm::Value *rhs = visit(node->getRhs());
+    if (node->getRhs()->alwaysReturns())
+        return nullptr;
     assertNonNull(lhs);
     assertNonNull(rhs);
-    switch (m_op) {
+    switch (node->getOp()) {
         case ast::BinaryOpType::add: {
-            return ctx->builder->CreateAdd(lhs, rhs, "addtmp");
+            return m_ctx->builder->CreateAdd(lhs, rhs, "addtmp");
         }
         case ast::BinaryOpType::sub: {
-            return ctx->builder->CreateSub(lhs, rhs, "subtmp");
+            return m_ctx->builder->CreateSub(lhs, rhs, "subtmp");
         }
         case ast::BinaryOpType::mul: {
-            return ctx->builder->CreateMul(lhs, rhs, "multmp");
+            return m_ctx->builder->CreateMul(lhs, rhs, "multmp");
         }
         case ast::BinaryOpType::div: {
-            return ctx->builder->CreateUDiv(lhs, rhs, "divtmp");
+            return m_ctx->builder->CreateUDiv(lhs, rhs, "divtmp");
         }
         case ast::BinaryOpType::mod: {
-            return ctx->builder->CreateURem(lhs, rhs, "modulotmp");
+            return m_ctx->builder->CreateURem(lhs, rhs, "modulotmp");
         }
         case ast::BinaryOpType::invalid: {
-            throw codegen::CodeGenException("encountered an invalid binary operation", m_loc);
+            throw codegen::CodeGenException("encountered an invalid binary operation", node->getLoc());
         }
         default:
-            throw std::runtime_error("invalid value of enum class BinaryOpType: " + std::to_string(static_cast<uint32_t>(m_op)));
+            throw std::runtime_error("invalid value of enum class BinaryOpType: " + std::to_string(static_cast<uint32_t>(node->getOp())));
     }
     return nullptr;
 }
 
-void *ast::UnaryOp::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Value *rhs = static_cast<llvm::Value*>(m_rhs->codegen(ctx));
+llvm::Value *codegen::Codegen::visitUnaryOp(ast::UnaryOp const *node) {
+    llvm::Value *rhs = visit(node->getRhs());
+    if (node->getRhs()->alwaysReturns())
+        return nullptr;
     assertNonNull(rhs);
-    switch (m_op) {
+    switch (node->getOp()) {
         case ast::UnaryOpType::neg: {
-            return ctx->builder->CreateSub(llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), rhs, "negtmp");
+            return m_ctx->builder->CreateSub(llvm::ConstantInt::get(*m_ctx->llvm_ctx, llvm::APInt(8, 0, false)), rhs, "negtmp");
         }
         case ast::UnaryOpType::invalid: {
-            throw codegen::CodeGenException("encountered an invalid unary operation", m_loc);
+            throw codegen::CodeGenException("encountered an invalid unary operation", node->getLoc());
         }
         default:
-            throw std::runtime_error("invalid value of enum class BinaryOpType: " + std::to_string(static_cast<uint32_t>(m_op)));
+            throw std::runtime_error("invalid value of enum class BinaryOpType: " + std::to_string(static_cast<uint32_t>(node->getOp())));
     }
     return nullptr;
 }
 
-void *ast::VarRef::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    if (!variableDefined(ctx, m_name))
-        throw codegen::CodeGenException(std::string("use of undeclared variable '") + m_name + "'", m_loc);
-
-    llvm::Value *var_ptr;
-    if (ctx->state->named_values.find(m_name) != ctx->state->named_values.end())
-        var_ptr = static_cast<llvm::Value*>(ctx->state->named_values.at(m_name));  // llvm::AllocaInst*
-    else
-        var_ptr = static_cast<llvm::Value*>(ctx->module->getNamedGlobal(m_name));
-    return ctx->builder->CreateLoad(ctx->builder->getInt8Ty(), var_ptr, m_name + "_loadtmp");
+llvm::Value *codegen::Codegen::visitVarRef(ast::VarRef const *node) {
+    symbol::Id name = node->getName();
+    llvm::AllocaInst *var_ptr = lookupVariable(m_ctx, name);
+    if (!var_ptr)
+        throw codegen::CodeGenException(std::string("use of undeclared variable '") + symbol::name(name) + "'", node->getLoc());
+    return m_ctx->builder->CreateLoad(m_ctx->builder->getInt8Ty(), var_ptr, symbol::name(name) + "_loadtmp");
 }
 
-void *ast::Constant::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    return llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, m_value, false));
+llvm::Value *codegen::Codegen::visitConstant(ast::Constant const *node) {
+    return llvm::ConstantInt::get(*m_ctx->llvm_ctx, llvm::APInt(8, node->getValue(), false));
 }
 
-void *ast::FunctionCall::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Function *callee = ctx->module->getFunction(m_name);
+llvm::Value *codegen::Codegen::visitFunctionCall(ast::FunctionCall const *node) {
+    auto const &call_args = node->getArgs();
+    std::string const &name = symbol::name(node->getName());
+    llvm::Function *callee = m_ctx->module->getFunction(name);
     if (!callee) {
-        std::vector<std::string> arg_names(m_args.size(), std::string("arg"));
+        ast::Vec<symbol::Id> arg_names(call_args.size(), symbol::intern("arg"));
         auto proto = ast::FunctionProto {
-            .name = m_name,
+            .name = node->getName(),
             .args = arg_names,
             .is_extern = true,
             .is_fastcc = true
         };
-        createPrototype(ctx, &proto);
+        createPrototype(m_ctx, &proto);
     }
-    callee = ctx->module->getFunction(m_name);
+    callee = m_ctx->module->getFunction(name);
     if (!callee)
-        throw codegen::CodeGenException(std::string("failed to generate prototype for function '") + m_name + "'", m_loc);
-    if (callee->arg_size() != m_args.size())
-        throw codegen::CodeGenException("incorrect function signature for function '" + m_name + "': function takes "
-                               + std::to_string(callee->arg_size()) + " args, not " + std::to_string(m_args.size()), m_loc);
+        throw codegen::CodeGenException(std::string("failed to generate prototype for function '") + name + "'", node->getLoc());
+    if (callee->arg_size() != call_args.size())
+        throw codegen::CodeGenException("incorrect function signature for function '" + name + "': function takes "
+                               + std::to_string(callee->arg_size()) + " args, not " + std::to_string(call_args.size()), node->getLoc());
     std::vector<llvm::Value*> args;
-    for (uint32_t i = 0; i < m_args.size(); i++)
-        args.push_back(static_cast<llvm::Value*>(m_args.at(i)->codegen(ctx)));
-    return ctx->builder->CreateCall(callee, std::move(args), "calltmp");
+    for (uint32_t i = 0; i < call_args.size(); i++) {
+        args.push_back(visit(call_args.at(i).get()));
+        if (call_args.at(i)->alwaysReturns())
+            return nullptr;
+    }
+    return m_ctx->builder->CreateCall(callee, std::move(args), "calltmp");
 }
 
 void createLifetimeCall(codegen::Context *ctx, llvm::Value *obj, llvm::BasicBlock *lifetime_bb, char const *instruct_name) {
@@ -198,142 +259,165 @@ void createLifetimeEndCall(codegen::Context *ctx, llvm::Value *obj, llvm::BasicB
     createLifetimeCall(ctx, obj, lifetime_bb, "llvm.lifetime.end.p0");
 }
 
-void *ast::Block::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    codegen::State *old_state_ptr = ctx->state;
-    auto new_state = codegen::State {
-        .named_values = old_state_ptr->named_values,
-        .declarations_block = old_state_ptr->declarations_block,
-    };
-    ctx->state = &new_state;
-    if (m_is_toplevel) {
-        for (auto const &stmt : m_statements) {
+llvm::Value *codegen::Codegen::visitBlock(ast::Block const *node) {
+    codegen::State *state = m_ctx->state;
+    state->symbols.enterScope();
+    uint32_t scope_depth = state->symbols.depth();
+    if (node->isToplevel()) {
+        for (auto const &stmt : node->getStatements()) {
             if (stmt->getKind() == ast::StatementKind::function_def)
-                createPrototype(ctx, &stmt->getProto());
+                createPrototype(m_ctx, &static_cast<ast::FunctionDef const*>(stmt.get())->getProto());
         }
-        for (auto const &stmt : m_statements) {
+        for (auto const &stmt : node->getStatements()) {
             if (stmt->getKind() == ast::StatementKind::function_def) {
                 try {
-                    stmt->codegen(ctx);
+                    visit(stmt.get());
                 } catch (codegen::CodeGenException e) {
-                    ctx->state = &new_state;
-                    ctx->errors->push_back(codegen::Error {
+                    state->symbols.leaveScopesUntil(scope_depth);
+                    state->declarations_block = nullptr;
+                    m_ctx->errors->push_back(codegen::Error {
                         .loc = e.m_loc,
                         .msg = std::move(e.m_message),
                     });
                 }
             } else if (stmt->getKind() == ast::StatementKind::decl_assignment) {
-                auto const *da = static_cast<ast::DeclAssignment*>(stmt.get());
-                da->globalCodegen(ctx);
+                globalDeclaration(static_cast<ast::DeclAssignment const*>(stmt.get()));
             } else
                 throw std::runtime_error("parser generated other statement type in toplevel even though it should only generate function defs and decl assignments");
         }
-        ctx->state = old_state_ptr;
-        if (llvm::verifyModule(*ctx->module))
-            ctx->errors->push_back(codegen::Error {.loc = m_loc, .msg = "Could not compile module"});
+        state->symbols.leaveScope();
+        if (llvm::verifyModule(*m_ctx->module))
+            m_ctx->errors->push_back(codegen::Error {.loc = node->getLoc(), .msg = "Could not compile module"});
         return nullptr;
     } else {
-        llvm::Function *parent_fn = ctx->builder->GetInsertBlock()->getParent();
-        llvm::BasicBlock *decl_lifetime_start_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "block_lifetimes_start", parent_fn);
-        llvm::BasicBlock *block_entry_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "block_entry", parent_fn);
-        llvm::BasicBlock *decl_lifetime_end_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "block_lifetimes_end");
-        ctx->builder->CreateBr(decl_lifetime_start_bb);
-        ctx->builder->SetInsertPoint(block_entry_bb);
+        llvm::Function *parent_fn = m_ctx->builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *decl_lifetime_start_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "block_lifetimes_start", parent_fn);
+        llvm::BasicBlock *block_entry_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "block_entry", parent_fn);
+        m_ctx->builder->CreateBr(decl_lifetime_start_bb);
+        m_ctx->builder->SetInsertPoint(block_entry_bb);
 
+        auto const &statements = node->getStatements();
         std::vector<llvm::Value*> alloca_ptrs_of_decls;
-        for (auto const &stmt : m_statements) {
+        bool has_returned = false;
+        for (uint32_t i = 0; i < statements.size() && !has_returned; i++) {
+            auto const &stmt = statements[i];
             if (stmt->getKind() == ast::StatementKind::decl_assignment) {
-                llvm::Value* var = nullptr;
                 try {
-                    llvm::Value *var = static_cast<llvm::Value*>(stmt->codegen(ctx));
+                    llvm::Value *var = visit(stmt.get());
                     assertNonNull(var);
-                    createLifetimeStartCall(ctx, var, decl_lifetime_start_bb);
+                    createLifetimeStartCall(m_ctx, var, decl_lifetime_start_bb);
                     alloca_ptrs_of_decls.push_back(var);
                 } catch (codegen::CodeGenException e) {
-                    // recover state in case it was not reset back before error (which will always happen atm)
-                    ctx->state = &new_state;
-                    ctx->errors->push_back(codegen::Error {
+                    // leave the scopes the error unwound through
+                    state->symbols.leaveScopesUntil(scope_depth);
+                    m_ctx->errors->push_back(codegen::Error {
                         .loc = e.m_loc,
                         .msg = std::move(e.m_message),
                     });
+                    if (stmt->alwaysReturns())
+                        terminateFailedReturn(m_ctx);
                     alloca_ptrs_of_decls.push_back(nullptr);
                 }
             } else if (stmt->getKind() == ast::StatementKind::function_def)
                 throw std::runtime_error("parser accepted and constructed a function def in a non-toplevel scope");
             else {
                 try {
-                    stmt->codegen(ctx);
+                    visit(stmt.get());
                 } catch (codegen::CodeGenException e) {
-                    ctx->state = &new_state;
-                    ctx->errors->push_back(codegen::Error {
+                    state->symbols.leaveScopesUntil(scope_depth);
+                    m_ctx->errors->push_back(codegen::Error {
                         .loc = e.m_loc,
                         .msg = std::move(e.m_message),
                     });
+                    if (stmt->alwaysReturns())
+                        terminateFailedReturn(m_ctx);
                 }
                 alloca_ptrs_of_decls.push_back(nullptr);
             }
+            // even if the statement failed, its block was terminated in place of the ret
+            has_returned = stmt->alwaysReturns();
+            if (has_returned && i + 1 < statements.size())
+                pushUnreachableWarning(m_ctx, statements[i + 1]->getLoc());
+            else if (has_returned && node->getResult())
+                pushUnreachableWarning(m_ctx, node->getResult()->getLoc());
         }
 
         llvm::Value *result = nullptr;
-        if (m_result) {
+        if (node->getResult() && !has_returned) {
             try {
-                result = static_cast<llvm::Value*>(m_result.value()->codegen(ctx));
+                result = visit(node->getResult());
             } catch (codegen::CodeGenException e) {
-                ctx->errors->push_back(codegen::Error {
+                state->symbols.leaveScopesUntil(scope_depth);
+                m_ctx->errors->push_back(codegen::Error {
                     .loc = e.m_loc,
                     .msg = std::move(e.m_message),
                 });
+                if (node->getResult()->alwaysReturns())
+                    terminateFailedReturn(m_ctx);
             }
         }
 
-        auto saved_ip = ctx->builder->saveIP();
-        ctx->builder->SetInsertPoint(decl_lifetime_start_bb);
-        ctx->builder->CreateBr(block_entry_bb);
-        ctx->builder->restoreIP(saved_ip);
-        ctx->builder->CreateBr(decl_lifetime_end_bb);
+        auto saved_ip = m_ctx->builder->saveIP();
+        m_ctx->builder->SetInsertPoint(decl_lifetime_start_bb);
+        m_ctx->builder->CreateBr(block_entry_bb);
+        m_ctx->builder->restoreIP(saved_ip);
+        if (node->alwaysReturns()) {
+            // the end of the block is never reached, and neither are the ends of the lifetimes
+            state->symbols.leaveScope();
+            return nullptr;
+        }
+        llvm::BasicBlock *decl_lifetime_end_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "block_lifetimes_end");
+        m_ctx->builder->CreateBr(decl_lifetime_end_bb);
         parent_fn->insert(parent_fn->end(), decl_lifetime_end_bb);
-        ctx->builder->SetInsertPoint(decl_lifetime_end_bb);
+        m_ctx->builder->SetInsertPoint(decl_lifetime_end_bb);
         for (auto const &alloca_ptr : alloca_ptrs_of_decls) {
             if (alloca_ptr != nullptr)
-                createLifetimeEndCall(ctx, alloca_ptr, decl_lifetime_end_bb);
+                createLifetimeEndCall(m_ctx, alloca_ptr, decl_lifetime_end_bb);
         }
 
-        ctx->state = old_state_ptr;
+        state->symbols.leaveScope();
         return result;
     }
 }
 
-void *ast::If::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Value *condition = ctx->builder->CreateICmpNE(static_cast<llvm::Value*>(m_condition->codegen(ctx)), llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), "condtmp");
-    llvm::Function *parent_fn = ctx->builder->GetInsertBlock()->getParent();
-    llvm::BasicBlock *cond_true_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "cond_true", parent_fn);
-    llvm::BasicBlock *cond_false_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "cond_false");
-    llvm::BasicBlock *post_if_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "post_if");
+llvm::Value *codegen::Codegen::visitIf(ast::If const *node) {
+    llvm::Value *condition_value = visit(node->getCondition());
+    if (node->getCondition()->alwaysReturns())
+        return nullptr;
+    llvm::Value *condition = m_ctx->builder->CreateICmpNE(condition_value, llvm::ConstantInt::get(*m_ctx->llvm_ctx, llvm::APInt(8, 0, false)), "condtmp");
+    llvm::Function *parent_fn = m_ctx->builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock *cond_true_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "cond_true", parent_fn);
+    llvm::BasicBlock *cond_false_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "cond_false");
+    llvm::BasicBlock *post_if_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "post_if");
 
     // create conditional branch
-    llvm::AllocaInst *if_result = allocaInDeclBlock(ctx, ctx->builder->getInt8Ty(), "if_result");
-    ctx->builder->CreateCondBr(condition, cond_true_bb, cond_false_bb);
+    llvm::AllocaInst *if_result = allocaInDeclBlock(m_ctx, m_ctx->builder->getInt8Ty(), "if_result");
+    m_ctx->builder->CreateCondBr(condition, cond_true_bb, cond_false_bb);
 
     // condition true branch
-    ctx->builder->SetInsertPoint(cond_true_bb);
-    llvm::Value *cond_true_result = static_cast<llvm::Value*>(m_branch->codegen(ctx));
-
-    if (cond_true_result)
-        ctx->builder->CreateStore(cond_true_result, if_result);
-    else
-        ctx->builder->CreateStore(llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), if_result);
-    ctx->builder->CreateBr(post_if_bb);
-    cond_true_bb = ctx->builder->GetInsertBlock();
+    m_ctx->builder->SetInsertPoint(cond_true_bb);
+    llvm::Value *cond_true_result = visit(node->getBranch());
+    bool true_returns = node->getBranch()->alwaysReturns();
+
+    if (!true_returns) {
+        if (cond_true_result)
+            m_ctx->builder->CreateStore(cond_true_result, if_result);
+        else
+            m_ctx->builder->CreateStore(llvm::ConstantInt::get(*m_ctx->llvm_ctx, llvm::APInt(8, 0, false)), if_result);
+        m_ctx->builder->CreateBr(post_if_bb);
+    }
+    cond_true_bb = m_ctx->builder->GetInsertBlock();
 
     // condition false branch
     parent_fn->insert(parent_fn->end(), cond_false_bb);
-    ctx->builder->SetInsertPoint(cond_false_bb);
+    m_ctx->builder->SetInsertPoint(cond_false_bb);
     llvm::Value *cond_false_result = nullptr;
-    if (m_else_branch)
-        cond_false_result = static_cast<llvm::Value*>(m_else_branch.value()->codegen(ctx));
+    if (node->getElseBranch())
+        cond_false_result = visit(node->getElseBranch());
+    bool false_returns = node->getElseBranch() && node->getElseBranch()->alwaysReturns();
 
-    if (cond_true_result != nullptr || cond_false_result != nullptr) {
+    // a branch that always returns has no value, so it fits the type of the other one
+    if (!true_returns && !false_returns && (cond_true_result != nullptr || cond_false_result != nullptr)) {
         std::optional<std::string> message = std::nullopt;
         if (cond_true_result == nullptr && cond_false_result != nullptr)
             message = std::string("incompatible result types of true and false branch of if condition; true branch type: void; false branch type: ")
@@ -348,192 +432,204 @@ void *ast::If::codegen(void *ctx_) const {
                 + "; false branch type: "
                 + llvmTypeAsString(cond_false_result->getType());
         if (message)
-            ctx->warnings->push_back(codegen::Warning {
-                .loc = m_loc,
+            m_ctx->warnings->push_back(codegen::Warning {
+                .loc = node->getLoc(),
                 .msg = std::move(message.value()),
             });
     }
 
-    if (cond_false_result)
-        ctx->builder->CreateStore(cond_false_result, if_result);
-    else
-        ctx->builder->CreateStore(llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), if_result);
-    ctx->builder->CreateBr(post_if_bb);
-    cond_false_bb = ctx->builder->GetInsertBlock();
+    if (!false_returns) {
+        if (cond_false_result)
+            m_ctx->builder->CreateStore(cond_false_result, if_result);
+        else
+            m_ctx->builder->CreateStore(llvm::ConstantInt::get(*m_ctx->llvm_ctx, llvm::APInt(8, 0, false)), if_result);
+        m_ctx->builder->CreateBr(post_if_bb);
+    }
+    cond_false_bb = m_ctx->builder->GetInsertBlock();
+    if (true_returns && false_returns) {
+        // nothing branches to it
+        delete post_if_bb;
+        return nullptr;
+    }
 
     // post if block (where codegen continues)
     parent_fn->insert(parent_fn->end(), post_if_bb);
-    ctx->builder->SetInsertPoint(post_if_bb);
-    llvm::Value *loaded_result = ctx->builder->CreateLoad(ctx->builder->getInt8Ty(), if_result, "if_result.loadtmp");
+    m_ctx->builder->SetInsertPoint(post_if_bb);
+    llvm::Value *loaded_result = m_ctx->builder->CreateLoad(m_ctx->builder->getInt8Ty(), if_result, "if_result.loadtmp");
     return loaded_result;
 }
 
-void *ast::While::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Function *parent_fn = ctx->builder->GetInsertBlock()->getParent();
-    llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "cond_block", parent_fn);
-    llvm::BasicBlock *loop_body_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "loop_body");
-    llvm::BasicBlock *post_while_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "post_while");
+llvm::Value *codegen::Codegen::visitWhile(ast::While const *node) {
+    llvm::Function *parent_fn = m_ctx->builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "cond_block", parent_fn);
 
     // create condition block
     // TODO support implicit returns from breaks
-    ctx->builder->CreateBr(cond_bb);
-    ctx->builder->SetInsertPoint(cond_bb);
-    llvm::Value *condition = ctx->builder->CreateICmpNE(static_cast<llvm::Value*>(m_condition->codegen(ctx)), llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), "condtmp");
-    ctx->builder->CreateCondBr(condition, loop_body_bb, post_while_bb);
+    m_ctx->builder->CreateBr(cond_bb);
+    m_ctx->builder->SetInsertPoint(cond_bb);
+    llvm::Value *condition_value = visit(node->getCondition());
+    if (node->getCondition()->alwaysReturns())
+        return nullptr;
+    llvm::Value *condition = m_ctx->builder->CreateICmpNE(condition_value, llvm::ConstantInt::get(*m_ctx->llvm_ctx, llvm::APInt(8, 0, false)), "condtmp");
+    llvm::BasicBlock *loop_body_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "loop_body");
+    llvm::BasicBlock *post_while_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "post_while");
+    m_ctx->builder->CreateCondBr(condition, loop_body_bb, post_while_bb);
 
     // loop body branch
     parent_fn->insert(parent_fn->end(), loop_body_bb);
-    ctx->builder->SetInsertPoint(loop_body_bb);
-    llvm::Value *cond_true_result = static_cast<llvm::Value*>(m_branch->codegen(ctx));
+    m_ctx->builder->SetInsertPoint(loop_body_bb);
+    llvm::Value *cond_true_result = visit(node->getBranch());
     if (cond_true_result != nullptr)
         throw std::runtime_error("return values from loops not supported at the moment");
-    ctx->builder->CreateBr(cond_bb);
-    loop_body_bb = ctx->builder->GetInsertBlock();
+    if (!node->getBranch()->alwaysReturns())
+        m_ctx->builder->CreateBr(cond_bb);
+    loop_body_bb = m_ctx->builder->GetInsertBlock();
 
     // after the loop
     parent_fn->insert(parent_fn->end(), post_while_bb);
-    ctx->builder->SetInsertPoint(post_while_bb);
+    m_ctx->builder->SetInsertPoint(post_while_bb);
     return nullptr;
 }
 
-void *ast::For::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Function *parent_fn = ctx->builder->GetInsertBlock()->getParent();
-    llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "cond_block", parent_fn);
-    llvm::BasicBlock *loop_body_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "loop_body");
-    llvm::BasicBlock *post_for_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "post_for");
-
-    m_init->codegen(ctx);
+llvm::Value *codegen::Codegen::visitFor(ast::For const *node) {
+    llvm::Function *parent_fn = m_ctx->builder->GetInsertBlock()->getParent();
+    visit(node->getInit());
+    if (node->getInit()->alwaysReturns())
+        return nullptr;
 
     // create condition block
     // TODO support implicit returns from breaks
-    ctx->builder->CreateBr(cond_bb);
-    ctx->builder->SetInsertPoint(cond_bb);
-    llvm::Value *condition = ctx->builder->CreateICmpNE(static_cast<llvm::Value*>(m_condition->codegen(ctx)), llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), "condtmp");
-    ctx->builder->CreateCondBr(condition, loop_body_bb, post_for_bb);
+    llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "cond_block", parent_fn);
+    m_ctx->builder->CreateBr(cond_bb);
+    m_ctx->builder->SetInsertPoint(cond_bb);
+    llvm::Value *condition_value = visit(node->getCondition());
+    if (node->getCondition()->alwaysReturns())
+        return nullptr;
+    llvm::Value *condition = m_ctx->builder->CreateICmpNE(condition_value, llvm::ConstantInt::get(*m_ctx->llvm_ctx, llvm::APInt(8, 0, false)), "condtmp");
+    llvm::BasicBlock *loop_body_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "loop_body");
+    llvm::BasicBlock *post_for_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "post_for");
+    m_ctx->builder->CreateCondBr(condition, loop_body_bb, post_for_bb);
 
     // loop body branch
     parent_fn->insert(parent_fn->end(), loop_body_bb);
-    ctx->builder->SetInsertPoint(loop_body_bb);
-    llvm::Value *cond_true_result = static_cast<llvm::Value*>(m_branch->codegen(ctx));
+    m_ctx->builder->SetInsertPoint(loop_body_bb);
+    llvm::Value *cond_true_result = visit(node->getBranch());
     if (cond_true_result != nullptr)
         throw std::runtime_error("return values from loops not supported at the moment");
 
-    m_update->codegen(ctx);
-
-    ctx->builder->CreateBr(cond_bb);
-    loop_body_bb = ctx->builder->GetInsertBlock();
+    if (!node->getBranch()->alwaysReturns()) {
+        visit(node->getUpdate());
+        if (!node->getUpdate()->alwaysReturns())
+            m_ctx->builder->CreateBr(cond_bb);
+    }
+    loop_body_bb = m_ctx->builder->GetInsertBlock();
 
     // after the loop
     parent_fn->insert(parent_fn->end(), post_for_bb);
-    ctx->builder->SetInsertPoint(post_for_bb);
+    m_ctx->builder->SetInsertPoint(post_for_bb);
     return nullptr;
 }
 
-void *ast::FunctionDef::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Function *fn = ctx->module->getFunction(m_proto.name);
+llvm::Value *codegen::Codegen::visitFunctionDef(ast::FunctionDef const *node) {
+    ast::FunctionProto const &proto = node->getProto();
+    llvm::Function *fn = m_ctx->module->getFunction(symbol::name(proto.name));
     if (!fn)
         throw std::runtime_error("no forward declaration has been auto-generated for this function");
     else if (!fn->empty())
-        throw codegen::CodeGenException(std::string("redefinition of function '") + m_proto.name + "'", m_loc);
-    llvm::BasicBlock *declarations_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "declarations_block", fn);
-    llvm::BasicBlock *entry_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "entry");
-    ctx->builder->SetInsertPoint(declarations_bb);
-
-    codegen::State *old_state_ptr = ctx->state;
-    auto new_state = codegen::State {
-        .named_values = ctx->state->named_values,  // TODO avoid copies
-        .declarations_block = declarations_bb,
-    };
-    ctx->state = &new_state;
+        throw codegen::CodeGenException(std::string("redefinition of function '") + symbol::name(proto.name) + "'", node->getLoc());
+    llvm::BasicBlock *declarations_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "declarations_block", fn);
+    llvm::BasicBlock *entry_bb = llvm::BasicBlock::Create(*m_ctx->llvm_ctx, "entry");
+    m_ctx->builder->SetInsertPoint(declarations_bb);
+
+    codegen::State *state = m_ctx->state;
+    llvm::BasicBlock *old_declarations_block = state->declarations_block;
+    state->declarations_block = declarations_bb;
+    state->symbols.enterScope();
 
     uint32_t i = 0;
     for (llvm::Argument const &arg_val : fn->args()) {
-        llvm::AllocaInst *alloca = allocaInDeclBlock(ctx, ctx->builder->getInt8Ty(), arg_val.getName().data());
-        new_state.named_values[m_proto.args[i++]] = alloca;
+        llvm::AllocaInst *alloca = allocaInDeclBlock(m_ctx, m_ctx->builder->getInt8Ty(), arg_val.getName().data());
+        state->symbols.declare(proto.args[i++], alloca);
     }
     
     fn->insert(fn->end(), entry_bb);
-    ctx->builder->SetInsertPoint(entry_bb);
+    m_ctx->builder->SetInsertPoint(entry_bb);
 
-    i = 0;
     for (llvm::Argument &arg_val : fn->args()) {
-        llvm::AllocaInst *alloca = new_state.named_values[m_proto.args[i++]];
-        ctx->builder->CreateStore(&arg_val, alloca);
+        // of arguments with the same name, the last one is bound and all of them are stored to its slot
+        llvm::AllocaInst *alloca = state->symbols.local(proto.args[arg_val.getArgNo()]);
+        m_ctx->builder->CreateStore(&arg_val, alloca);
     }
 
-    llvm::Value *implicit_ret = static_cast<llvm::Value*>(m_block->codegen(ctx));
-    if (implicit_ret)
-        ctx->builder->CreateRet(implicit_ret);
-    else
-        ctx->builder->CreateRet(llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)));
-    ctx->builder->SetInsertPoint(declarations_bb);
-    ctx->builder->CreateBr(entry_bb);
-    ctx->state = old_state_ptr;
+    llvm::Value *implicit_ret = visit(node->getBlock());
+    // a body that always returns has no end to fall off, so it gets no implicit return
+    if (!node->getBlock()->alwaysReturns()) {
+        if (implicit_ret)
+            m_ctx->builder->CreateRet(implicit_ret);
+        else
+            m_ctx->builder->CreateRet(llvm::ConstantInt::get(*m_ctx->llvm_ctx, llvm::APInt(8, 0, false)));
+    }
+    m_ctx->builder->SetInsertPoint(declarations_bb);
+    m_ctx->builder->CreateBr(entry_bb);
+    state->symbols.leaveScope();
+    state->declarations_block = old_declarations_block;
 
     llvm::verifyFunction(*fn);
     return nullptr;
 }
 
-void *ast::DeclAssignment::globalCodegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    if (m_value)
-        throw codegen::CodeGenException("global variables do currently not support immediate initialization (I recommend creating a globalInit function that is called at the start of main instead)", m_loc);
-    if (ctx->module->getNamedGlobal(m_name))
-        throw codegen::CodeGenException("global variables must currently not be redefined (TODO: keep track of gvars manually to allow for that)", m_loc);
+void codegen::Codegen::globalDeclaration(ast::DeclAssignment const *node) {
+    if (node->getValue())
+        throw codegen::CodeGenException("global variables do currently not support immediate initialization (I recommend creating a globalInit function that is called at the start of main instead)", node->getLoc());
+    if (m_ctx->state->symbols.isGlobal(node->getName()))
+        throw codegen::CodeGenException("global variables must currently not be redefined (TODO: keep track of gvars manually to allow for that)", node->getLoc());
     new llvm::GlobalVariable(  // TODO does this leak memory?
-        *ctx->module,
-        ctx->builder->getInt8Ty(),
+        *m_ctx->module,
+        m_ctx->builder->getInt8Ty(),
         /*isConstant*/ false,  // TODO encorporate type info for mutability later
         llvm::GlobalValue::ExternalLinkage,
-        llvm::PoisonValue::get(ctx->builder->getInt8Ty()),
-        m_name
+        llvm::PoisonValue::get(m_ctx->builder->getInt8Ty()),
+        symbol::name(node->getName())
     );
-    return nullptr;
+    m_ctx->state->symbols.declareGlobal(node->getName());
 }
 
-void *ast::DeclAssignment::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::AllocaInst *var = allocaInDeclBlock(ctx, ctx->builder->getInt8Ty(), m_name.c_str());
-    if (m_value) {
-        llvm::Value *value = static_cast<llvm::Value*>(m_value.value()->codegen(ctx));
-        ctx->builder->CreateStore(value, var);
+llvm::Value *codegen::Codegen::visitDeclAssignment(ast::DeclAssignment const *node) {
+    llvm::AllocaInst *var = allocaInDeclBlock(m_ctx, m_ctx->builder->getInt8Ty(), symbol::name(node->getName()).c_str());
+    if (node->getValue()) {
+        llvm::Value *value = visit(node->getValue());
+        if (!node->getValue()->alwaysReturns())
+            m_ctx->builder->CreateStore(value, var);
     }
-    ctx->state->named_values[m_name] = var;
-    return static_cast<llvm::Value*>(var);
-}
-
-void *ast::Assignment::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Value *value = static_cast<llvm::Value*>(m_value->codegen(ctx));
-
-    if (m_key->getKind() == ast::ExprKind::var_ref) {
-        std::string const &name = m_key->getVarName();
-        if (variableDefined(ctx, name)) {
-            llvm::Value *var;
-            if (ctx->state->named_values.find(name) != ctx->state->named_values.end())
-                var = static_cast<llvm::Value*>(ctx->state->named_values.at(name));
-            else
-                var = static_cast<llvm::Value*>(ctx->module->getNamedGlobal(name));
-            ctx->builder->CreateStore(value, var);
-        } else  // TODO support pointer deref assignments here
-            throw codegen::CodeGenException(std::string("use of undeclared variable '") + name + "'", m_loc);
+    m_ctx->state->symbols.declare(node->getName(), var);
+    return var;
+}
+
+llvm::Value *codegen::Codegen::visitAssignment(ast::Assignment const *node) {
+    llvm::Value *value = visit(node->getValue());
+    if (node->getValue()->alwaysReturns())
+        return nullptr;
+
+    if (node->getKey()->getKind() == ast::ExprKind::var_ref) {
+        symbol::Id name = static_cast<ast::VarRef const*>(node->getKey())->getName();
+        if (llvm::AllocaInst *var = lookupVariable(m_ctx, name))
+            m_ctx->builder->CreateStore(value, var);
+        else  // TODO support pointer deref assignments here
+            throw codegen::CodeGenException(std::string("use of undeclared variable '") + symbol::name(name) + "'", node->getLoc());
     } else
-        throw codegen::CodeGenException("invalid lhs for assignment: lhs must be either an identifier (or in the future, a dereference of some expression)", m_loc);
+        throw codegen::CodeGenException("invalid lhs for assignment: lhs must be either an identifier (or in the future, a dereference of some expression)", node->getLoc());
     return nullptr;
 }
 
-void *ast::Return::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Value *value = static_cast<llvm::Value*>(m_value->codegen(ctx));
-    ctx->builder->CreateRet(value);
+llvm::Value *codegen::Codegen::visitReturn(ast::Return const *node) {
+    llvm::Value *value = visit(node->getValue());
+    // the value may have returned already, eg return { return x; };
+    if (!node->getValue()->alwaysReturns())
+        m_ctx->builder->CreateRet(value);
     return nullptr;
 }
 
-void *ast::ExprStmt::codegen(void *ctx_) const {
-    codegen::Context *ctx = static_cast<codegen::Context*>(ctx_);
-    llvm::Value *expr = static_cast<llvm::Value*>(m_expr->codegen(ctx));
+llvm::Value *codegen::Codegen::visitExprStmt(ast::ExprStmt const *node) {
+    visit(node->getExpr());
     return nullptr;
 }
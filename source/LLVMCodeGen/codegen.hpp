@@ -1,7 +1,9 @@
 #pragma once
 
 #include "ast.hpp"
+#include "ast_visitor.hpp"
 #include "lib.hpp"
+#include "symbol.hpp"
 #include "llvm/ADT/APInt.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
@@ -31,8 +33,40 @@ typedef struct Warning {
     std::string msg;
 } Warning;
 
+/* The variables in scope during codegen. Every symbol id (they are dense) indexes a slot holding its innermost
+ * binding, so a lookup is an array access. Declaring a variable records the binding it shadows in an undo log, and
+ * leaving a scope restores the bindings logged since the scope was entered, so entering a scope costs nothing and
+ * leaving it is proportional to the declarations it made. Global variables are only marked per symbol.
+ */
+class SymbolTable {
+    typedef struct Shadowed {
+        symbol::Id name;
+        llvm::AllocaInst *previous;
+    } Shadowed;
+
+    std::vector<llvm::AllocaInst*> m_locals;
+    std::vector<bool> m_globals;
+    std::vector<Shadowed> m_undo_log;
+    /// undo log size at the entry of every open scope
+    std::vector<uint32_t> m_scopes;
+
+public:
+    void enterScope();
+    void leaveScope();
+    /// number of open scopes
+    uint32_t depth() const;
+    /// leave the scopes that were left out when an error unwound through them, until depth scopes are open
+    void leaveScopesUntil(uint32_t depth);
+    /// bind name in the innermost scope
+    void declare(symbol::Id name, llvm::AllocaInst *alloca);
+    void declareGlobal(symbol::Id name);
+    /// the innermost local binding of name, nullptr if there is none
+    llvm::AllocaInst *local(symbol::Id name) const;
+    bool isGlobal(symbol::Id name) const;
+};
+
 typedef struct State {
-    std::unordered_map<std::string, llvm::AllocaInst*> named_values{};
+    SymbolTable symbols{};
     llvm::BasicBlock *declarations_block = nullptr;
 } State;
 
@@ -57,4 +91,47 @@ public:
 };
 
 std::string dumpIR(Context const *ctx);
+
+/// the llvm backend for ast.hpp trees (see codegen.cpp for what the visit methods return)
+class Codegen : public ast::Visitor<Codegen, llvm::Value*> {
+    Context *m_ctx;
+
+public:
+    explicit Codegen(Context *ctx);
+
+    llvm::Value *visitBinaryOp(ast::BinaryOp const *node);
+    llvm::Value *visitUnaryOp(ast::UnaryOp const *node);
+    llvm::Value *visitVarRef(ast::VarRef const *node);
+    llvm::Value *visitConstant(ast::Constant const *node);
+    llvm::Value *visitFunctionCall(ast::FunctionCall const *node);
+    llvm::Value *visitBlock(ast::Block const *node);
+    llvm::Value *visitIf(ast::If const *node);
+    llvm::Value *visitWhile(ast::While const *node);
+    llvm::Value *visitFor(ast::For const *node);
+    llvm::Value *visitFunctionDef(ast::FunctionDef const *node);
+    llvm::Value *visitDeclAssignment(ast::DeclAssignment const *node);
+    llvm::Value *visitAssignment(ast::Assignment const *node);
+    llvm::Value *visitReturn(ast::Return const *node);
+    llvm::Value *visitExprStmt(ast::ExprStmt const *node);
+    /// a declaration at toplevel, which becomes a global variable
+    void globalDeclaration(ast::DeclAssignment const *node);
+};
+
+/// generate the module of a file
+void codegenAst(Context *ctx, ast::Block const *block);
 }  // namespace codegen
+
+// helpers shared by the codegen of ast.hpp trees and of flat trees (flat_codegen.cpp)
+void assertNonNull(void *ptr);
+std::string llvmTypeAsString(llvm::Type const *ty);
+llvm::AllocaInst *allocaInDeclBlock(codegen::Context *ctx, llvm::Type *ty, char const *name);
+/// warn about code after a node that always returns, which is skipped
+void pushUnreachableWarning(codegen::Context *ctx, LocationInfo loc);
+/// ends the current basic block with an unreachable after a node that always returns failed to generate: the code
+/// around it relies on the ret the node never emitted
+void terminateFailedReturn(codegen::Context *ctx);
+/// the stack slot of a variable that can be referenced, nullptr if it is undeclared
+llvm::AllocaInst *lookupVariable(codegen::Context *ctx, symbol::Id variable);
+void createPrototype(codegen::Context *ctx, ast::FunctionProto const *proto);
+void createLifetimeStartCall(codegen::Context *ctx, llvm::Value *obj, llvm::BasicBlock *lifetime_bb);
+void createLifetimeEndCall(codegen::Context *ctx, llvm::Value *obj, llvm::BasicBlock *lifetime_bb);
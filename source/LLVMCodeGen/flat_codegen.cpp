@@ -0,0 +1,513 @@
+/* Codegen over a flat::Tree. Mirrors the codegen methods of the ast.hpp nodes in codegen.cpp node for node (same
+ * basic blocks, same value names, same diagnostics), so the two paths can be compared IR for IR. Every node kind is
+ * handled by one function here, dispatched on the kind array instead of a vtable.
+ */
+
+#include "LLVMCodeGen/flat_codegen.hpp"
+
+namespace {
+typedef struct Walk {
+    codegen::Context *ctx;
+    flat::TreeView const *tree;
+    /// see flat::alwaysReturns, nothing is emitted after a node that always returns
+    std::vector<bool> always_returns;
+} Walk;
+
+llvm::Value *genNode(Walk *w, flat::NodeId id);
+
+void pushError(codegen::Context *ctx, codegen::CodeGenException &e) {
+    ctx->errors->push_back(codegen::Error {
+        .loc = e.m_loc,
+        .msg = std::move(e.m_message),
+    });
+}
+
+/// nullptr if the condition always returns
+llvm::Value *genCondition(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    llvm::Value *value = genNode(w, id);
+    if (w->always_returns[id])
+        return nullptr;
+    return ctx->builder->CreateICmpNE(value, llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), "condtmp");
+}
+
+llvm::Value *genBinaryOp(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    llvm::Value *lhs = genNode(w, w->tree->child(id, 0));
+    if (w->always_returns[w->tree->child(id, 0)])
+        return nullptr;
+    llvm::Value *rhs = genNode(w, w->tree->child(id, 1));
+    if (w->always_returns[w->tree->child(id, 1)])
+        return nullptr;
+    assertNonNull(lhs);
+    assertNonNull(rhs);
+    auto op = static_cast<ast::BinaryOpType>(w->tree->ops[id]);
+    switch (op) {
+        case ast::BinaryOpType::add:
+            return ctx->builder->CreateAdd(lhs, rhs, "addtmp");
+        case ast::BinaryOpType::sub:
+            return ctx->builder->CreateSub(lhs, rhs, "subtmp");
+        case ast::BinaryOpType::mul:
+            return ctx->builder->CreateMul(lhs, rhs, "multmp");
+        case ast::BinaryOpType::div:
+            return ctx->builder->CreateUDiv(lhs, rhs, "divtmp");
+        case ast::BinaryOpType::mod:
+            return ctx->builder->CreateURem(lhs, rhs, "modulotmp");
+        case ast::BinaryOpType::invalid:
+            throw codegen::CodeGenException("encountered an invalid binary operation", w->tree->loc(id));
+        default:
+            throw std::runtime_error("invalid value of enum class BinaryOpType: " + std::to_string(static_cast<uint32_t>(op)));
+    }
+}
+
+llvm::Value *genUnaryOp(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    llvm::Value *rhs = genNode(w, w->tree->child(id, 0));
+    if (w->always_returns[w->tree->child(id, 0)])
+        return nullptr;
+    assertNonNull(rhs);
+    auto op = static_cast<ast::UnaryOpType>(w->tree->ops[id]);
+    switch (op) {
+        case ast::UnaryOpType::neg:
+            return ctx->builder->CreateSub(llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), rhs, "negtmp");
+        case ast::UnaryOpType::invalid:
+            throw codegen::CodeGenException("encountered an invalid unary operation", w->tree->loc(id));
+        default:
+            throw std::runtime_error("invalid value of enum class BinaryOpType: " + std::to_string(static_cast<uint32_t>(op)));
+    }
+}
+
+llvm::Value *genVarRef(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    symbol::Id name = w->tree->symbol(id);
+    llvm::AllocaInst *var_ptr = lookupVariable(ctx, name);
+    if (!var_ptr)
+        throw codegen::CodeGenException(std::string("use of undeclared variable '") + symbol::name(name) + "'", w->tree->loc(id));
+    return ctx->builder->CreateLoad(ctx->builder->getInt8Ty(), var_ptr, symbol::name(name) + "_loadtmp");
+}
+
+llvm::Value *genConstant(Walk *w, flat::NodeId id) {
+    return llvm::ConstantInt::get(*w->ctx->llvm_ctx, llvm::APInt(8, w->tree->constants[w->tree->payloads[id]], false));
+}
+
+llvm::Value *genFunctionCall(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    symbol::Id name_id = w->tree->symbol(id);
+    uint32_t n_args = w->tree->childCount(id);
+    std::string const &name = symbol::name(name_id);
+    llvm::Function *callee = ctx->module->getFunction(name);
+    if (!callee) {
+        auto proto = ast::FunctionProto {
+            .name = name_id,
+            .args = ast::Vec<symbol::Id>(n_args, symbol::intern("arg")),
+            .is_extern = true,
+            .is_fastcc = true
+        };
+        createPrototype(ctx, &proto);
+    }
+    callee = ctx->module->getFunction(name);
+    if (!callee)
+        throw codegen::CodeGenException(std::string("failed to generate prototype for function '") + name + "'", w->tree->loc(id));
+    if (callee->arg_size() != n_args)
+        throw codegen::CodeGenException("incorrect function signature for function '" + name + "': function takes "
+                               + std::to_string(callee->arg_size()) + " args, not " + std::to_string(n_args), w->tree->loc(id));
+    std::vector<llvm::Value*> args;
+    args.reserve(n_args);
+    for (uint32_t i = 0; i < n_args; i++) {
+        args.push_back(genNode(w, w->tree->child(id, i)));
+        if (w->always_returns[w->tree->child(id, i)])
+            return nullptr;
+    }
+    return ctx->builder->CreateCall(callee, std::move(args), "calltmp");
+}
+
+llvm::Value *genGlobalDeclAssignment(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    symbol::Id name = w->tree->symbol(id);
+    if (w->tree->childCount(id))
+        throw codegen::CodeGenException("global variables do currently not support immediate initialization (I recommend creating a globalInit function that is called at the start of main instead)", w->tree->loc(id));
+    if (ctx->state->symbols.isGlobal(name))
+        throw codegen::CodeGenException("global variables must currently not be redefined (TODO: keep track of gvars manually to allow for that)", w->tree->loc(id));
+    new llvm::GlobalVariable(
+        *ctx->module,
+        ctx->builder->getInt8Ty(),
+        /*isConstant*/ false,
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::PoisonValue::get(ctx->builder->getInt8Ty()),
+        symbol::name(name)
+    );
+    ctx->state->symbols.declareGlobal(name);
+    return nullptr;
+}
+
+llvm::Value *genToplevelBlock(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    auto const *tree = w->tree;
+    codegen::State *state = ctx->state;
+    state->symbols.enterScope();
+    uint32_t scope_depth = state->symbols.depth();
+    uint32_t n_statements = tree->childCount(id);
+    for (uint32_t i = 0; i < n_statements; i++) {
+        flat::NodeId stmt = tree->child(id, i);
+        if (tree->kinds[stmt] == flat::NodeKind::function_def)
+            createPrototype(ctx, &tree->protos[tree->payloads[stmt]]);
+    }
+    for (uint32_t i = 0; i < n_statements; i++) {
+        flat::NodeId stmt = tree->child(id, i);
+        if (tree->kinds[stmt] == flat::NodeKind::function_def) {
+            try {
+                genNode(w, stmt);
+            } catch (codegen::CodeGenException e) {
+                state->symbols.leaveScopesUntil(scope_depth);
+                state->declarations_block = nullptr;
+                pushError(ctx, e);
+            }
+        } else if (tree->kinds[stmt] == flat::NodeKind::decl_assignment) {
+            genGlobalDeclAssignment(w, stmt);
+        } else
+            throw std::runtime_error("parser generated other statement type in toplevel even though it should only generate function defs and decl assignments");
+    }
+    state->symbols.leaveScope();
+    if (llvm::verifyModule(*ctx->module))
+        ctx->errors->push_back(codegen::Error {.loc = tree->loc(id), .msg = "Could not compile module"});
+    return nullptr;
+}
+
+llvm::Value *genBlock(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    auto const *tree = w->tree;
+    uint8_t flags = tree->ops[id];
+    if (flags & FLAT_BLOCK_TOPLEVEL)
+        return genToplevelBlock(w, id);
+
+    codegen::State *state = ctx->state;
+    state->symbols.enterScope();
+    uint32_t scope_depth = state->symbols.depth();
+    llvm::Function *parent_fn = ctx->builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock *decl_lifetime_start_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "block_lifetimes_start", parent_fn);
+    llvm::BasicBlock *block_entry_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "block_entry", parent_fn);
+    ctx->builder->CreateBr(decl_lifetime_start_bb);
+    ctx->builder->SetInsertPoint(block_entry_bb);
+
+    bool has_result = flags & FLAT_BLOCK_HAS_RESULT;
+    uint32_t n_statements = tree->childCount(id) - has_result;
+    std::vector<llvm::Value*> alloca_ptrs_of_decls;
+    bool has_returned = false;
+    for (uint32_t i = 0; i < n_statements && !has_returned; i++) {
+        flat::NodeId stmt = tree->child(id, i);
+        if (tree->kinds[stmt] == flat::NodeKind::decl_assignment) {
+            try {
+                llvm::Value *var = genNode(w, stmt);
+                assertNonNull(var);
+                createLifetimeStartCall(ctx, var, decl_lifetime_start_bb);
+                alloca_ptrs_of_decls.push_back(var);
+            } catch (codegen::CodeGenException e) {
+                state->symbols.leaveScopesUntil(scope_depth);
+                pushError(ctx, e);
+                if (w->always_returns[stmt])
+                    terminateFailedReturn(ctx);
+                alloca_ptrs_of_decls.push_back(nullptr);
+            }
+        } else if (tree->kinds[stmt] == flat::NodeKind::function_def)
+            throw std::runtime_error("parser accepted and constructed a function def in a non-toplevel scope");
+        else {
+            try {
+                genNode(w, stmt);
+            } catch (codegen::CodeGenException e) {
+                state->symbols.leaveScopesUntil(scope_depth);
+                pushError(ctx, e);
+                if (w->always_returns[stmt])
+                    terminateFailedReturn(ctx);
+            }
+            alloca_ptrs_of_decls.push_back(nullptr);
+        }
+        // even if the statement failed, its block was terminated in place of the ret
+        has_returned = w->always_returns[stmt];
+        // the result is the last child
+        if (has_returned && i + 1 < tree->childCount(id))
+            pushUnreachableWarning(ctx, tree->loc(tree->child(id, i + 1)));
+    }
+
+    llvm::Value *result = nullptr;
+    if (has_result && !has_returned) {
+        try {
+            result = genNode(w, tree->child(id, n_statements));
+        } catch (codegen::CodeGenException e) {
+            state->symbols.leaveScopesUntil(scope_depth);
+            pushError(ctx, e);
+            if (w->always_returns[tree->child(id, n_statements)])
+                terminateFailedReturn(ctx);
+        }
+    }
+
+    auto saved_ip = ctx->builder->saveIP();
+    ctx->builder->SetInsertPoint(decl_lifetime_start_bb);
+    ctx->builder->CreateBr(block_entry_bb);
+    ctx->builder->restoreIP(saved_ip);
+    if (w->always_returns[id]) {
+        // the end of the block is never reached, and neither are the ends of the lifetimes
+        state->symbols.leaveScope();
+        return nullptr;
+    }
+    llvm::BasicBlock *decl_lifetime_end_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "block_lifetimes_end");
+    ctx->builder->CreateBr(decl_lifetime_end_bb);
+    parent_fn->insert(parent_fn->end(), decl_lifetime_end_bb);
+    ctx->builder->SetInsertPoint(decl_lifetime_end_bb);
+    for (auto const &alloca_ptr : alloca_ptrs_of_decls) {
+        if (alloca_ptr != nullptr)
+            createLifetimeEndCall(ctx, alloca_ptr, decl_lifetime_end_bb);
+    }
+
+    state->symbols.leaveScope();
+    return result;
+}
+
+llvm::Value *genIf(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    auto const *tree = w->tree;
+    llvm::Value *condition = genCondition(w, tree->child(id, 0));
+    if (!condition)
+        return nullptr;
+    llvm::Function *parent_fn = ctx->builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock *cond_true_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "cond_true", parent_fn);
+    llvm::BasicBlock *cond_false_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "cond_false");
+    llvm::BasicBlock *post_if_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "post_if");
+
+    // create conditional branch
+    llvm::AllocaInst *if_result = allocaInDeclBlock(ctx, ctx->builder->getInt8Ty(), "if_result");
+    ctx->builder->CreateCondBr(condition, cond_true_bb, cond_false_bb);
+
+    // condition true branch
+    ctx->builder->SetInsertPoint(cond_true_bb);
+    llvm::Value *cond_true_result = genNode(w, tree->child(id, 1));
+    bool true_returns = w->always_returns[tree->child(id, 1)];
+    if (!true_returns) {
+        if (cond_true_result)
+            ctx->builder->CreateStore(cond_true_result, if_result);
+        else
+            ctx->builder->CreateStore(llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), if_result);
+        ctx->builder->CreateBr(post_if_bb);
+    }
+
+    // condition false branch
+    parent_fn->insert(parent_fn->end(), cond_false_bb);
+    ctx->builder->SetInsertPoint(cond_false_bb);
+    llvm::Value *cond_false_result = nullptr;
+    if (tree->childCount(id) == 3)
+        cond_false_result = genNode(w, tree->child(id, 2));
+    bool false_returns = tree->childCount(id) == 3 && w->always_returns[tree->child(id, 2)];
+
+    // a branch that always returns has no value, so it fits the type of the other one
+    if (!true_returns && !false_returns && (cond_true_result != nullptr || cond_false_result != nullptr)) {
+        std::optional<std::string> message = std::nullopt;
+        if (cond_true_result == nullptr && cond_false_result != nullptr)
+            message = std::string("incompatible result types of true and false branch of if condition; true branch type: void; false branch type: ")
+                + llvmTypeAsString(cond_false_result->getType());
+        else if (cond_true_result != nullptr && cond_false_result == nullptr)
+            message = std::string("incompatible result types of true and false branch of if condition; true branch type: ")
+                + llvmTypeAsString(cond_true_result->getType())
+                + "; false branch type: void";
+        else if (cond_true_result->getType() != cond_false_result->getType())
+            message = std::string("incompatible result types of true and false branch of if condition; true branch type: ")
+                + llvmTypeAsString(cond_true_result->getType())
+                + "; false branch type: "
+                + llvmTypeAsString(cond_false_result->getType());
+        if (message)
+            ctx->warnings->push_back(codegen::Warning {
+                .loc = tree->loc(id),
+                .msg = std::move(message.value()),
+            });
+    }
+
+    if (!false_returns) {
+        if (cond_false_result)
+            ctx->builder->CreateStore(cond_false_result, if_result);
+        else
+            ctx->builder->CreateStore(llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)), if_result);
+        ctx->builder->CreateBr(post_if_bb);
+    }
+    if (true_returns && false_returns) {
+        // nothing branches to it
+        delete post_if_bb;
+        return nullptr;
+    }
+
+    // post if block (where codegen continues)
+    parent_fn->insert(parent_fn->end(), post_if_bb);
+    ctx->builder->SetInsertPoint(post_if_bb);
+    return ctx->builder->CreateLoad(ctx->builder->getInt8Ty(), if_result, "if_result.loadtmp");
+}
+
+/// while and for loops: for loops additionally run init before and update at the end of every iteration
+llvm::Value *genLoop(Walk *w, flat::NodeId id, flat::NodeId init, flat::NodeId condition_id, flat::NodeId update, flat::NodeId branch, char const *post_name) {
+    auto *ctx = w->ctx;
+    llvm::Function *parent_fn = ctx->builder->GetInsertBlock()->getParent();
+    if (init != FLAT_NO_NODE) {
+        genNode(w, init);
+        if (w->always_returns[init])
+            return nullptr;
+    }
+
+    // create condition block
+    // TODO support implicit returns from breaks
+    llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "cond_block", parent_fn);
+    ctx->builder->CreateBr(cond_bb);
+    ctx->builder->SetInsertPoint(cond_bb);
+    llvm::Value *condition = genCondition(w, condition_id);
+    if (!condition)
+        return nullptr;
+    llvm::BasicBlock *loop_body_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "loop_body");
+    llvm::BasicBlock *post_loop_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, post_name);
+    ctx->builder->CreateCondBr(condition, loop_body_bb, post_loop_bb);
+
+    // loop body branch
+    parent_fn->insert(parent_fn->end(), loop_body_bb);
+    ctx->builder->SetInsertPoint(loop_body_bb);
+    if (genNode(w, branch) != nullptr)
+        throw std::runtime_error("return values from loops not supported at the moment");
+    if (!w->always_returns[branch]) {
+        if (update != FLAT_NO_NODE)
+            genNode(w, update);
+        if (update == FLAT_NO_NODE || !w->always_returns[update])
+            ctx->builder->CreateBr(cond_bb);
+    }
+
+    // after the loop
+    parent_fn->insert(parent_fn->end(), post_loop_bb);
+    ctx->builder->SetInsertPoint(post_loop_bb);
+    return nullptr;
+}
+
+llvm::Value *genFunctionDef(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    auto const &proto = w->tree->protos[w->tree->payloads[id]];
+    llvm::Function *fn = ctx->module->getFunction(symbol::name(proto.name));
+    if (!fn)
+        throw std::runtime_error("no forward declaration has been auto-generated for this function");
+    else if (!fn->empty())
+        throw codegen::CodeGenException(std::string("redefinition of function '") + symbol::name(proto.name) + "'", w->tree->loc(id));
+    llvm::BasicBlock *declarations_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "declarations_block", fn);
+    llvm::BasicBlock *entry_bb = llvm::BasicBlock::Create(*ctx->llvm_ctx, "entry");
+    ctx->builder->SetInsertPoint(declarations_bb);
+
+    codegen::State *state = ctx->state;
+    llvm::BasicBlock *old_declarations_block = state->declarations_block;
+    state->declarations_block = declarations_bb;
+    state->symbols.enterScope();
+
+    uint32_t i = 0;
+    for (llvm::Argument const &arg_val : fn->args()) {
+        llvm::AllocaInst *alloca = allocaInDeclBlock(ctx, ctx->builder->getInt8Ty(), arg_val.getName().data());
+        state->symbols.declare(proto.args[i++], alloca);
+    }
+
+    fn->insert(fn->end(), entry_bb);
+    ctx->builder->SetInsertPoint(entry_bb);
+
+    for (llvm::Argument &arg_val : fn->args()) {
+        // of arguments with the same name, the last one is bound and all of them are stored to its slot
+        llvm::AllocaInst *alloca = state->symbols.local(proto.args[arg_val.getArgNo()]);
+        ctx->builder->CreateStore(&arg_val, alloca);
+    }
+
+    llvm::Value *implicit_ret = genNode(w, w->tree->child(id, 0));
+    // a body that always returns has no end to fall off, so it gets no implicit return
+    if (!w->always_returns[w->tree->child(id, 0)]) {
+        if (implicit_ret)
+            ctx->builder->CreateRet(implicit_ret);
+        else
+            ctx->builder->CreateRet(llvm::ConstantInt::get(*ctx->llvm_ctx, llvm::APInt(8, 0, false)));
+    }
+    ctx->builder->SetInsertPoint(declarations_bb);
+    ctx->builder->CreateBr(entry_bb);
+    state->symbols.leaveScope();
+    state->declarations_block = old_declarations_block;
+
+    llvm::verifyFunction(*fn);
+    return nullptr;
+}
+
+llvm::Value *genDeclAssignment(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    symbol::Id name = w->tree->symbol(id);
+    llvm::AllocaInst *var = allocaInDeclBlock(ctx, ctx->builder->getInt8Ty(), symbol::name(name).c_str());
+    if (w->tree->childCount(id)) {
+        llvm::Value *value = genNode(w, w->tree->child(id, 0));
+        if (!w->always_returns[w->tree->child(id, 0)])
+            ctx->builder->CreateStore(value, var);
+    }
+    ctx->state->symbols.declare(name, var);
+    return var;
+}
+
+llvm::Value *genAssignment(Walk *w, flat::NodeId id) {
+    auto *ctx = w->ctx;
+    auto const *tree = w->tree;
+    llvm::Value *value = genNode(w, tree->child(id, 1));
+    if (w->always_returns[tree->child(id, 1)])
+        return nullptr;
+
+    flat::NodeId key = tree->child(id, 0);
+    if (tree->kinds[key] != flat::NodeKind::var_ref)
+        throw codegen::CodeGenException("invalid lhs for assignment: lhs must be either an identifier (or in the future, a dereference of some expression)", tree->loc(id));
+    symbol::Id name = tree->symbol(key);
+    llvm::AllocaInst *var = lookupVariable(ctx, name);
+    if (!var)
+        throw codegen::CodeGenException(std::string("use of undeclared variable '") + symbol::name(name) + "'", tree->loc(id));
+    ctx->builder->CreateStore(value, var);
+    return nullptr;
+}
+
+llvm::Value *genNode(Walk *w, flat::NodeId id) {
+    if (stackIsLow())
+        return onNewStack([&] { return genNode(w, id); });
+    auto const *tree = w->tree;
+    switch (tree->kinds[id]) {
+        case flat::NodeKind::unary_op:
+            return genUnaryOp(w, id);
+        case flat::NodeKind::binary_op:
+            return genBinaryOp(w, id);
+        case flat::NodeKind::constant:
+            return genConstant(w, id);
+        case flat::NodeKind::var_ref:
+            return genVarRef(w, id);
+        case flat::NodeKind::function_call:
+            return genFunctionCall(w, id);
+        case flat::NodeKind::block:
+            return genBlock(w, id);
+        case flat::NodeKind::if_:
+            return genIf(w, id);
+        case flat::NodeKind::while_:
+            return genLoop(w, id, FLAT_NO_NODE, tree->child(id, 0), FLAT_NO_NODE, tree->child(id, 1), "post_while");
+        case flat::NodeKind::for_:
+            return genLoop(w, id, tree->child(id, 0), tree->child(id, 1), tree->child(id, 2), tree->child(id, 3), "post_for");
+        case flat::NodeKind::assignment:
+            return genAssignment(w, id);
+        case flat::NodeKind::decl_assignment:
+            return genDeclAssignment(w, id);
+        case flat::NodeKind::function_def:
+            return genFunctionDef(w, id);
+        case flat::NodeKind::return_: {
+            llvm::Value *value = genNode(w, tree->child(id, 0));
+            // the value may have returned already, eg return { return x; };
+            if (!w->always_returns[tree->child(id, 0)])
+                w->ctx->builder->CreateRet(value);
+            return nullptr;
+        }
+        case flat::NodeKind::expr_stmt:
+            genNode(w, tree->child(id, 0));
+            return nullptr;
+    }
+    throw std::runtime_error("invalid value of enum class flat::NodeKind: " + std::to_string(static_cast<uint32_t>(tree->kinds[id])));
+}
+}  // namespace
+
+void codegen::codegenFlat(Context *ctx, flat::TreeView const *tree) {
+    Walk w = {.ctx = ctx, .tree = tree, .always_returns = flat::alwaysReturns(*tree)};
+    genNode(&w, tree->root);
+}
+
+void codegen::codegenFlat(Context *ctx, flat::Tree const *tree) {
+    flat::TreeView view = tree->view();
+    codegenFlat(ctx, &view);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "LLVMCodeGen/codegen.hpp"
+#include "flat_ast.hpp"
+
+namespace codegen {
+/// generate the module of a flattened file. Produces the same IR, errors and warnings as codegen on the ast.hpp tree
+/// it was flattened from, but walks the node arrays by index instead of chasing pointers between nodes.
+void codegenFlat(Context *ctx, flat::Tree const *tree);
+/// same on a view, eg of a binary AST file that was mapped into memory instead of parsing the source
+void codegenFlat(Context *ctx, flat::TreeView const *tree);
+}  // namespace codegen
@@ -1,5 +1,4 @@
 #include "LLVMCodeGen/optimization.hpp"
-#include "LLVMCodeGen/cleanup_pass.hpp"
 #include "llvm/Pass.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
@@ -58,7 +57,6 @@ void codegen::optimizeModule(
     std::string pre_mod_ir;
     std::string post_mod_ir;
     // with O3 opt level, the opt passes are run until there are no changes in the IR anymore
-    bool is_first_run = true;
     do {
         llvm::LoopAnalysisManager lam;
         llvm::FunctionAnalysisManager fam;
@@ -76,8 +74,6 @@ void codegen::optimizeModule(
         pb.crossRegisterProxies(lam, fam, cgam, mam);
 
         llvm::ModulePassManager mpm;
-        if (is_first_run)
-            mpm.addPass(codegen::CleanupPass());
         mpm.addPass(llvm::VerifierPass());
         mpm.addPass(pb.buildPerModuleDefaultPipeline(opt_level));
 
@@ -90,7 +86,6 @@ void codegen::optimizeModule(
             writeModuleToString(module, post_mod_ir);
 
         n_max_pipeline_runs--;
-        is_first_run = false;
     } while (opt_level_ == OptLevel::O3 && n_max_pipeline_runs && pre_mod_ir != post_mod_ir);
 }
 
@@ -117,7 +112,6 @@ void codegen::batchOptimizeModules(
         std::string pre_mod_ir;
         std::string post_mod_ir;
         // with O3 opt level, the opt passes are run until there are no changes in the IR anymore
-        bool is_first_run = true;
         do {
             llvm::LoopAnalysisManager lam;
             llvm::FunctionAnalysisManager fam;
@@ -135,8 +129,6 @@ void codegen::batchOptimizeModules(
             pb.crossRegisterProxies(lam, fam, cgam, mam);
 
             llvm::ModulePassManager mpm;
-            if (is_first_run)
-                mpm.addPass(codegen::CleanupPass());
             mpm.addPass(llvm::VerifierPass());
             mpm.addPass(pb.buildPerModuleDefaultPipeline(opt_level));
 
@@ -149,7 +141,6 @@ void codegen::batchOptimizeModules(
                 writeModuleToString(module, post_mod_ir);
 
             n_max_pipeline_runs--;
-            is_first_run = false;
         } while (opt_level_ == OptLevel::O3 && n_max_pipeline_runs && pre_mod_ir != post_mod_ir);
     }
 }
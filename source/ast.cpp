@@ -1,33 +1,43 @@
 #include "ast.hpp"
+#include "ast_visitor.hpp"
+#include "output_sink.hpp"
 
-ast::Expr::Expr(LocationInfo loc) : m_loc(loc)
+ast::Arena::Arena() : m_resource(AST_ARENA_INITIAL_BLOCK_SIZE)
 {}
 
-std::string ast::Expr::toJsonString() const {
-    throw std::runtime_error("called toJsonString on abstract type ast::Expr");
-}
+ast::Arena::Arena(void *buffer, size_t size) : m_resource(buffer, size)
+{}
 
-ast::ExprKind ast::Expr::getKind() const {
-    return ast::ExprKind::abstract_expr_type;
+ast::Arena *ast::Arena::spawn() {
+    m_children.push_back(std::make_unique<Arena>());
+    return m_children.back().get();
 }
 
-std::string const &ast::Expr::getVarName() const {
-    throw std::runtime_error("called getVarName on non-ident ast node");
+void ast::Arena::reset() {
+    m_children.clear();
+    m_resource.release();
 }
 
-ast::Statement::Statement(LocationInfo loc) : m_loc(loc)
+ast::Expr::Expr(LocationInfo loc, ast::ExprKind kind) : m_loc(loc), m_kind(kind)
 {}
 
-std::string ast::Statement::toJsonString() const {
-    throw std::runtime_error("called toJsonString on abstract type ast::Statement");
+std::string ast::Expr::toJsonString() const {
+    std::string result;
+    OutputSink out(&result);
+    writeJson(&out);
+    out.flush();
+    return result;
 }
 
-ast::StatementKind ast::Statement::getKind() const {
-    return ast::StatementKind::abstract_statement_type;
-}
+ast::Statement::Statement(LocationInfo loc, ast::StatementKind kind) : m_loc(loc), m_kind(kind)
+{}
 
-ast::FunctionProto const &ast::Statement::getProto() const {
-    throw std::runtime_error("called getProto on non-function-def ast node");
+std::string ast::Statement::toJsonString() const {
+    std::string result;
+    OutputSink out(&result);
+    writeJson(&out);
+    out.flush();
+    return result;
 }
 
 #define BOTFFTT_MAP(kind, mapped) if (t == token::TokenType::kind) return BinaryOpType::mapped
@@ -61,294 +71,431 @@ std::string ast::unaryOpTypeToString(ast::UnaryOpType t) {
     return "invalid";
 }
 
-std::string jsonLocPrefix(LocationInfo loc) {
-    return std::string("{\"line\": ") + std::to_string(loc.line) + ", \"file\": \"" + loc.file.start + "\", ";
-}
-
 ast::BinaryOp::BinaryOp(
     LocationInfo loc,
-    std::unique_ptr<Expr> lhs,
-    std::unique_ptr<Expr> rhs,
+    Ptr<Expr> lhs,
+    Ptr<Expr> rhs,
     ast::BinaryOpType op
-) : ast::Expr(loc), m_lhs(std::move(lhs)), m_rhs(std::move(rhs)), m_op(op)
-{}
-
-std::string ast::BinaryOp::toJsonString() const {
-    return jsonLocPrefix(m_loc) + "\"kind\": \"binary_op\", \"op\": \""
-        + ast::binaryOpTypeToString(m_op)
-        + "\", \"lhs\": "
-        + m_lhs->toJsonString()
-        + ", \"rhs\": "
-        + m_rhs->toJsonString()
-        + "}";
-}
-
-ast::ExprKind ast::BinaryOp::getKind() const {
-    return ast::ExprKind::binary_op;
+) : ast::Expr(loc, ast::ExprKind::binary_op), m_lhs(std::move(lhs)), m_rhs(std::move(rhs)), m_op(op)
+{
+    m_always_returns = m_lhs->alwaysReturns() || m_rhs->alwaysReturns();
 }
 
 ast::UnaryOp::UnaryOp(
     LocationInfo loc,
-    std::unique_ptr<Expr> rhs,
+    Ptr<Expr> rhs,
     ast::UnaryOpType op
-) : ast::Expr(loc), m_rhs(std::move(rhs)), m_op(op)
-{}
-
-std::string ast::UnaryOp::toJsonString() const {
-    return jsonLocPrefix(m_loc)
-        + "\"kind\": \"unary_op\", \"op\": \""
-        + ast::unaryOpTypeToString(m_op)
-        + "\", \"rhs\": "
-        + m_rhs->toJsonString()
-        + "}";
-}
-
-ast::ExprKind ast::UnaryOp::getKind() const {
-    return ast::ExprKind::unary_op;
+) : ast::Expr(loc, ast::ExprKind::unary_op), m_rhs(std::move(rhs)), m_op(op)
+{
+    m_always_returns = m_rhs->alwaysReturns();
 }
 
 ast::VarRef::VarRef(
     LocationInfo loc,
-    std::string name
-) : ast::Expr(loc), m_name(std::move(name))
+    symbol::Id name
+) : ast::Expr(loc, ast::ExprKind::var_ref), m_name(name)
 {}
 
-std::string ast::VarRef::toJsonString() const {
-    return jsonLocPrefix(m_loc) + "\"kind\": \"var_ref\", \"name\": \"" + m_name + "\"}";
-}
-
-ast::ExprKind ast::VarRef::getKind() const {
-    return ast::ExprKind::var_ref;
-}
-
-std::string const &ast::VarRef::getVarName() const {
-    return m_name;
-}
-
 ast::Constant::Constant(
     LocationInfo loc,
     uint64_t value
-) : ast::Expr(loc), m_value(value)
+) : ast::Expr(loc, ast::ExprKind::constant), m_value(value)
 {}
 
-std::string ast::Constant::toJsonString() const {
-    return jsonLocPrefix(m_loc) + "\"kind\": \"constant\", \"value\": " + std::to_string(m_value) + "}";
-}
-
-ast::ExprKind ast::Constant::getKind() const {
-    return ast::ExprKind::constant;
-}
-
 ast::FunctionCall::FunctionCall(
     LocationInfo loc,
-    std::string name,
-    std::vector<std::unique_ptr<Expr>> args
-) : ast::Expr(loc), m_name(std::move(name)), m_args(std::move(args))
-{}
-
-std::string ast::FunctionCall::toJsonString() const {
-    std::string result = jsonLocPrefix(m_loc) + "\"kind\": \"function_call\", \"name\": \"" + m_name + "\", \"args\": [";
-    for (uint32_t i = 0; i < m_args.size(); i++) {
-        result += m_args[i]->toJsonString();
-        if (i != m_args.size() - 1)
-            result += ", ";
-    }
-    return result + "]}";
-}
-
-ast::ExprKind ast::FunctionCall::getKind() const {
-    return ast::ExprKind::function_call;
+    symbol::Id name,
+    Vec<Ptr<Expr>> args
+) : ast::Expr(loc, ast::ExprKind::function_call), m_name(name), m_args(std::move(args))
+{
+    for (auto const &arg : m_args)
+        m_always_returns |= arg->alwaysReturns();
 }
 
 ast::Block::Block(
     LocationInfo loc,
-    std::vector<std::unique_ptr<Statement>> statements,
-    std::optional<std::unique_ptr<Expr>> result,
+    Vec<Ptr<Statement>> statements,
+    std::optional<Ptr<Expr>> result,
     bool is_toplevel
-) : ast::Expr(loc), m_statements(std::move(statements)), m_result(std::move(result)), m_is_toplevel(is_toplevel)
-{}
-
-std::string ast::Block::toJsonString() const {
-    std::string result = jsonLocPrefix(m_loc) + "\"kind\": \"block\", \"statements\": [";
-    for (uint32_t i = 0; i < m_statements.size(); i++) {
-        result += m_statements[i]->toJsonString();
-        if (i != m_statements.size() - 1)
-            result += ", ";
-    }
-    result += "], \"result\": ";
+) : ast::Expr(loc, ast::ExprKind::block), m_statements(std::move(statements)), m_result(std::move(result)), m_is_toplevel(is_toplevel)
+{
+    for (auto const &stmt : m_statements)
+        m_always_returns |= stmt->alwaysReturns();
     if (m_result)
-        result += m_result.value()->toJsonString();
-    else
-        result += "null";
-    return result + "}";
-}
-
-ast::ExprKind ast::Block::getKind() const {
-    return ast::ExprKind::block;
+        m_always_returns |= (*m_result)->alwaysReturns();
 }
 
 ast::If::If(
     LocationInfo loc,
-    std::unique_ptr<Expr> condition,
-    std::unique_ptr<Expr> branch,
-    std::optional<std::unique_ptr<Expr>> else_branch
-) : ast::Expr(loc), m_condition(std::move(condition)), m_branch(std::move(branch)), m_else_branch(std::move(else_branch))
-{}
-
-std::string ast::If::toJsonString() const {
-    std::string result = jsonLocPrefix(m_loc) + "\"kind\": \"if\", \"condition\": " + m_condition->toJsonString() + ", \"branch\": " + m_branch->toJsonString() + ", \"else_branch\": ";
-    if (m_else_branch)
-        result += m_else_branch.value()->toJsonString();
-    else
-        result += "null";
-    return result + "}";
-}
-
-ast::ExprKind ast::If::getKind() const {
-    return ast::ExprKind::if_;
+    Ptr<Expr> condition,
+    Ptr<Expr> branch,
+    std::optional<Ptr<Expr>> else_branch
+) : ast::Expr(loc, ast::ExprKind::if_), m_condition(std::move(condition)), m_branch(std::move(branch)), m_else_branch(std::move(else_branch))
+{
+    m_always_returns = m_condition->alwaysReturns()
+        || (m_branch->alwaysReturns() && m_else_branch && (*m_else_branch)->alwaysReturns());
 }
 
 ast::While::While(
     LocationInfo loc,
-    std::unique_ptr<Expr> condition,
-    std::unique_ptr<Expr> branch
-) : ast::Expr(loc), m_condition(std::move(condition)), m_branch(std::move(branch))
-{}
-
-std::string ast::While::toJsonString() const {
-    return jsonLocPrefix(m_loc) + "\"kind\": \"while\", \"condition\": " + m_condition->toJsonString() + ", \"branch\": " + m_branch->toJsonString() + "}";
-}
-
-ast::ExprKind ast::While::getKind() const {
-    return ast::ExprKind::while_;
+    Ptr<Expr> condition,
+    Ptr<Expr> branch
+) : ast::Expr(loc, ast::ExprKind::while_), m_condition(std::move(condition)), m_branch(std::move(branch))
+{
+    // the body may not run at all
+    m_always_returns = m_condition->alwaysReturns();
 }
 
 ast::For::For(
     LocationInfo loc,
-    std::unique_ptr<Statement> init,
-    std::unique_ptr<Expr> condition,
-    std::unique_ptr<Statement> update,
-    std::unique_ptr<Expr> branch
-) : ast::Expr(loc), m_init(std::move(init)), m_condition(std::move(condition)), m_update(std::move(update)), m_branch(std::move(branch))
-{}
-
-std::string ast::For::toJsonString() const {
-    return jsonLocPrefix(m_loc)
-        + "\"kind\": \"for\", \"init\": "
-        + m_branch->toJsonString()
-        + ", \"condition\": "
-        + m_condition->toJsonString()
-        + ", \"update\": "
-        + m_update->toJsonString()
-        + ", \"branch\": "
-        + m_branch->toJsonString()
-        + "}";
-}
-
-ast::ExprKind ast::For::getKind() const {
-    return ast::ExprKind::for_;
+    Ptr<Statement> init,
+    Ptr<Expr> condition,
+    Ptr<Statement> update,
+    Ptr<Expr> branch
+) : ast::Expr(loc, ast::ExprKind::for_), m_init(std::move(init)), m_condition(std::move(condition)), m_update(std::move(update)), m_branch(std::move(branch))
+{
+    // the body and the update may not run at all
+    m_always_returns = m_init->alwaysReturns() || m_condition->alwaysReturns();
 }
 
 ast::FunctionDef::FunctionDef(
     LocationInfo loc,
-    std::string name,
-    std::vector<std::string> args,
-    std::unique_ptr<Block> block,
+    symbol::Id name,
+    Vec<symbol::Id> args,
+    Ptr<Block> block,
     bool is_extern,
     bool is_fastcc
-) : ast::Statement(loc), m_block(std::move(block))
-{
-    m_proto = ast::FunctionProto {
-        .name = std::move(name),
+) : ast::Statement(loc, ast::StatementKind::function_def),
+    // constructed in place: assigning would copy args out of the arena
+    m_proto {
+        .name = name,
         .args = std::move(args),
         .is_extern = is_extern,
         .is_fastcc = is_fastcc
-    };
-}
+    },
+    m_block(std::move(block))
+{}
 
 ast::FunctionDef::FunctionDef(
     LocationInfo loc,
     ast::FunctionProto proto,
-    std::unique_ptr<Block> block
-) : ast::Statement(loc), m_proto(std::move(proto)), m_block(std::move(block))
+    Ptr<Block> block
+) : ast::Statement(loc, ast::StatementKind::function_def), m_proto(std::move(proto)), m_block(std::move(block))
 {}
 
-ast::StatementKind ast::FunctionDef::getKind() const {
-    return ast::StatementKind::function_def;
-}
-
-std::string ast::FunctionDef::toJsonString() const {
-    std::string result = jsonLocPrefix(m_loc) + "\"kind\": \"function_def\", \"proto\": {\"name\": \"" + m_proto.name + "\", \"args\": [";
-    for (uint32_t i = 0; i < m_proto.args.size(); i++) {
-        result = result + "\"" + m_proto.args[i] + "\"";
-        if (i != m_proto.args.size() - 1)
-            result += ", ";
-    }
-    result = result + "]}, \"block\": " + m_block->toJsonString() + "}";
-    return result;
-}
-
 ast::FunctionProto const &ast::FunctionDef::getProto() const {
     return m_proto;
 }
 
 ast::DeclAssignment::DeclAssignment(
     LocationInfo loc,
-    std::string name,
-    std::optional<std::unique_ptr<Expr>> value
-) : ast::Statement(loc), m_name(std::move(name)), m_value(std::move(value))
-{}
-
-std::string ast::DeclAssignment::toJsonString() const {
-    auto result = jsonLocPrefix(m_loc) + "\"kind\": \"decl_assignment\", \"name\": \"" + m_name + "\", \"value\": ";
-    if (m_value)
-        result = result + m_value.value()->toJsonString() + "}";
-    return result;
-}
-
-ast::StatementKind ast::DeclAssignment::getKind() const {
-    return ast::StatementKind::decl_assignment;
+    symbol::Id name,
+    std::optional<Ptr<Expr>> value
+) : ast::Statement(loc, ast::StatementKind::decl_assignment), m_name(name), m_value(std::move(value))
+{
+    m_always_returns = m_value && (*m_value)->alwaysReturns();
 }
 
 ast::Assignment::Assignment(
     LocationInfo loc,
-    std::unique_ptr<Expr> key,
-    std::unique_ptr<Expr> value
-) : ast::Statement(loc), m_key(std::move(key)), m_value(std::move(value))
-{}
-
-std::string ast::Assignment::toJsonString() const {
-    return jsonLocPrefix(m_loc) + "\"kind\": \"assignment\", \"key\": " + m_key->toJsonString() + ", \"value\": " + m_value->toJsonString() + "}";
-}
-
-ast::StatementKind ast::Assignment::getKind() const {
-    return ast::StatementKind::assignment;
+    Ptr<Expr> key,
+    Ptr<Expr> value
+) : ast::Statement(loc, ast::StatementKind::assignment), m_key(std::move(key)), m_value(std::move(value))
+{
+    // the key is not evaluated, it names the variable
+    m_always_returns = m_value->alwaysReturns();
 }
 
 ast::Return::Return(
     LocationInfo loc,
-    std::unique_ptr<Expr> value
-) : ast::Statement(loc), m_value(std::move(value))
-{}
+    Ptr<Expr> value
+) : ast::Statement(loc, ast::StatementKind::return_), m_value(std::move(value))
+{
+    m_always_returns = true;
+}
 
-std::string ast::Return::toJsonString() const {
-    return jsonLocPrefix(m_loc) + "\"kind\": \"return\", \"value\": " + m_value->toJsonString() + "}";
+ast::ExprStmt::ExprStmt(
+    LocationInfo loc,
+    Ptr<Expr> expr
+) : ast::Statement(loc, ast::StatementKind::expr_stmt), m_expr(std::move(expr))
+{
+    m_always_returns = m_expr->alwaysReturns();
 }
 
-ast::StatementKind ast::Return::getKind() const {
-    return ast::StatementKind::return_;
+namespace ast {
+class JsonWriter : public Visitor<JsonWriter, void> {
+    OutputSink *m_out;
+
+    void writeLocPrefix(LocationInfo loc) {
+        m_out->writeCString("{\"line\": ");
+        m_out->writeUint(loc.line);
+        m_out->writeCString(", \"file\": \"");
+        m_out->writeCString(loc.file.start);
+        m_out->writeCString("\", ");
+    }
+
+public:
+    explicit JsonWriter(OutputSink *out) : m_out(out)
+    {}
+
+    void visitBinaryOp(BinaryOp const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"binary_op\", \"op\": \"");
+        m_out->write(binaryOpTypeToString(node->getOp()));
+        m_out->writeCString("\", \"lhs\": ");
+        visit(node->getLhs());
+        m_out->writeCString(", \"rhs\": ");
+        visit(node->getRhs());
+        m_out->writeChar('}');
+    }
+
+    void visitUnaryOp(UnaryOp const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"unary_op\", \"op\": \"");
+        m_out->write(unaryOpTypeToString(node->getOp()));
+        m_out->writeCString("\", \"rhs\": ");
+        visit(node->getRhs());
+        m_out->writeChar('}');
+    }
+
+    void visitConstant(Constant const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"constant\", \"value\": ");
+        m_out->writeUint(node->getValue());
+        m_out->writeChar('}');
+    }
+
+    void visitVarRef(VarRef const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"var_ref\", \"name\": \"");
+        m_out->write(symbol::name(node->getName()));
+        m_out->writeCString("\"}");
+    }
+
+    void visitFunctionCall(FunctionCall const *node) {
+        auto const &args = node->getArgs();
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"function_call\", \"name\": \"");
+        m_out->write(symbol::name(node->getName()));
+        m_out->writeCString("\", \"args\": [");
+        for (uint32_t i = 0; i < args.size(); i++) {
+            visit(args[i].get());
+            if (i != args.size() - 1)
+                m_out->writeCString(", ");
+        }
+        m_out->writeCString("]}");
+    }
+
+    void visitBlock(Block const *node) {
+        auto const &statements = node->getStatements();
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"block\", \"statements\": [");
+        for (uint32_t i = 0; i < statements.size(); i++) {
+            visit(statements[i].get());
+            if (i != statements.size() - 1)
+                m_out->writeCString(", ");
+        }
+        m_out->writeCString("], \"result\": ");
+        if (node->getResult())
+            visit(node->getResult());
+        else
+            m_out->writeCString("null");
+        m_out->writeChar('}');
+    }
+
+    void visitIf(If const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"if\", \"condition\": ");
+        visit(node->getCondition());
+        m_out->writeCString(", \"branch\": ");
+        visit(node->getBranch());
+        m_out->writeCString(", \"else_branch\": ");
+        if (node->getElseBranch())
+            visit(node->getElseBranch());
+        else
+            m_out->writeCString("null");
+        m_out->writeChar('}');
+    }
+
+    void visitWhile(While const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"while\", \"condition\": ");
+        visit(node->getCondition());
+        m_out->writeCString(", \"branch\": ");
+        visit(node->getBranch());
+        m_out->writeChar('}');
+    }
+
+    void visitFor(For const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"for\", \"init\": ");
+        visit(node->getBranch());
+        m_out->writeCString(", \"condition\": ");
+        visit(node->getCondition());
+        m_out->writeCString(", \"update\": ");
+        visit(node->getUpdate());
+        m_out->writeCString(", \"branch\": ");
+        visit(node->getBranch());
+        m_out->writeChar('}');
+    }
+
+    void visitFunctionDef(FunctionDef const *node) {
+        FunctionProto const &proto = node->getProto();
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"function_def\", \"proto\": {\"name\": \"");
+        m_out->write(symbol::name(proto.name));
+        m_out->writeCString("\", \"args\": [");
+        for (uint32_t i = 0; i < proto.args.size(); i++) {
+            m_out->writeChar('"');
+            m_out->write(symbol::name(proto.args[i]));
+            m_out->writeChar('"');
+            if (i != proto.args.size() - 1)
+                m_out->writeCString(", ");
+        }
+        m_out->writeCString("]}, \"block\": ");
+        visit(node->getBlock());
+        m_out->writeChar('}');
+    }
+
+    void visitDeclAssignment(DeclAssignment const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"decl_assignment\", \"name\": \"");
+        m_out->write(symbol::name(node->getName()));
+        m_out->writeCString("\", \"value\": ");
+        if (node->getValue()) {
+            visit(node->getValue());
+            m_out->writeChar('}');
+        }
+    }
+
+    void visitAssignment(Assignment const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"assignment\", \"key\": ");
+        visit(node->getKey());
+        m_out->writeCString(", \"value\": ");
+        visit(node->getValue());
+        m_out->writeChar('}');
+    }
+
+    void visitReturn(Return const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"return\", \"value\": ");
+        visit(node->getValue());
+        m_out->writeChar('}');
+    }
+
+    void visitExprStmt(ExprStmt const *node) {
+        writeLocPrefix(node->getLoc());
+        m_out->writeCString("\"kind\": \"expr_stmt\", \"expr\": ");
+        visit(node->getExpr());
+        m_out->writeChar('}');
+    }
+};
+
+/// every node moves its own location and passes the delta on to its children
+class LineShifter : public Visitor<LineShifter, void, void, true> {
+    int32_t m_delta;
+
+public:
+    explicit LineShifter(int32_t delta) : m_delta(delta)
+    {}
+
+    void visitBinaryOp(BinaryOp *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_lhs.get());
+        visit(node->m_rhs.get());
+    }
+
+    void visitUnaryOp(UnaryOp *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_rhs.get());
+    }
+
+    void visitConstant(Constant *node) {
+        node->m_loc.line += m_delta;
+    }
+
+    void visitVarRef(VarRef *node) {
+        node->m_loc.line += m_delta;
+    }
+
+    void visitFunctionCall(FunctionCall *node) {
+        node->m_loc.line += m_delta;
+        for (auto &arg : node->m_args)
+            visit(arg.get());
+    }
+
+    void visitBlock(Block *node) {
+        node->m_loc.line += m_delta;
+        for (auto &stmt : node->m_statements)
+            visit(stmt.get());
+        if (node->m_result)
+            visit(node->m_result->get());
+    }
+
+    void visitIf(If *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_condition.get());
+        visit(node->m_branch.get());
+        if (node->m_else_branch)
+            visit(node->m_else_branch->get());
+    }
+
+    void visitWhile(While *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_condition.get());
+        visit(node->m_branch.get());
+    }
+
+    void visitFor(For *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_init.get());
+        visit(node->m_condition.get());
+        visit(node->m_update.get());
+        visit(node->m_branch.get());
+    }
+
+    void visitFunctionDef(FunctionDef *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_block.get());
+    }
+
+    void visitDeclAssignment(DeclAssignment *node) {
+        node->m_loc.line += m_delta;
+        if (node->m_value)
+            visit(node->m_value->get());
+    }
+
+    void visitAssignment(Assignment *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_key.get());
+        visit(node->m_value.get());
+    }
+
+    void visitReturn(Return *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_value.get());
+    }
+
+    void visitExprStmt(ExprStmt *node) {
+        node->m_loc.line += m_delta;
+        visit(node->m_expr.get());
+    }
+};
+}  // namespace ast
+
+void ast::Expr::writeJson(OutputSink *out) const {
+    JsonWriter(out).visit(this);
 }
 
-ast::ExprStmt::ExprStmt(
-    LocationInfo loc,
-    std::unique_ptr<Expr> expr
-) : ast::Statement(loc), m_expr(std::move(expr))
-{}
+void ast::Statement::writeJson(OutputSink *out) const {
+    JsonWriter(out).visit(this);
+}
 
-std::string ast::ExprStmt::toJsonString() const {
-    return jsonLocPrefix(m_loc) + "\"kind\": \"expr_stmt\", \"expr\": " + m_expr->toJsonString() + "}";
+void ast::Expr::shiftLines(int32_t delta) {
+    LineShifter(delta).visit(this);
 }
 
-ast::StatementKind ast::ExprStmt::getKind() const {
-    return ast::StatementKind::expr_stmt;
+void ast::Statement::shiftLines(int32_t delta) {
+    LineShifter(delta).visit(this);
 }
@@ -2,15 +2,67 @@
 
 #include "lexer.hpp"
 #include "lib.hpp"
+#include "symbol.hpp"
 #include <cstdint>
 #include <memory>
+#include <memory_resource>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <optional>
 
+class OutputSink;
+
 namespace ast {
+/* AST nodes of a translation unit are allocated from an Arena: bump allocation into large blocks, and the whole tree
+ * is freed at once when the arena is reset or destroyed. No node destructors ever run, so every container inside a
+ * node must allocate from the same arena (see Arena::vec). Ptr keeps the move-only ownership semantics of unique_ptr
+ * for building the tree, but its deleter does nothing; a Ptr must not outlive the arena it points into.
+ */
+typedef struct NoopDeleter {
+    void operator()(void const *) const {}
+} NoopDeleter;
+
+template<typename T>
+using Ptr = std::unique_ptr<T, NoopDeleter>;
+
+template<typename T>
+using Vec = std::pmr::vector<T>;
+
+#define AST_ARENA_INITIAL_BLOCK_SIZE (64 * 1024)
+
+class Arena {
+    std::pmr::monotonic_buffer_resource m_resource;
+    std::vector<std::unique_ptr<Arena>> m_children;
+
+public:
+    Arena();
+    /// allocate from buffer (eg memory that is reused for every file) first and only go to the heap once it is full
+    Arena(void *buffer, size_t size);
+    Arena(Arena const &) = delete;
+    Arena &operator=(Arena const &) = delete;
+
+    template<typename T, typename... Args>
+    Ptr<T> make(Args &&...args) {
+        void *mem = m_resource.allocate(sizeof(T), alignof(T));
+        return Ptr<T>(new (mem) T(std::forward<Args>(args)...));
+    }
+
+    /// an empty vector that allocates from the arena (for the children of a node)
+    template<typename T>
+    Vec<T> vec() {
+        return Vec<T>(&m_resource);
+    }
+
+    /// a separate arena for another thread (an arena is not thread safe), owned by this one: its nodes are freed
+    /// together with the nodes of this arena
+    Arena *spawn();
+
+    /// free all nodes at once; every Ptr into the arena dangles afterwards. A buffer given to the constructor is reused.
+    void reset();
+};
+
 typedef enum class ExprKind {
     abstract_expr_type,
     unary_op,
@@ -34,34 +86,60 @@ typedef enum class StatementKind {
 } StatementKind;
 
 typedef struct FunctionProto {
-    std::string name;
-    std::vector<std::string> args;
+    symbol::Id name;
+    Vec<symbol::Id> args;
     bool is_extern;
     bool is_fastcc;
 } FunctionProto;
 
+/* The kind of a node is stored in it, so passes dispatch on it with a switch instead of a virtual call (see
+ * ast_visitor.hpp) and then read the children through the accessors of the concrete class; the nodes have no virtual
+ * functions at all, writeJson and shiftLines are passes too. The passes that rewrite the tree in place
+ * (ConstantFolder, see constant_folding.hpp, and LineShifter) are friends of the node classes instead.
+ */
 class Expr {
 protected:
     LocationInfo m_loc;
+    ExprKind m_kind;
+    /// set by the constructor of the concrete class from its children, see alwaysReturns
+    bool m_always_returns = false;
+    friend class LineShifter;
 
 public:
-    Expr(LocationInfo loc);
-    virtual std::string toJsonString() const;
-    virtual ExprKind getKind() const;
-    virtual std::string const &getVarName() const;
-    virtual void *codegen(void *ctx_) const;
+    Expr(LocationInfo loc, ExprKind kind);
+    /// the node and its subtree as json
+    std::string toJsonString() const;
+    /// stream the json of the node and its subtree into out
+    void writeJson(OutputSink *out) const;
+    ExprKind getKind() const { return m_kind; }
+    LocationInfo getLoc() const { return m_loc; }
+    /// whether every path through the node executes a return statement, so control never continues after it (like
+    /// the ! type of rust). Codegen emits nothing after such a node, and its value (if any) is never used.
+    bool alwaysReturns() const { return m_always_returns; }
+    /// move the locations of this node and its subtree delta lines (for a subtree that is reused after its text moved)
+    void shiftLines(int32_t delta);
 };
 
 class Statement {
 protected:
     LocationInfo m_loc;
+    StatementKind m_kind;
+    /// set by the constructor of the concrete class from its children, see alwaysReturns
+    bool m_always_returns = false;
+    friend class LineShifter;
 
 public:
-    Statement(LocationInfo loc);
-    virtual std::string toJsonString() const;
-    virtual StatementKind getKind() const;
-    virtual FunctionProto const &getProto() const;
-    virtual void *codegen(void *ctx_) const;
+    Statement(LocationInfo loc, StatementKind kind);
+    /// the node and its subtree as json
+    std::string toJsonString() const;
+    /// stream the json of the node and its subtree into out
+    void writeJson(OutputSink *out) const;
+    StatementKind getKind() const { return m_kind; }
+    LocationInfo getLoc() const { return m_loc; }
+    /// see Expr::alwaysReturns. A function definition never returns from the code around it (it runs no code there).
+    bool alwaysReturns() const { return m_always_returns; }
+    /// move the locations of this node and its subtree delta lines (for a subtree that is reused after its text moved)
+    void shiftLines(int32_t delta);
 };
 
 typedef enum class BinaryOpType {
@@ -88,187 +166,200 @@ std::string binaryOpTypeToString(BinaryOpType t);
 std::string unaryOpTypeToString(UnaryOpType t);
 
 class BinaryOp : public Expr {
-    std::unique_ptr<Expr> m_lhs;
-    std::unique_ptr<Expr> m_rhs;
+    Ptr<Expr> m_lhs;
+    Ptr<Expr> m_rhs;
     BinaryOpType m_op;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
     BinaryOp(
         LocationInfo loc,
-        std::unique_ptr<Expr> lhs,
-        std::unique_ptr<Expr> rhs,
+        Ptr<Expr> lhs,
+        Ptr<Expr> rhs,
         BinaryOpType op
     );
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    Expr const *getLhs() const { return m_lhs.get(); }
+    Expr const *getRhs() const { return m_rhs.get(); }
+    BinaryOpType getOp() const { return m_op; }
 };
 
 class UnaryOp : public Expr {
-    std::unique_ptr<Expr> m_rhs;
+    Ptr<Expr> m_rhs;
     UnaryOpType m_op;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
-    UnaryOp(LocationInfo loc, std::unique_ptr<Expr> rhs, UnaryOpType op);
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    UnaryOp(LocationInfo loc, Ptr<Expr> rhs, UnaryOpType op);
+    Expr const *getRhs() const { return m_rhs.get(); }
+    UnaryOpType getOp() const { return m_op; }
 };
 
 class VarRef : public Expr {
-    std::string m_name;
+    symbol::Id m_name;
 
 public:
-    VarRef(LocationInfo loc, std::string name);
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    std::string const &getVarName() const override;
-    void *codegen(void *ctx_) const override;
+    VarRef(LocationInfo loc, symbol::Id name);
+    symbol::Id getName() const { return m_name; }
 };
 
 class Constant : public Expr {
     uint64_t m_value;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
     Constant(LocationInfo loc, uint64_t value);
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    uint64_t getValue() const { return m_value; }
 };
 
 class FunctionCall : public Expr {
-    std::string m_name;
-    std::vector<std::unique_ptr<Expr>> m_args;
+    symbol::Id m_name;
+    Vec<Ptr<Expr>> m_args;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
     FunctionCall(
         LocationInfo loc,
-        std::string name,
-        std::vector<std::unique_ptr<Expr>> args
+        symbol::Id name,
+        Vec<Ptr<Expr>> args
     );
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    symbol::Id getName() const { return m_name; }
+    Vec<Ptr<Expr>> const &getArgs() const { return m_args; }
 };
 
 class Block : public Expr {
-    std::vector<std::unique_ptr<Statement>> m_statements;
-    std::optional<std::unique_ptr<Expr>> m_result;
+    Vec<Ptr<Statement>> m_statements;
+    std::optional<Ptr<Expr>> m_result;
     bool m_is_toplevel;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
     Block(
         LocationInfo loc,
-        std::vector<std::unique_ptr<Statement>> statements,
-        std::optional<std::unique_ptr<Expr>> result,
+        Vec<Ptr<Statement>> statements,
+        std::optional<Ptr<Expr>> result,
         bool is_toplevel
     );
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    Vec<Ptr<Statement>> const &getStatements() const { return m_statements; }
+    /// nullptr if the block has no result expression
+    Expr const *getResult() const { return m_result ? m_result->get() : nullptr; }
+    bool isToplevel() const { return m_is_toplevel; }
 };
 
 class If : public Expr {
-    std::unique_ptr<Expr> m_condition;
-    std::unique_ptr<Expr> m_branch;
-    std::optional<std::unique_ptr<Expr>> m_else_branch;
+    Ptr<Expr> m_condition;
+    Ptr<Expr> m_branch;
+    std::optional<Ptr<Expr>> m_else_branch;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
-    If(LocationInfo loc, std::unique_ptr<Expr> condition, std::unique_ptr<Expr> branch, std::optional<std::unique_ptr<Expr>> else_branch);
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    If(LocationInfo loc, Ptr<Expr> condition, Ptr<Expr> branch, std::optional<Ptr<Expr>> else_branch);
+    Expr const *getCondition() const { return m_condition.get(); }
+    Expr const *getBranch() const { return m_branch.get(); }
+    /// nullptr if there is no else branch
+    Expr const *getElseBranch() const { return m_else_branch ? m_else_branch->get() : nullptr; }
 };
 
 class While : public Expr {
-    std::unique_ptr<Expr> m_condition;
-    std::unique_ptr<Expr> m_branch;
+    Ptr<Expr> m_condition;
+    Ptr<Expr> m_branch;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
-    While(LocationInfo loc, std::unique_ptr<Expr> condition, std::unique_ptr<Expr> branch);
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    While(LocationInfo loc, Ptr<Expr> condition, Ptr<Expr> branch);
+    Expr const *getCondition() const { return m_condition.get(); }
+    Expr const *getBranch() const { return m_branch.get(); }
 };
 
 class For : public Expr {
-    std::unique_ptr<Statement> m_init;
-    std::unique_ptr<Expr> m_condition;
-    std::unique_ptr<Statement> m_update;
-    std::unique_ptr<Expr> m_branch;
+    Ptr<Statement> m_init;
+    Ptr<Expr> m_condition;
+    Ptr<Statement> m_update;
+    Ptr<Expr> m_branch;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
-    For(LocationInfo loc, std::unique_ptr<Statement> init, std::unique_ptr<Expr> condition, std::unique_ptr<Statement> update, std::unique_ptr<Expr> branch);
-    std::string toJsonString() const override;
-    ExprKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    For(LocationInfo loc, Ptr<Statement> init, Ptr<Expr> condition, Ptr<Statement> update, Ptr<Expr> branch);
+    Statement const *getInit() const { return m_init.get(); }
+    Expr const *getCondition() const { return m_condition.get(); }
+    Statement const *getUpdate() const { return m_update.get(); }
+    Expr const *getBranch() const { return m_branch.get(); }
 };
 
 class FunctionDef : public Statement {
     FunctionProto m_proto;
-    // TODO one could probably get rid of this unique_ptr
-    std::unique_ptr<Block> m_block;
+    // TODO one could probably get rid of this pointer
+    Ptr<Block> m_block;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
     FunctionDef(
         LocationInfo loc,
-        std::string name,
-        std::vector<std::string> args,
-        std::unique_ptr<Block> block,
+        symbol::Id name,
+        Vec<symbol::Id> args,
+        Ptr<Block> block,
         bool is_extern = true,
         bool is_fastcc = true
     );
     FunctionDef(
         LocationInfo loc,
         FunctionProto proto,
-        std::unique_ptr<Block> block
+        Ptr<Block> block
     );
-    std::string toJsonString() const override;
-    StatementKind getKind() const override;
-    FunctionProto const &getProto() const override;
-    void *codegen(void *ctx_) const override;
+    Block const *getBlock() const { return m_block.get(); }
+    FunctionProto const &getProto() const;
 };
 
 class DeclAssignment : public Statement {
-    std::string m_name;
-    std::optional<std::unique_ptr<Expr>> m_value;
+    symbol::Id m_name;
+    std::optional<Ptr<Expr>> m_value;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
-    DeclAssignment(LocationInfo loc, std::string name, std::optional<std::unique_ptr<Expr>> value);
-    std::string toJsonString() const override;
-    StatementKind getKind() const override;
-    void *codegen(void *ctx_) const override;
-    void *globalCodegen(void *ctx_) const;
+    DeclAssignment(LocationInfo loc, symbol::Id name, std::optional<Ptr<Expr>> value);
+    symbol::Id getName() const { return m_name; }
+    /// nullptr for a declaration without a value
+    Expr const *getValue() const { return m_value ? m_value->get() : nullptr; }
 };
 
 class Assignment : public Statement {
-    std::unique_ptr<Expr> m_key;
-    std::unique_ptr<Expr> m_value;
+    Ptr<Expr> m_key;
+    Ptr<Expr> m_value;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
-    Assignment(LocationInfo loc, std::unique_ptr<Expr> key, std::unique_ptr<Expr> value);
-    std::string toJsonString() const override;
-    StatementKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    Assignment(LocationInfo loc, Ptr<Expr> key, Ptr<Expr> value);
+    Expr const *getKey() const { return m_key.get(); }
+    Expr const *getValue() const { return m_value.get(); }
 };
 
 class Return : public Statement {
-    std::unique_ptr<Expr> m_value;
+    Ptr<Expr> m_value;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
-    Return(LocationInfo loc, std::unique_ptr<Expr> value);
-    std::string toJsonString() const override;
-    StatementKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    Return(LocationInfo loc, Ptr<Expr> value);
+    Expr const *getValue() const { return m_value.get(); }
 };
 
 class ExprStmt : public Statement {
-    std::unique_ptr<Expr> m_expr;
+    Ptr<Expr> m_expr;
+    friend class ConstantFolder;
+    friend class LineShifter;
 
 public:
-    ExprStmt(LocationInfo loc, std::unique_ptr<Expr> expr);
-    std::string toJsonString() const override;
-    StatementKind getKind() const override;
-    void *codegen(void *ctx_) const override;
+    ExprStmt(LocationInfo loc, Ptr<Expr> expr);
+    Expr const *getExpr() const { return m_expr.get(); }
 };
 }  // namespace ast
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ast.hpp"
+#include "lib.hpp"
+#include <stdexcept>
+#include <type_traits>
+
+namespace ast {
+/* Static dispatch over the node classes, for backends and analysis passes. A pass derives from
+ * Visitor<Pass, ExprResult, StatementResult> and implements one method per node class,
+ *
+ *     ExprResult visitBinaryOp(BinaryOp const *node);  // ... through visitFor
+ *     StatementResult visitFunctionDef(FunctionDef const *node);  // ... through visitExprStmt
+ *
+ * and calls visit() on children. visit() switches on the kind stored in the node and calls the method of the pass
+ * directly (no virtual call, no cast from void *), so the methods can be inlined into the switch. A missing method
+ * is a compile error. visit() also holds the stack guard of lib.hpp, so a pass can recurse as deep as the tree goes.
+ * Passes that rewrite the tree set is_mutable and get non-const nodes.
+ */
+template<typename Derived, typename ExprResult, typename StatementResult = ExprResult, bool is_mutable = false>
+class Visitor {
+    template<typename T>
+    using Node = std::conditional_t<is_mutable, T, T const>;
+
+public:
+    ExprResult visit(Node<Expr> *expr) {
+        if (stackIsLow())
+            return onNewStack([&] { return visit(expr); });
+        auto *self = static_cast<Derived*>(this);
+        switch (expr->getKind()) {
+            case ExprKind::binary_op:
+                return self->visitBinaryOp(static_cast<Node<BinaryOp>*>(expr));
+            case ExprKind::unary_op:
+                return self->visitUnaryOp(static_cast<Node<UnaryOp>*>(expr));
+            case ExprKind::constant:
+                return self->visitConstant(static_cast<Node<Constant>*>(expr));
+            case ExprKind::var_ref:
+                return self->visitVarRef(static_cast<Node<VarRef>*>(expr));
+            case ExprKind::function_call:
+                return self->visitFunctionCall(static_cast<Node<FunctionCall>*>(expr));
+            case ExprKind::block:
+                return self->visitBlock(static_cast<Node<Block>*>(expr));
+            case ExprKind::if_:
+                return self->visitIf(static_cast<Node<If>*>(expr));
+            case ExprKind::while_:
+                return self->visitWhile(static_cast<Node<While>*>(expr));
+            case ExprKind::for_:
+                return self->visitFor(static_cast<Node<For>*>(expr));
+            default:
+                throw std::runtime_error("visited ast::Expr of invalid kind " + std::to_string(static_cast<uint32_t>(expr->getKind())));
+        }
+    }
+
+    StatementResult visit(Node<Statement> *stmt) {
+        auto *self = static_cast<Derived*>(this);
+        switch (stmt->getKind()) {
+            case StatementKind::assignment:
+                return self->visitAssignment(static_cast<Node<Assignment>*>(stmt));
+            case StatementKind::decl_assignment:
+                return self->visitDeclAssignment(static_cast<Node<DeclAssignment>*>(stmt));
+            case StatementKind::function_def:
+                return self->visitFunctionDef(static_cast<Node<FunctionDef>*>(stmt));
+            case StatementKind::return_:
+                return self->visitReturn(static_cast<Node<Return>*>(stmt));
+            case StatementKind::expr_stmt:
+                return self->visitExprStmt(static_cast<Node<ExprStmt>*>(stmt));
+            default:
+                throw std::runtime_error("visited ast::Statement of invalid kind " + std::to_string(static_cast<uint32_t>(stmt->getKind())));
+        }
+    }
+};
+}  // namespace ast
@@ -0,0 +1,342 @@
+#include "constant_folding.hpp"
+#include "ast_visitor.hpp"
+
+#include <optional>
+#include <vector>
+
+namespace ast {
+/* The visit methods of expressions return the node that takes the place of the visited one (itself if nothing
+ * changed). Children are folded before their parent, so a parent only ever has to look one level down.
+ *
+ * Which variables codegen will find is tracked exactly like codegen tracks it (see SymbolTable and lookupVariable in
+ * codegen.hpp): a variable is found if there is a local of that name in scope and no global of that name has been
+ * declared before. A declaration whose value has an error still counts as declared here, so only the follow-up errors
+ * of an error that is reported anyway can be folded away.
+ */
+class ConstantFolder : public Visitor<ConstantFolder, Expr*, void, true> {
+    Arena *m_arena;
+    uint32_t m_eliminated = 0;
+    /// number of locals in scope by symbol id
+    std::vector<uint32_t> m_locals;
+    std::vector<bool> m_globals;
+    /// the declarations of all scopes that are currently entered, in order
+    std::vector<symbol::Id> m_declared;
+    /// size of m_declared when each scope was entered
+    std::vector<size_t> m_scopes;
+
+public:
+    explicit ConstantFolder(Arena *arena);
+    uint32_t eliminated() const;
+
+    Expr *visitBinaryOp(BinaryOp *node);
+    Expr *visitUnaryOp(UnaryOp *node);
+    Expr *visitConstant(Constant *node);
+    Expr *visitVarRef(VarRef *node);
+    Expr *visitFunctionCall(FunctionCall *node);
+    Expr *visitBlock(Block *node);
+    Expr *visitIf(If *node);
+    Expr *visitWhile(While *node);
+    Expr *visitFor(For *node);
+
+    void visitFunctionDef(FunctionDef *node);
+    void visitDeclAssignment(DeclAssignment *node);
+    void visitAssignment(Assignment *node);
+    void visitReturn(Return *node);
+    void visitExprStmt(ExprStmt *node);
+
+private:
+    /// fold the expression in slot and put its replacement there
+    void fold(Ptr<Expr> &slot);
+    void enterScope();
+    void leaveScope();
+    void declare(symbol::Id name);
+    void declareGlobal(symbol::Id name);
+    bool isFound(symbol::Id name) const;
+    /// whether dropping expr changes neither the program nor its diagnostics
+    bool isPure(Expr const *expr) const;
+};
+}  // namespace ast
+
+/// the value codegen gives a constant expression (truncated to 8 bits), nothing if expr is not a constant
+std::optional<uint8_t> constantValue(ast::Expr const *expr) {
+    if (expr->getKind() != ast::ExprKind::constant)
+        return std::nullopt;
+    return static_cast<uint8_t>(static_cast<ast::Constant const*>(expr)->getValue());
+}
+
+/// evaluate op the way the generated code does (wrapping, unsigned division), rhs must not be 0 for div and mod
+uint8_t evalBinaryOp(ast::BinaryOpType op, uint8_t lhs, uint8_t rhs) {
+    switch (op) {
+        case ast::BinaryOpType::add:
+            return lhs + rhs;
+        case ast::BinaryOpType::sub:
+            return lhs - rhs;
+        case ast::BinaryOpType::mul:
+            return lhs * rhs;
+        case ast::BinaryOpType::div:
+            return lhs / rhs;
+        case ast::BinaryOpType::mod:
+            return lhs % rhs;
+        default:
+            throw std::runtime_error("cannot evaluate binary op " + ast::binaryOpTypeToString(op));
+    }
+}
+
+/// number of nodes of a tree of operators, constants and variable references
+uint32_t operandSize(ast::Expr const *expr) {
+    if (stackIsLow())
+        return onNewStack([&] { return operandSize(expr); });
+    if (expr->getKind() == ast::ExprKind::binary_op) {
+        auto const *op = static_cast<ast::BinaryOp const*>(expr);
+        return 1 + operandSize(op->getLhs()) + operandSize(op->getRhs());
+    }
+    if (expr->getKind() == ast::ExprKind::unary_op)
+        return 1 + operandSize(static_cast<ast::UnaryOp const*>(expr)->getRhs());
+    return 1;
+}
+
+/// whether two trees of operators, constants and variable references compute the same value
+bool sameOperand(ast::Expr const *a, ast::Expr const *b) {
+    if (stackIsLow())
+        return onNewStack([&] { return sameOperand(a, b); });
+    if (a->getKind() != b->getKind())
+        return false;
+    switch (a->getKind()) {
+        case ast::ExprKind::constant:
+            return constantValue(a) == constantValue(b);
+        case ast::ExprKind::var_ref:
+            return static_cast<ast::VarRef const*>(a)->getName() == static_cast<ast::VarRef const*>(b)->getName();
+        case ast::ExprKind::unary_op: {
+            auto const *ua = static_cast<ast::UnaryOp const*>(a);
+            auto const *ub = static_cast<ast::UnaryOp const*>(b);
+            return ua->getOp() == ub->getOp() && sameOperand(ua->getRhs(), ub->getRhs());
+        }
+        case ast::ExprKind::binary_op: {
+            auto const *ba = static_cast<ast::BinaryOp const*>(a);
+            auto const *bb = static_cast<ast::BinaryOp const*>(b);
+            return ba->getOp() == bb->getOp() && sameOperand(ba->getLhs(), bb->getLhs()) && sameOperand(ba->getRhs(), bb->getRhs());
+        }
+        default:
+            return false;
+    }
+}
+
+ast::ConstantFolder::ConstantFolder(Arena *arena) : m_arena(arena) {}
+
+uint32_t ast::ConstantFolder::eliminated() const {
+    return m_eliminated;
+}
+
+void ast::ConstantFolder::fold(Ptr<Expr> &slot) {
+    Expr *replacement = visit(slot.get());
+    if (replacement != slot.get()) {
+        // the old node stays in the arena, the deleter of Ptr does nothing
+        slot.release();
+        slot.reset(replacement);
+    }
+}
+
+void ast::ConstantFolder::enterScope() {
+    m_scopes.push_back(m_declared.size());
+}
+
+void ast::ConstantFolder::leaveScope() {
+    size_t start = m_scopes.back();
+    m_scopes.pop_back();
+    for (size_t i = start; i < m_declared.size(); i++)
+        m_locals[m_declared[i]]--;
+    m_declared.resize(start);
+}
+
+void ast::ConstantFolder::declare(symbol::Id name) {
+    if (name >= m_locals.size())
+        m_locals.resize(name + 1, 0);
+    m_locals[name]++;
+    m_declared.push_back(name);
+}
+
+void ast::ConstantFolder::declareGlobal(symbol::Id name) {
+    if (name >= m_globals.size())
+        m_globals.resize(name + 1, false);
+    m_globals[name] = true;
+}
+
+bool ast::ConstantFolder::isFound(symbol::Id name) const {
+    bool is_global = name < m_globals.size() && m_globals[name];
+    return name < m_locals.size() && m_locals[name] && !is_global;
+}
+
+bool ast::ConstantFolder::isPure(Expr const *expr) const {
+    if (stackIsLow())
+        return onNewStack([&] { return isPure(expr); });
+    switch (expr->getKind()) {
+        case ExprKind::constant:
+            return true;
+        case ExprKind::var_ref:
+            return isFound(static_cast<VarRef const*>(expr)->getName());
+        case ExprKind::unary_op: {
+            auto const *op = static_cast<UnaryOp const*>(expr);
+            return op->getOp() != UnaryOpType::invalid && isPure(op->getRhs());
+        }
+        case ExprKind::binary_op: {
+            auto const *op = static_cast<BinaryOp const*>(expr);
+            return op->getOp() != BinaryOpType::invalid && isPure(op->getLhs()) && isPure(op->getRhs());
+        }
+        default:
+            // calls have side effects, and the control flow expressions open blocks and scopes in codegen
+            return false;
+    }
+}
+
+ast::Expr *ast::ConstantFolder::visitBinaryOp(BinaryOp *node) {
+    fold(node->m_lhs);
+    fold(node->m_rhs);
+    Expr *lhs = node->m_lhs.get();
+    Expr *rhs = node->m_rhs.get();
+    std::optional<uint8_t> lhs_value = constantValue(lhs);
+    std::optional<uint8_t> rhs_value = constantValue(rhs);
+    BinaryOpType op = node->m_op;
+    if (op == BinaryOpType::invalid)
+        return node;
+
+    if (lhs_value && rhs_value) {
+        // a division by zero is left to the generated code
+        if ((op == BinaryOpType::div || op == BinaryOpType::mod) && !*rhs_value)
+            return node;
+        static_cast<Constant*>(lhs)->m_value = evalBinaryOp(op, *lhs_value, *rhs_value);
+        m_eliminated += 2;
+        return lhs;
+    }
+
+    // identities that keep one operand
+    if (((op == BinaryOpType::add || op == BinaryOpType::sub) && rhs_value == 0)
+        || ((op == BinaryOpType::mul || op == BinaryOpType::div) && rhs_value == 1)) {
+        m_eliminated += 2;
+        return lhs;
+    }
+    if ((op == BinaryOpType::add && lhs_value == 0) || (op == BinaryOpType::mul && lhs_value == 1)) {
+        m_eliminated += 2;
+        return rhs;
+    }
+
+    // identities that drop an operand, only if it has no effect that would be lost
+    if (op == BinaryOpType::mul && rhs_value == 0 && isPure(lhs)) {
+        m_eliminated += 1 + operandSize(lhs);
+        return rhs;
+    }
+    if (op == BinaryOpType::mul && lhs_value == 0 && isPure(rhs)) {
+        m_eliminated += 1 + operandSize(rhs);
+        return lhs;
+    }
+    if (op == BinaryOpType::mod && rhs_value == 1 && isPure(lhs)) {
+        static_cast<Constant*>(rhs)->m_value = 0;
+        m_eliminated += 1 + operandSize(lhs);
+        return rhs;
+    }
+    // comparing first keeps this linear on long chains of subtractions, isPure only runs on operands that match
+    if (op == BinaryOpType::sub && sameOperand(lhs, rhs) && isPure(lhs)) {
+        m_eliminated += 2 * operandSize(lhs);
+        return m_arena->make<Constant>(node->getLoc(), 0).release();
+    }
+    return node;
+}
+
+ast::Expr *ast::ConstantFolder::visitUnaryOp(UnaryOp *node) {
+    fold(node->m_rhs);
+    std::optional<uint8_t> value = constantValue(node->m_rhs.get());
+    if (value && node->m_op == UnaryOpType::neg) {
+        auto *result = static_cast<Constant*>(node->m_rhs.get());
+        result->m_value = static_cast<uint8_t>(-*value);
+        m_eliminated++;
+        return result;
+    }
+    return node;
+}
+
+ast::Expr *ast::ConstantFolder::visitConstant(Constant *node) {
+    return node;
+}
+
+ast::Expr *ast::ConstantFolder::visitVarRef(VarRef *node) {
+    return node;
+}
+
+ast::Expr *ast::ConstantFolder::visitFunctionCall(FunctionCall *node) {
+    for (auto &arg : node->m_args)
+        fold(arg);
+    return node;
+}
+
+ast::Expr *ast::ConstantFolder::visitBlock(Block *node) {
+    enterScope();
+    if (node->m_is_toplevel) {
+        // codegen never evaluates the value of a global (it reports an error), so there is nothing to fold in it
+        for (auto &stmt : node->m_statements)
+            if (stmt->getKind() == StatementKind::decl_assignment)
+                declareGlobal(static_cast<DeclAssignment*>(stmt.get())->m_name);
+            else
+                visit(stmt.get());
+    } else {
+        for (auto &stmt : node->m_statements)
+            visit(stmt.get());
+        if (node->m_result)
+            fold(*node->m_result);
+    }
+    leaveScope();
+    return node;
+}
+
+ast::Expr *ast::ConstantFolder::visitIf(If *node) {
+    fold(node->m_condition);
+    fold(node->m_branch);
+    if (node->m_else_branch)
+        fold(*node->m_else_branch);
+    return node;
+}
+
+ast::Expr *ast::ConstantFolder::visitWhile(While *node) {
+    fold(node->m_condition);
+    fold(node->m_branch);
+    return node;
+}
+
+ast::Expr *ast::ConstantFolder::visitFor(For *node) {
+    // same order as codegen, the init statement declares into the enclosing scope
+    visit(node->m_init.get());
+    fold(node->m_condition);
+    fold(node->m_branch);
+    visit(node->m_update.get());
+    return node;
+}
+
+void ast::ConstantFolder::visitFunctionDef(FunctionDef *node) {
+    enterScope();
+    for (symbol::Id arg : node->m_proto.args)
+        declare(arg);
+    visit(node->m_block.get());
+    leaveScope();
+}
+
+void ast::ConstantFolder::visitDeclAssignment(DeclAssignment *node) {
+    if (node->m_value)
+        fold(*node->m_value);
+    declare(node->m_name);
+}
+
+void ast::ConstantFolder::visitAssignment(Assignment *node) {
+    fold(node->m_value);
+}
+
+void ast::ConstantFolder::visitReturn(Return *node) {
+    fold(node->m_value);
+}
+
+void ast::ConstantFolder::visitExprStmt(ExprStmt *node) {
+    fold(node->m_expr);
+}
+
+uint32_t ast::foldConstants(Block *block, Arena *arena) {
+    ConstantFolder folder(arena);
+    folder.visit(block);
+    return folder.eliminated();
+}
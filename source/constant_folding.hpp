@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ast.hpp"
+#include <cstdint>
+
+namespace ast {
+/* Pre-codegen simplification of the tree, in place. Arithmetic on constants is evaluated with the 8-bit wrapping
+ * semantics of the language (constants are truncated to 8 bits and division is unsigned; a division by a constant
+ * zero is left alone), and the identities x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1 are reduced to x. x * 0, 0 * x,
+ * x % 1 and x - x become 0 only if x is free of side effects and of diagnostics, ie it consists of constants,
+ * operators and references to variables that codegen will find, so folding never hides an error. The left-hand side
+ * of an assignment is never touched.
+ *
+ * New nodes come from arena (which must be the arena of the tree or outlive it). Returns the number of nodes that
+ * were eliminated from the tree.
+ */
+uint32_t foldConstants(Block *block, Arena *arena);
+}  // namespace ast
@@ -0,0 +1,249 @@
+#include "flat_ast.hpp"
+#include "ast_visitor.hpp"
+
+uint32_t flat::Tree::size() const {
+    return kinds.size();
+}
+
+LocationInfo flat::Tree::loc(NodeId id) const {
+    return LocationInfo {
+        .line = lines[id],
+        .column = columns[id],
+        .file = file,
+    };
+}
+
+flat::NodeId flat::Tree::child(NodeId id, uint32_t i) const {
+    return children[(id ? children_end[id - 1] : 0) + i];
+}
+
+uint32_t flat::Tree::childCount(NodeId id) const {
+    return children_end[id] - (id ? children_end[id - 1] : 0);
+}
+
+size_t flat::Tree::memoryUsage() const {
+    size_t bytes = size() * (sizeof(NodeKind) + sizeof(uint8_t) + 4 * sizeof(uint32_t))
+        + children.size() * sizeof(NodeId)
+        + constants.size() * sizeof(uint64_t)
+        + protos.size() * sizeof(ast::FunctionProto);
+    for (auto const &proto : protos)
+        bytes += proto.args.size() * sizeof(symbol::Id);
+    return bytes;
+}
+
+flat::TreeView flat::Tree::view() const {
+    return TreeView {
+        .file = file,
+        .n_nodes = size(),
+        .kinds = kinds.data(),
+        .ops = ops.data(),
+        .lines = lines.data(),
+        .columns = columns.data(),
+        .children_end = children_end.data(),
+        .payloads = payloads.data(),
+        .children = children.data(),
+        .constants = constants.data(),
+        .protos = protos.data(),
+        .symbols = nullptr,
+        .root = root,
+    };
+}
+
+uint32_t flat::TreeView::size() const {
+    return n_nodes;
+}
+
+LocationInfo flat::TreeView::loc(NodeId id) const {
+    return LocationInfo {
+        .line = lines[id],
+        .column = columns[id],
+        .file = file,
+    };
+}
+
+flat::NodeId flat::TreeView::child(NodeId id, uint32_t i) const {
+    return children[(id ? children_end[id - 1] : 0) + i];
+}
+
+uint32_t flat::TreeView::childCount(NodeId id) const {
+    return children_end[id] - (id ? children_end[id - 1] : 0);
+}
+
+symbol::Id flat::TreeView::symbol(NodeId id) const {
+    return symbols ? symbols[payloads[id]] : payloads[id];
+}
+
+flat::NodeId flat::pushNode(Tree *tree, NodeKind kind, uint8_t op, LocationInfo loc, uint32_t payload, NodeId const *children, uint32_t n_children) {
+    NodeId id = tree->size();
+    tree->kinds.push_back(kind);
+    tree->ops.push_back(op);
+    tree->lines.push_back(loc.line);
+    tree->columns.push_back(loc.column);
+    tree->payloads.push_back(payload);
+    tree->children.insert(tree->children.end(), children, children + n_children);
+    tree->children_end.push_back(tree->children.size());
+    return id;
+}
+
+namespace {
+/// the children of a node are flattened first (post order), so their ids are known when the node itself is pushed
+class Flattener : public ast::Visitor<Flattener, flat::NodeId> {
+    flat::Tree *m_tree;
+
+public:
+    explicit Flattener(flat::Tree *tree) : m_tree(tree)
+    {}
+
+    flat::NodeId visitBinaryOp(ast::BinaryOp const *node) {
+        flat::NodeId children[] = {visit(node->getLhs()), visit(node->getRhs())};
+        return flat::pushNode(m_tree, flat::NodeKind::binary_op, static_cast<uint8_t>(node->getOp()), node->getLoc(), 0, children, 2);
+    }
+
+    flat::NodeId visitUnaryOp(ast::UnaryOp const *node) {
+        flat::NodeId rhs = visit(node->getRhs());
+        return flat::pushNode(m_tree, flat::NodeKind::unary_op, static_cast<uint8_t>(node->getOp()), node->getLoc(), 0, &rhs, 1);
+    }
+
+    flat::NodeId visitVarRef(ast::VarRef const *node) {
+        return flat::pushNode(m_tree, flat::NodeKind::var_ref, 0, node->getLoc(), node->getName(), nullptr, 0);
+    }
+
+    flat::NodeId visitConstant(ast::Constant const *node) {
+        uint32_t idx = m_tree->constants.size();
+        m_tree->constants.push_back(node->getValue());
+        return flat::pushNode(m_tree, flat::NodeKind::constant, 0, node->getLoc(), idx, nullptr, 0);
+    }
+
+    flat::NodeId visitFunctionCall(ast::FunctionCall const *node) {
+        std::vector<flat::NodeId> children;
+        children.reserve(node->getArgs().size());
+        for (auto const &arg : node->getArgs())
+            children.push_back(visit(arg.get()));
+        return flat::pushNode(m_tree, flat::NodeKind::function_call, 0, node->getLoc(), node->getName(), children.data(), children.size());
+    }
+
+    flat::NodeId visitBlock(ast::Block const *node) {
+        std::vector<flat::NodeId> children;
+        children.reserve(node->getStatements().size() + 1);
+        for (auto const &stmt : node->getStatements())
+            children.push_back(visit(stmt.get()));
+        uint8_t flags = node->isToplevel() ? FLAT_BLOCK_TOPLEVEL : 0;
+        if (node->getResult()) {
+            children.push_back(visit(node->getResult()));
+            flags |= FLAT_BLOCK_HAS_RESULT;
+        }
+        // every file has a toplevel block, so this is where the file of the tree is taken from
+        if (node->isToplevel())
+            m_tree->file = node->getLoc().file;
+        return flat::pushNode(m_tree, flat::NodeKind::block, flags, node->getLoc(), 0, children.data(), children.size());
+    }
+
+    flat::NodeId visitIf(ast::If const *node) {
+        flat::NodeId children[3] = {visit(node->getCondition()), visit(node->getBranch())};
+        uint32_t n = 2;
+        if (node->getElseBranch())
+            children[n++] = visit(node->getElseBranch());
+        return flat::pushNode(m_tree, flat::NodeKind::if_, 0, node->getLoc(), 0, children, n);
+    }
+
+    flat::NodeId visitWhile(ast::While const *node) {
+        flat::NodeId children[] = {visit(node->getCondition()), visit(node->getBranch())};
+        return flat::pushNode(m_tree, flat::NodeKind::while_, 0, node->getLoc(), 0, children, 2);
+    }
+
+    flat::NodeId visitFor(ast::For const *node) {
+        flat::NodeId children[] = {visit(node->getInit()), visit(node->getCondition()), visit(node->getUpdate()), visit(node->getBranch())};
+        return flat::pushNode(m_tree, flat::NodeKind::for_, 0, node->getLoc(), 0, children, 4);
+    }
+
+    flat::NodeId visitFunctionDef(ast::FunctionDef const *node) {
+        ast::FunctionProto const &proto = node->getProto();
+        flat::NodeId block = visit(node->getBlock());
+        uint32_t idx = m_tree->protos.size();
+        // copied out of the arena, the flat tree must stay valid on its own
+        m_tree->protos.push_back(ast::FunctionProto {
+            .name = proto.name,
+            .args = ast::Vec<symbol::Id>(proto.args.begin(), proto.args.end()),
+            .is_extern = proto.is_extern,
+            .is_fastcc = proto.is_fastcc,
+        });
+        return flat::pushNode(m_tree, flat::NodeKind::function_def, 0, node->getLoc(), idx, &block, 1);
+    }
+
+    flat::NodeId visitDeclAssignment(ast::DeclAssignment const *node) {
+        flat::NodeId value = node->getValue() ? visit(node->getValue()) : FLAT_NO_NODE;
+        return flat::pushNode(m_tree, flat::NodeKind::decl_assignment, 0, node->getLoc(), node->getName(), &value, node->getValue() ? 1 : 0);
+    }
+
+    flat::NodeId visitAssignment(ast::Assignment const *node) {
+        flat::NodeId children[] = {visit(node->getKey()), visit(node->getValue())};
+        return flat::pushNode(m_tree, flat::NodeKind::assignment, 0, node->getLoc(), 0, children, 2);
+    }
+
+    flat::NodeId visitReturn(ast::Return const *node) {
+        flat::NodeId value = visit(node->getValue());
+        return flat::pushNode(m_tree, flat::NodeKind::return_, 0, node->getLoc(), 0, &value, 1);
+    }
+
+    flat::NodeId visitExprStmt(ast::ExprStmt const *node) {
+        flat::NodeId expr = visit(node->getExpr());
+        return flat::pushNode(m_tree, flat::NodeKind::expr_stmt, 0, node->getLoc(), 0, &expr, 1);
+    }
+};
+}  // namespace
+
+flat::Tree flat::flatten(ast::Block const *root) {
+    Tree tree = {};
+    tree.root = Flattener(&tree).visit(root);
+    // drop the slack left by the growth of the arrays
+    tree.kinds.shrink_to_fit();
+    tree.ops.shrink_to_fit();
+    tree.lines.shrink_to_fit();
+    tree.columns.shrink_to_fit();
+    tree.children_end.shrink_to_fit();
+    tree.payloads.shrink_to_fit();
+    tree.children.shrink_to_fit();
+    return tree;
+}
+
+std::vector<bool> flat::alwaysReturns(TreeView const &tree) {
+    std::vector<bool> result(tree.size(), false);
+    for (NodeId id = 0; id < tree.size(); id++) {
+        uint32_t n_children = tree.childCount(id);
+        bool any_child = false;
+        for (uint32_t i = 0; i < n_children; i++)
+            any_child = any_child || result[tree.child(id, i)];
+        switch (tree.kinds[id]) {
+            case NodeKind::return_:
+                result[id] = true;
+                break;
+            case NodeKind::unary_op:
+            case NodeKind::binary_op:
+            case NodeKind::function_call:
+            case NodeKind::block:
+            case NodeKind::decl_assignment:
+            case NodeKind::expr_stmt:
+                result[id] = any_child;
+                break;
+            case NodeKind::if_:
+                result[id] = result[tree.child(id, 0)] || (n_children == 3 && result[tree.child(id, 1)] && result[tree.child(id, 2)]);
+                break;
+            case NodeKind::while_:
+                // the body may not run at all
+                result[id] = result[tree.child(id, 0)];
+                break;
+            case NodeKind::for_:
+                // the body and the update may not run at all
+                result[id] = result[tree.child(id, 0)] || result[tree.child(id, 1)];
+                break;
+            case NodeKind::assignment:
+                // the key is not evaluated, it names the variable
+                result[id] = result[tree.child(id, 1)];
+                break;
+            default:
+                // constants, variable references and function definitions
+                break;
+        }
+    }
+    return result;
+}
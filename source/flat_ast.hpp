@@ -0,0 +1,110 @@
+#pragma once
+
+#include "ast.hpp"
+#include "lib.hpp"
+#include "symbol.hpp"
+#include <cstdint>
+#include <vector>
+
+/* Data-oriented representation of an AST: every node is a row in a set of parallel arrays (like token::TokenBuffer)
+ * and refers to its children by 32 bit index instead of by pointer. The children of a node are stored next to each
+ * other in one shared array, and nodes are numbered in post order, so a walk over the tree mostly moves forward
+ * through memory. Names are interned symbol ids and the file is stored once per tree instead of in every location.
+ * A node costs 22 bytes (plus the constant or prototype it refers to), compared to 40 to 88 bytes for the
+ * pointer-linked nodes of ast.hpp.
+ */
+namespace flat {
+typedef uint32_t NodeId;
+#define FLAT_NO_NODE UINT32_MAX
+
+typedef enum class NodeKind : uint8_t {
+    // expressions
+    unary_op,        // children: rhs; op: UnaryOpType
+    binary_op,       // children: lhs, rhs; op: BinaryOpType
+    constant,        // payload: index into constants
+    var_ref,         // payload: symbol
+    function_call,   // children: args; payload: symbol
+    block,           // children: statements, then the result if FLAT_BLOCK_HAS_RESULT is set; op: FLAT_BLOCK_* flags
+    if_,             // children: condition, branch and optionally the else branch
+    while_,          // children: condition, branch
+    for_,            // children: init, condition, update, branch
+    // statements
+    assignment,      // children: key, value
+    decl_assignment, // children: optionally the value; payload: symbol
+    function_def,    // children: block; payload: index into protos
+    return_,         // children: value
+    expr_stmt,       // children: expr
+} NodeKind;
+
+#define FLAT_BLOCK_TOPLEVEL 1
+#define FLAT_BLOCK_HAS_RESULT 2
+
+typedef struct TreeView TreeView;
+
+typedef struct Tree {
+    StringRef file;
+    std::vector<NodeKind> kinds;
+    /// operator type of operators, flags of blocks, 0 for all other nodes
+    std::vector<uint8_t> ops;
+    std::vector<uint32_t> lines;
+    std::vector<uint32_t> columns;
+    /// the children of node i are children[children_end[i - 1] ... children_end[i]) (starting at 0 for node 0): a
+    /// node's children are appended right when the node is, so the ranges of consecutive nodes are adjacent
+    std::vector<uint32_t> children_end;
+    /// symbol, constant index or prototype index depending on the kind
+    std::vector<uint32_t> payloads;
+    std::vector<NodeId> children;
+    std::vector<uint64_t> constants;
+    std::vector<ast::FunctionProto> protos;
+    /// the toplevel block (nodes are in post order, so this is the last node)
+    NodeId root = FLAT_NO_NODE;
+
+    uint32_t size() const;
+    LocationInfo loc(NodeId id) const;
+    NodeId child(NodeId id, uint32_t i) const;
+    uint32_t childCount(NodeId id) const;
+    /// approximate heap memory held by the tree in bytes
+    size_t memoryUsage() const;
+    TreeView view() const;
+} Tree;
+
+/* Read-only view of the arrays of a tree that live somewhere else: in a Tree, or in a binary AST file mapped into
+ * memory (see flat_ast_file.hpp). Walks take a view, so they run directly on a loaded file without first copying it
+ * into vectors.
+ */
+typedef struct TreeView {
+    StringRef file;
+    uint32_t n_nodes;
+    NodeKind const *kinds;
+    uint8_t const *ops;
+    uint32_t const *lines;
+    uint32_t const *columns;
+    uint32_t const *children_end;
+    uint32_t const *payloads;
+    NodeId const *children;
+    uint64_t const *constants;
+    ast::FunctionProto const *protos;
+    /// symbol ids of the symbol payloads if those are indices into the string table of a file, nullptr if the
+    /// payloads are symbol ids already
+    symbol::Id const *symbols;
+    NodeId root;
+
+    uint32_t size() const;
+    LocationInfo loc(NodeId id) const;
+    NodeId child(NodeId id, uint32_t i) const;
+    uint32_t childCount(NodeId id) const;
+    /// the payload of a var_ref, function_call or decl_assignment as a symbol id
+    symbol::Id symbol(NodeId id) const;
+} TreeView;
+
+/// append a node whose children have already been added, returns its id
+NodeId pushNode(Tree *tree, NodeKind kind, uint8_t op, LocationInfo loc, uint32_t payload, NodeId const *children, uint32_t n_children);
+
+/// convert a pointer-linked tree (eg straight from the parser). The result does not refer to the source tree, so the
+/// arena it lives in can be freed afterwards.
+Tree flatten(ast::Block const *root);
+
+/// ast::Expr::alwaysReturns of every node, by node id. Children come before their parent, so this is one pass over
+/// the nodes in order.
+std::vector<bool> alwaysReturns(TreeView const &tree);
+}  // namespace flat
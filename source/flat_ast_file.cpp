@@ -0,0 +1,257 @@
+#include "flat_ast_file.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+/// the nodes whose payload is a symbol (written as an index into the string table)
+bool hasSymbolPayload(flat::NodeKind kind) {
+    return kind == flat::NodeKind::var_ref || kind == flat::NodeKind::function_call || kind == flat::NodeKind::decl_assignment;
+}
+
+typedef struct FileWriter {
+    std::string out;
+    std::vector<uint32_t> string_offsets;
+    std::string strings;
+    std::unordered_map<symbol::Id, uint32_t> string_of_symbol;
+} FileWriter;
+
+uint32_t addString(FileWriter *w, char const *str, size_t length) {
+    w->string_offsets.push_back(w->strings.size());
+    w->strings.append(str, length);
+    w->strings.push_back('\0');
+    return w->string_offsets.size() - 1;
+}
+
+uint32_t addSymbol(FileWriter *w, symbol::Id sym) {
+    auto it = w->string_of_symbol.find(sym);
+    if (it != w->string_of_symbol.end())
+        return it->second;
+    std::string const &name = symbol::name(sym);
+    uint32_t idx = addString(w, name.data(), name.size());
+    w->string_of_symbol.emplace(sym, idx);
+    return idx;
+}
+
+void writeSection(FileWriter *w, flat::FileHeader *header, flat::FileSection section, void const *data, size_t size) {
+    w->out.resize((w->out.size() + 7) / 8 * 8, '\0');
+    header->sections[static_cast<uint32_t>(section)] = w->out.size();
+    w->out.append(static_cast<char const *>(data), size);
+}
+}  // namespace
+
+std::string flat::writeFile(Tree const &tree) {
+    FileWriter w = {};
+    FileHeader header = {};
+    std::memcpy(header.magic, FLAT_FILE_MAGIC, sizeof(header.magic));
+    header.version = FLAT_FILE_VERSION;
+    header.byte_order = FLAT_FILE_BYTE_ORDER;
+    header.n_nodes = tree.size();
+    header.n_children = tree.children.size();
+    header.n_constants = tree.constants.size();
+    header.n_protos = tree.protos.size();
+    header.root = tree.root;
+    header.file = addString(&w, tree.file.start, tree.file.length);
+
+    std::vector<uint32_t> payloads = tree.payloads;
+    for (uint32_t i = 0; i < tree.size(); i++)
+        if (hasSymbolPayload(tree.kinds[i]))
+            payloads[i] = addSymbol(&w, payloads[i]);
+    std::vector<FileProto> protos;
+    std::vector<uint32_t> proto_args;
+    protos.reserve(tree.protos.size());
+    for (auto const &proto : tree.protos) {
+        protos.push_back(FileProto {
+            .name = addSymbol(&w, proto.name),
+            .args_start = static_cast<uint32_t>(proto_args.size()),
+            .n_args = static_cast<uint32_t>(proto.args.size()),
+            .is_extern = proto.is_extern,
+            .is_fastcc = proto.is_fastcc,
+            .reserved = 0,
+        });
+        for (symbol::Id arg : proto.args)
+            proto_args.push_back(addSymbol(&w, arg));
+    }
+    w.string_offsets.push_back(w.strings.size());
+    header.n_proto_args = proto_args.size();
+    header.n_strings = w.string_offsets.size() - 1;
+    header.n_string_bytes = w.strings.size();
+
+    // the header is written again at the end, once the section offsets are known
+    w.out.append(reinterpret_cast<char const *>(&header), sizeof(header));
+    writeSection(&w, &header, FileSection::kinds, tree.kinds.data(), tree.size() * sizeof(NodeKind));
+    writeSection(&w, &header, FileSection::ops, tree.ops.data(), tree.size() * sizeof(uint8_t));
+    writeSection(&w, &header, FileSection::lines, tree.lines.data(), tree.size() * sizeof(uint32_t));
+    writeSection(&w, &header, FileSection::columns, tree.columns.data(), tree.size() * sizeof(uint32_t));
+    writeSection(&w, &header, FileSection::children_end, tree.children_end.data(), tree.size() * sizeof(uint32_t));
+    writeSection(&w, &header, FileSection::payloads, payloads.data(), tree.size() * sizeof(uint32_t));
+    writeSection(&w, &header, FileSection::children, tree.children.data(), tree.children.size() * sizeof(NodeId));
+    writeSection(&w, &header, FileSection::constants, tree.constants.data(), tree.constants.size() * sizeof(uint64_t));
+    writeSection(&w, &header, FileSection::protos, protos.data(), protos.size() * sizeof(FileProto));
+    writeSection(&w, &header, FileSection::proto_args, proto_args.data(), proto_args.size() * sizeof(uint32_t));
+    writeSection(&w, &header, FileSection::string_offsets, w.string_offsets.data(), w.string_offsets.size() * sizeof(uint32_t));
+    writeSection(&w, &header, FileSection::strings, w.strings.data(), w.strings.size());
+    std::memcpy(w.out.data(), &header, sizeof(header));
+    return std::move(w.out);
+}
+
+bool flat::isFile(StringRef data) {
+    return data.length >= sizeof(FileHeader) && !std::memcmp(data.start, FLAT_FILE_MAGIC, sizeof(FileHeader::magic));
+}
+
+namespace {
+/// pointer to a section of count elements of type T, throws if it does not lie within the file
+template<typename T>
+T const *fileSection(StringRef data, flat::FileHeader const *header, flat::FileSection section, uint64_t count) {
+    uint64_t offset = header->sections[static_cast<uint32_t>(section)];
+    if (offset % alignof(T) || offset > data.length || count > (data.length - offset) / sizeof(T))
+        throw std::runtime_error("corrupt binary AST file: section " + std::to_string(static_cast<uint32_t>(section)) + " is out of bounds");
+    return reinterpret_cast<T const *>(data.start + offset);
+}
+
+[[noreturn]] void corruptNode(flat::NodeId id, std::string const &reason) {
+    throw std::runtime_error("corrupt binary AST file: node " + std::to_string(id) + " " + reason);
+}
+
+/* Checks everything a walk relies on, in one pass over the nodes: known kinds, child ranges that grow monotonically
+ * and stay within the children section, children that come before their parent (post order, which also rules out
+ * cycles), the number of children each kind has and payloads that index into the table of their kind. After this a
+ * walk over the view can not read outside of the file, however the file was produced.
+ */
+void validateNodes(flat::TreeView const &view, flat::FileHeader const *header) {
+    uint32_t start = 0;
+    for (flat::NodeId id = 0; id < view.n_nodes; id++) {
+        uint32_t end = view.children_end[id];
+        if (end < start || end > header->n_children)
+            corruptNode(id, "has a broken child range");
+        for (uint32_t i = start; i < end; i++)
+            if (view.children[i] >= id)
+                corruptNode(id, "has a child that does not come before it");
+        uint32_t n = end - start;
+        uint32_t payload = view.payloads[id];
+        bool counts_ok;
+        bool payload_ok = true;
+        switch (view.kinds[id]) {
+            case flat::NodeKind::unary_op:
+            case flat::NodeKind::return_:
+            case flat::NodeKind::expr_stmt:
+                counts_ok = n == 1;
+                break;
+            case flat::NodeKind::binary_op:
+            case flat::NodeKind::while_:
+            case flat::NodeKind::assignment:
+                counts_ok = n == 2;
+                break;
+            case flat::NodeKind::constant:
+                counts_ok = n == 0;
+                payload_ok = payload < header->n_constants;
+                break;
+            case flat::NodeKind::var_ref:
+                counts_ok = n == 0;
+                payload_ok = payload < header->n_strings;
+                break;
+            case flat::NodeKind::function_call:
+                counts_ok = true;
+                payload_ok = payload < header->n_strings;
+                break;
+            case flat::NodeKind::block:
+                counts_ok = n > 0 || !(view.ops[id] & FLAT_BLOCK_HAS_RESULT);
+                break;
+            case flat::NodeKind::if_:
+                counts_ok = n == 2 || n == 3;
+                break;
+            case flat::NodeKind::for_:
+                counts_ok = n == 4;
+                break;
+            case flat::NodeKind::decl_assignment:
+                counts_ok = n <= 1;
+                payload_ok = payload < header->n_strings;
+                break;
+            case flat::NodeKind::function_def:
+                counts_ok = n == 1;
+                payload_ok = payload < header->n_protos;
+                break;
+            default:
+                corruptNode(id, "has an unknown kind " + std::to_string(static_cast<uint32_t>(view.kinds[id])));
+        }
+        if (!counts_ok)
+            corruptNode(id, "has the wrong number of children for its kind");
+        if (!payload_ok)
+            corruptNode(id, "refers to a missing constant, string or function prototype");
+        start = end;
+    }
+    if (view.kinds[view.root] != flat::NodeKind::block)
+        corruptNode(view.root, "is the root but not a block");
+}
+}  // namespace
+
+flat::MappedFile::MappedFile(StringRef data) {
+    if (!isFile(data))
+        throw std::runtime_error("not a binary AST file");
+    if (reinterpret_cast<uintptr_t>(data.start) % alignof(FileHeader))
+        throw std::runtime_error("binary AST file is not aligned in memory");
+    auto const *header = reinterpret_cast<FileHeader const *>(data.start);
+    if (header->byte_order != FLAT_FILE_BYTE_ORDER)
+        throw std::runtime_error("binary AST file was written on a machine with a different byte order");
+    if (header->version != FLAT_FILE_VERSION)
+        throw std::runtime_error("binary AST file has version " + std::to_string(header->version) + ", expected " + std::to_string(FLAT_FILE_VERSION));
+    if (header->root >= header->n_nodes || header->file >= header->n_strings)
+        throw std::runtime_error("corrupt binary AST file: header refers to a missing node or string");
+
+    auto const *string_offsets = fileSection<uint32_t>(data, header, FileSection::string_offsets, header->n_strings + 1ull);
+    auto const *strings = fileSection<char>(data, header, FileSection::strings, header->n_string_bytes);
+    m_symbols.reserve(header->n_strings);
+    for (uint32_t i = 0; i < header->n_strings; i++) {
+        uint32_t start = string_offsets[i];
+        uint32_t end = string_offsets[i + 1];
+        if (start >= end || end > header->n_string_bytes || strings[end - 1] != '\0')
+            throw std::runtime_error("corrupt binary AST file: broken string table");
+        m_symbols.push_back(symbol::intern(StringRef {.start = strings + start, .length = end - start - 1}));
+    }
+
+    auto const *protos = fileSection<FileProto>(data, header, FileSection::protos, header->n_protos);
+    auto const *proto_args = fileSection<uint32_t>(data, header, FileSection::proto_args, header->n_proto_args);
+    m_protos.reserve(header->n_protos);
+    for (uint32_t i = 0; i < header->n_protos; i++) {
+        FileProto const &proto = protos[i];
+        if (proto.name >= header->n_strings || proto.args_start > header->n_proto_args || proto.n_args > header->n_proto_args - proto.args_start)
+            throw std::runtime_error("corrupt binary AST file: broken function prototype");
+        ast::Vec<symbol::Id> args;
+        args.reserve(proto.n_args);
+        for (uint32_t a = 0; a < proto.n_args; a++) {
+            uint32_t arg = proto_args[proto.args_start + a];
+            if (arg >= header->n_strings)
+                throw std::runtime_error("corrupt binary AST file: broken function prototype");
+            args.push_back(m_symbols[arg]);
+        }
+        m_protos.push_back(ast::FunctionProto {
+            .name = m_symbols[proto.name],
+            .args = std::move(args),
+            .is_extern = static_cast<bool>(proto.is_extern),
+            .is_fastcc = static_cast<bool>(proto.is_fastcc),
+        });
+    }
+
+    uint32_t file_start = string_offsets[header->file];
+    m_view = TreeView {
+        .file = StringRef {.start = strings + file_start, .length = string_offsets[header->file + 1] - file_start - 1},
+        .n_nodes = header->n_nodes,
+        .kinds = fileSection<NodeKind>(data, header, FileSection::kinds, header->n_nodes),
+        .ops = fileSection<uint8_t>(data, header, FileSection::ops, header->n_nodes),
+        .lines = fileSection<uint32_t>(data, header, FileSection::lines, header->n_nodes),
+        .columns = fileSection<uint32_t>(data, header, FileSection::columns, header->n_nodes),
+        .children_end = fileSection<uint32_t>(data, header, FileSection::children_end, header->n_nodes),
+        .payloads = fileSection<uint32_t>(data, header, FileSection::payloads, header->n_nodes),
+        .children = fileSection<NodeId>(data, header, FileSection::children, header->n_children),
+        .constants = fileSection<uint64_t>(data, header, FileSection::constants, header->n_constants),
+        .protos = m_protos.data(),
+        .symbols = m_symbols.data(),
+        .root = header->root,
+    };
+    validateNodes(m_view, header);
+}
+
+flat::TreeView const &flat::MappedFile::view() const {
+    return m_view;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "flat_ast.hpp"
+#include "lib.hpp"
+#include "symbol.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Binary AST files: a flat::Tree written out as is, so a build can cache parsed files (or ship pre-parsed libraries)
+ * and skip lexing and parsing. The file is a header followed by one section per array of the tree, every section
+ * 8-byte aligned and located by its offset from the start of the file, so the file can be mapped at any address and
+ * walked in place through a flat::TreeView. Node ids, child ranges and the indices into the constant, prototype and
+ * string tables are all relative to their section. Names are stored once in a string table (the symbol payloads and
+ * prototypes refer to it by index), which is the only thing interned when a file is opened. The location table is
+ * the lines and columns sections, the file name of the locations is the string table entry named in the header.
+ *
+ * Integers are stored in the byte order of the writer; a reader with a different byte order, a different version
+ * or a header that does not fit the file rejects it with an error naming the reason (the compiler then stops, the
+ * file has to be emitted again from its source). The node sections are validated in one pass when the file is
+ * opened (kinds, child ranges, child counts and payload indices), so a corrupt file is rejected the same way instead
+ * of being read out of bounds later.
+ */
+namespace flat {
+#define FLAT_FILE_MAGIC "bplast\x1a\n"
+#define FLAT_FILE_VERSION 1
+#define FLAT_FILE_BYTE_ORDER 0x01020304u
+
+typedef enum class FileSection : uint32_t {
+    kinds,          // NodeKind per node
+    ops,            // uint8_t per node
+    lines,          // uint32_t per node
+    columns,        // uint32_t per node
+    children_end,   // uint32_t per node
+    payloads,       // uint32_t per node, a string index for the nodes that name a symbol
+    children,       // NodeId per child
+    constants,      // uint64_t per constant
+    protos,         // FileProto per function
+    proto_args,     // string index per argument of all functions, FileProto::args_start points in here
+    string_offsets, // uint32_t per string plus one, the offset of every string in strings
+    strings,        // the contents of all strings, each followed by a NUL
+    count,
+} FileSection;
+
+typedef struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t n_nodes;
+    uint32_t n_children;
+    uint32_t n_constants;
+    uint32_t n_protos;
+    uint32_t n_proto_args;
+    uint32_t n_strings;
+    uint32_t n_string_bytes;
+    NodeId root;
+    /// string index of the source file the locations refer to
+    uint32_t file;
+    uint32_t reserved;
+    /// offset of every FileSection from the start of the file
+    uint64_t sections[static_cast<uint32_t>(FileSection::count)];
+} FileHeader;
+
+typedef struct FileProto {
+    uint32_t name;
+    uint32_t args_start;
+    uint32_t n_args;
+    uint8_t is_extern;
+    uint8_t is_fastcc;
+    uint16_t reserved;
+} FileProto;
+
+/// serialize a tree into the binary format
+std::string writeFile(Tree const &tree);
+
+/// whether data starts with the magic of a binary AST file (it may still be invalid)
+bool isFile(StringRef data);
+
+/* An opened binary AST file. The data (eg a source file mapped by the SourceManager) must be 8-byte aligned and stay
+ * valid as long as the view is used; opening interns the string table and decodes the prototypes, nodes are only
+ * ever read where they are.
+ */
+class MappedFile {
+    std::vector<symbol::Id> m_symbols;
+    std::vector<ast::FunctionProto> m_protos;
+    TreeView m_view;
+
+public:
+    /// throws std::runtime_error if data is not a binary AST file this version can read
+    explicit MappedFile(StringRef data);
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    TreeView const &view() const;
+};
+}  // namespace flat
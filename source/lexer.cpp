@@ -1,36 +1,109 @@
 #include "lexer.hpp"
+#include "lexer_scan.hpp"
 
-#define KWD_TOKEN(kind) \
-Token { \
-    .value = StringRef { \
-        .start = code + start, \
-        .length = i - start + 1, \
-    }, \
-    .type = TokenType::kind, \
-    .meta = std::nullopt, \
-    .loc = LocationInfo { \
-        .line = line, \
-        .column = column, \
-        .file = file, \
-    }, \
-}
+#include <algorithm>
+#include <cstring>
+#include <thread>
 
-#define SWITCH_CHARS_BRANCH(kind) \
-result.push_back(Token { \
-    .value = StringRef { \
-        .start = code + start, \
-        .length = i - start + 1, \
-    }, \
-    .type = TokenType::kind, \
-    .meta = std::nullopt, \
-    .loc = LocationInfo { \
-        .line = line, \
-        .column = column, \
-        .file = file, \
-    }, \
-}); break;
+#define SWITCH_CHARS_BRANCH(kind) pushToken(out, TokenType::kind, i, 1); return true;
 
 namespace token {
+typedef struct Keyword {
+    char const *text;
+    uint32_t length;
+    TokenType type;
+} Keyword;
+
+constexpr uint32_t constexprStrlen(char const *s) {
+    uint32_t n = 0;
+    while (s[n])
+        n++;
+    return n;
+}
+
+#define KEYWORD(text, kind) Keyword {text, constexprStrlen(text), TokenType::kind}
+
+/// to add a keyword, just add it here; the perfect hash below is regenerated at compile time
+constexpr Keyword keywords[] = {
+    KEYWORD("fn", fn_kwd),
+    KEYWORD("if", if_kwd),
+    KEYWORD("else", else_kwd),
+    KEYWORD("while", while_kwd),
+    KEYWORD("for", for_kwd),
+    KEYWORD("return", return_kwd),
+    KEYWORD("let", let_kwd),
+    KEYWORD("extern", extern_kwd),
+    KEYWORD("externc", externc_kwd),
+};
+
+constexpr uint32_t n_keywords = sizeof(keywords) / sizeof(keywords[0]);
+
+#define KEYWORD_TABLE_BITS 6
+#define KEYWORD_TABLE_SIZE (1 << KEYWORD_TABLE_BITS)
+#define KEYWORD_SEED_SEARCH_LIMIT 4096
+
+/// multiplicative hash over (first char, last char, length) of an identifier
+constexpr uint32_t keywordHash(char first, char last, uint32_t length, uint32_t seed) {
+    uint32_t key = static_cast<uint32_t>(static_cast<unsigned char>(first)) << 16
+        | static_cast<uint32_t>(static_cast<unsigned char>(last)) << 8
+        | (length & 0xff);
+    return (key * seed) >> (32 - KEYWORD_TABLE_BITS);
+}
+
+constexpr uint32_t keywordHash(Keyword const &kwd, uint32_t seed) {
+    return keywordHash(kwd.text[0], kwd.text[kwd.length - 1], kwd.length, seed);
+}
+
+constexpr bool isPerfectKeywordSeed(uint32_t seed) {
+    bool used[KEYWORD_TABLE_SIZE] = {};
+    for (uint32_t i = 0; i < n_keywords; i++) {
+        uint32_t h = keywordHash(keywords[i], seed);
+        if (used[h])
+            return false;
+        used[h] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t findKeywordSeed() {
+    for (uint32_t k = 0; k < KEYWORD_SEED_SEARCH_LIMIT; k++) {
+        uint32_t seed = 0x9e3779b1u + 2 * k;  // odd multipliers around the golden ratio
+        if (isPerfectKeywordSeed(seed))
+            return seed;
+    }
+    return 0;
+}
+
+constexpr uint32_t keyword_seed = findKeywordSeed();
+static_assert(keyword_seed != 0, "no perfect hash seed found for the keyword set, increase KEYWORD_TABLE_BITS");
+
+typedef struct KeywordTable {
+    int8_t slots[KEYWORD_TABLE_SIZE];
+} KeywordTable;
+
+constexpr KeywordTable buildKeywordTable() {
+    KeywordTable table = {};
+    for (uint32_t i = 0; i < KEYWORD_TABLE_SIZE; i++)
+        table.slots[i] = -1;
+    for (uint32_t i = 0; i < n_keywords; i++)
+        table.slots[keywordHash(keywords[i], keyword_seed)] = static_cast<int8_t>(i);
+    return table;
+}
+
+constexpr KeywordTable keyword_table = buildKeywordTable();
+
+TokenType keywordOrIdent(StringRef ident) {
+    if (!ident.length)
+        return TokenType::ident;
+    int8_t slot = keyword_table.slots[keywordHash(ident.start[0], ident.start[ident.length - 1], ident.length, keyword_seed)];
+    if (slot < 0)
+        return TokenType::ident;
+    Keyword const &kwd = keywords[slot];
+    if (kwd.length == ident.length && std::memcmp(kwd.text, ident.start, ident.length) == 0)
+        return kwd.type;
+    return TokenType::ident;
+}
+
 std::string displayTokenType(TokenType t) {
     if (t == TokenType::eof) return "eof";
     if (t == TokenType::left_paren) return "(";
@@ -58,135 +131,127 @@ std::string displayTokenType(TokenType t) {
     return "<UnknownTokenType>";
 }
 
-std::vector<Token> tokenize(StringRef file, StringRef code_) {
-    char const *code = code_.start;
-    uint32_t length = code_.length;
-    std::vector<Token> result;
-    uint32_t line = 1;
-    uint32_t column = 0;
-    bool is_comment = false;
-    bool last_was_slash = false;
-    bool last_was_zero = false;
-    bool hex_mode = false;
-    for (uint32_t i = 0; i < length; i++, column++) {
-        char c = code[i];
-        if (last_was_slash && c == '/') {
-            is_comment = true;
-            result.pop_back();  // remove the slash that has already been added
-        }
+uint32_t TokenBuffer::size() const {
+    return types.size();
+}
 
-        if (c == ' ')
-            continue;
-        else if (c == '\n') {
-            line++;
-            column = -1;
-            is_comment = false;
-            continue;
-        }
+StringRef TokenBuffer::value(uint32_t idx) const {
+    return StringRef {
+        .start = code.start + offsets[idx],
+        .length = lengths[idx],
+    };
+}
 
-        if (is_comment)
-            continue;
+uint64_t TokenBuffer::number(uint32_t idx) const {
+    auto it = std::lower_bound(number_token_indices.begin(), number_token_indices.end(), idx);
+    if (it == number_token_indices.end() || *it != idx)
+        throw std::runtime_error("unreachable: token " + std::to_string(idx) + " is not a number token");
+    return numbers[it - number_token_indices.begin()];
+}
 
-        if (last_was_zero && c == 'x') {
-            last_was_zero = false;
-            hex_mode = true;
-            continue;
-        } else if (last_was_zero) {
-            result.push_back(
-                Token {
-                    .value = StringRef {
-                        .start = code + i - 1,
-                        .length = 1,
-                    },
-                    .type = TokenType::number,
-                    .meta = TokenMeta {.number = 0},
-                    .loc = LocationInfo {
-                        .line = line,
-                        .column = column,
-                        .file = file,
-                    }
-                }
-            );
-        }
+symbol::Id TokenBuffer::sym(uint32_t idx) const {
+    return symbols[idx];
+}
 
-        if (c == '0') {
-            last_was_zero = true;
-            continue;
-        } else
-            last_was_zero = false;
+LocationInfo TokenBuffer::locationOf(uint32_t offset) const {
+    // index of the first line starting after offset == 1-based line number of offset
+    uint32_t line = std::upper_bound(line_starts.begin(), line_starts.end(), offset) - line_starts.begin();
+    return LocationInfo {
+        .line = line,
+        .column = offset - line_starts[line - 1],
+        .file = file,
+    };
+}
 
+LocationInfo TokenBuffer::loc(uint32_t idx) const {
+    return locationOf(offsets[idx]);
+}
 
-        last_was_slash = c == '/';
+StringRef TokenRef::value() const {
+    return buffer->value(idx);
+}
 
-        uint32_t start = i;
-        if ((std::isalpha(c) || c == '_') && !hex_mode) {
-            std::string ident;
-            while (i < length && (std::isalpha(c) || c == '_' || std::isdigit(c))) {
-                ident += c;
-                if (++i < length) c = code[i];
-            }
-            i--;
-            if (ident == "fn") {
-                result.push_back(
-                    KWD_TOKEN(fn_kwd)
-                );
-            } else if (ident == "if") {
-                result.push_back(
-                    KWD_TOKEN(if_kwd)
-                );
-            } else if (ident == "else") {
-                result.push_back(
-                    KWD_TOKEN(else_kwd)
-                );
-            } else if (ident == "while") {
-                result.push_back(
-                    KWD_TOKEN(while_kwd)
-                );
-            } else if (ident == "for") {
-                result.push_back(
-                    KWD_TOKEN(for_kwd)
-                );
-            } else if (ident == "return") {
-                result.push_back(
-                    KWD_TOKEN(return_kwd)
-                );
-            } else if (ident == "let") {
-                result.push_back(
-                    KWD_TOKEN(let_kwd)
-                );
-            } else if (ident == "extern") {
-                result.push_back(
-                    KWD_TOKEN(extern_kwd)
-                );
-            } else if (ident == "externc") {
-                result.push_back(
-                    KWD_TOKEN(externc_kwd)
-                );
-            } else {
-                StringRef ident_str = {
-                    .start = code + start,
-                    .length = i - start + 1,
-                };
-                result.push_back(
-                    Token {
-                        .value = StringRef {
-                            .start = code + start,
-                            .length = i - start + 1,
-                        },
-                        .type = TokenType::ident,
-                        .meta = std::nullopt,
-                        .loc = LocationInfo {
-                            .line = line,
-                            .column = column,
-                            .file = file,
-                        },
-                    }
-                );
-            }
-        } else if (std::isdigit(c) || (hex_mode && (('a' <= c && c <= 'f') || ('A' <= c && c <= 'F')))) {
+uint64_t TokenRef::number() const {
+    return buffer->number(idx);
+}
+
+symbol::Id TokenRef::sym() const {
+    return buffer->sym(idx);
+}
+
+LocationInfo TokenRef::loc() const {
+    return buffer->loc(idx);
+}
+
+void pushToken(TokenBuffer *buf, TokenType type, uint32_t offset, uint32_t length, symbol::Id sym) {
+    buf->types.push_back(type);
+    buf->offsets.push_back(offset);
+    buf->lengths.push_back(length);
+    buf->symbols.push_back(sym);
+}
+
+void pushNumber(TokenBuffer *buf, uint32_t offset, uint32_t length, uint64_t value) {
+    buf->number_token_indices.push_back(buf->types.size());
+    buf->numbers.push_back(value);
+    pushToken(buf, TokenType::number, offset, length);
+}
+
+void TokenBuffer::clearTokens() {
+    types.clear();
+    offsets.clear();
+    lengths.clear();
+    symbols.clear();
+    numbers.clear();
+    number_token_indices.clear();
+    matches.clear();
+}
+
+bool LexCursor::next(TokenBuffer *out) {
+    char const *src = code.start;
+    while (pos < end) {
+        char c = src[pos];
+        if (c == ' ') {
+            // skip the whole run of spaces at once
+            pos = scan::skipSpaces(src + pos, src + end) - src;
+            continue;
+        } else if (c == '\n') {
+            out->line_starts.push_back(++pos);
+            continue;
+        } else if (c == '/' && pos + 1 < end && src[pos + 1] == '/') {
+            // skip the comment body up to (not including) the newline
+            pos = scan::findNewline(src + pos, src + end) - src;
+            continue;
+        }
+
+        uint32_t start = pos;
+        bool hex_mode = c == '0' && pos + 1 < end && src[pos + 1] == 'x';
+        if (hex_mode) {
+            pos += 2;
+            // a `0x` without any hex digits after it is dropped
+            if (pos == end || !scan::isHexDigit(src[pos]))
+                continue;
+            c = src[pos];
+        }
+
+        if (c == '0' && !hex_mode) {
+            // a leading zero is always its own token (`05` lexes as `0` `5`)
+            pushNumber(out, pos++, 1, 0);
+            return true;
+        } else if (scan::isIdentStart(c) && !hex_mode) {
+            pos = scan::skipIdentChars(src + pos, src + end) - src;
+            StringRef ident = {
+                .start = src + start,
+                .length = pos - start,
+            };
+            TokenType type = keywordOrIdent(ident);
+            pushToken(out, type, start, ident.length, type == TokenType::ident ? symbol::intern(ident) : SYMBOL_NONE);
+            return true;
+        } else if (scan::isDigit(c) || hex_mode) {
             uint64_t num = 0;
             uint64_t base = hex_mode ? 16 : 10;
-            while (i < length && (std::isdigit(c) || (hex_mode && (('a' <= c && c <= 'f') || ('A' <= c && c <= 'F'))))) {
+            uint32_t run_end = (hex_mode ? scan::skipHexDigits(src + pos, src + end) : scan::skipDigits(src + pos, src + end)) - src;
+            for (; pos < run_end; pos++) {
+                c = src[pos];
                 if (hex_mode && 'A' <= c && c <= 'F')
                     c -= 'A' - 10;
                 else if (hex_mode && 'a' <= c && c <= 'f')
@@ -194,25 +259,13 @@ std::vector<Token> tokenize(StringRef file, StringRef code_) {
                 else
                     c -= '0';
                 num = base * num + c;
-                if (++i < length) c = code[i];
             }
-            i--;
-            result.push_back(
-                Token {
-                    .value = StringRef {
-                        .start = code + start - hex_mode * 2,
-                        .length = i - start + 1 + hex_mode * 2,
-                    },
-                    .type = TokenType::number,
-                    .meta = TokenMeta {.number = num},
-                    .loc = LocationInfo {
-                        .line = line,
-                        .column = column,
-                        .file = file,
-                    }
-                }
-            );
-        } else switch (c) {
+            pushNumber(out, start, pos - start, num);
+            return true;
+        }
+
+        uint32_t i = pos++;
+        switch (c) {
             case '+': SWITCH_CHARS_BRANCH(plus);
             case '-': SWITCH_CHARS_BRANCH(minus);
             case '*': SWITCH_CHARS_BRANCH(asterisk);
@@ -225,41 +278,229 @@ std::vector<Token> tokenize(StringRef file, StringRef code_) {
             case ')': SWITCH_CHARS_BRANCH(right_paren);
             case '{': SWITCH_CHARS_BRANCH(left_brace);
             case '}': SWITCH_CHARS_BRANCH(right_brace);
-            default: break;
+            default: continue;  // unknown characters are skipped
+        }
+    }
+    return false;
+}
+
+LexCursor newLexCursor(StringRef code) {
+    return LexCursor {
+        .code = code,
+        .pos = 0,
+        .end = code.length,
+    };
+}
+
+void matchBrackets(TokenBuffer *buf) {
+    buf->matches.assign(buf->size(), TOKEN_NO_MATCH);
+    std::vector<uint32_t> open_parens;
+    std::vector<uint32_t> open_braces;
+    for (uint32_t i = 0; i < buf->size(); i++) {
+        std::vector<uint32_t> *stack;
+        switch (buf->types[i]) {
+            case TokenType::left_paren:
+                open_parens.push_back(i);
+                continue;
+            case TokenType::left_brace:
+                open_braces.push_back(i);
+                continue;
+            case TokenType::right_paren:
+                stack = &open_parens;
+                break;
+            case TokenType::right_brace:
+                stack = &open_braces;
+                break;
+            default:
+                continue;
         }
-        hex_mode = false;
+        if (stack->empty())
+            continue;
+        buf->matches[i] = stack->back();
+        buf->matches[stack->back()] = i;
+        stack->pop_back();
     }
-    if (last_was_zero)
+}
+
+TokenBuffer lex(StringRef file, StringRef code) {
+    TokenBuffer result = {};
+    result.file = file;
+    result.code = code;
+    // rough upper bound for typical code, avoids most regrowth of the arrays
+    uint32_t expected_tokens = code.length / 4 + 1;
+    result.types.reserve(expected_tokens);
+    result.offsets.reserve(expected_tokens);
+    result.lengths.reserve(expected_tokens);
+    result.symbols.reserve(expected_tokens);
+    result.line_starts.push_back(0);
+    LexCursor cursor = newLexCursor(code);
+    while (cursor.next(&result))
+        ;
+    pushToken(&result, TokenType::eof, code.length, 0);
+    matchBrackets(&result);
+    return result;
+}
+
+TokenBuffer lexParallel(StringRef file, StringRef code, uint32_t n_threads, uint32_t min_chunk_size) {
+    uint32_t n_chunks = std::max(1u, std::min(n_threads, code.length / std::max(1u, min_chunk_size)));
+    if (n_chunks == 1)
+        return lex(file, code);
+
+    // split right after a newline: no token or comment spans a newline and the cursor carries no state across
+    // tokens, so every chunk can be lexed on its own and no fix-up of lexer state is needed at the seams
+    std::vector<uint32_t> bounds = {0};
+    for (uint32_t k = 1; k < n_chunks; k++) {
+        uint32_t target = std::max(bounds.back(), static_cast<uint32_t>(static_cast<uint64_t>(code.length) * k / n_chunks));
+        auto newline = static_cast<char const *>(std::memchr(code.start + target, '\n', code.length - target));
+        if (!newline)
+            break;
+        uint32_t bound = newline - code.start + 1;
+        if (bound > bounds.back() && bound < code.length)
+            bounds.push_back(bound);
+    }
+    bounds.push_back(code.length);
+
+    std::vector<TokenBuffer> chunks(bounds.size() - 1);
+    std::vector<std::thread> workers;
+    for (uint32_t k = 0; k < chunks.size(); k++) {
+        workers.emplace_back([&, k]() {
+            TokenBuffer *chunk = &chunks[k];
+            uint32_t expected_tokens = (bounds[k + 1] - bounds[k]) / 4 + 1;
+            chunk->types.reserve(expected_tokens);
+            chunk->offsets.reserve(expected_tokens);
+            chunk->lengths.reserve(expected_tokens);
+            chunk->symbols.reserve(expected_tokens);
+            LexCursor cursor = {
+                .code = code,
+                .pos = bounds[k],
+                .end = bounds[k + 1],
+            };
+            while (cursor.next(chunk))
+                ;
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    // concatenate; offsets and line starts are absolute already, only the number side table indices need rebasing
+    TokenBuffer result = {};
+    result.file = file;
+    result.code = code;
+    size_t n_tokens = 1;
+    size_t n_numbers = 0;
+    size_t n_lines = 1;
+    for (auto const &chunk : chunks) {
+        n_tokens += chunk.size();
+        n_numbers += chunk.numbers.size();
+        n_lines += chunk.line_starts.size();
+    }
+    result.types.reserve(n_tokens);
+    result.offsets.reserve(n_tokens);
+    result.lengths.reserve(n_tokens);
+    result.symbols.reserve(n_tokens);
+    result.numbers.reserve(n_numbers);
+    result.number_token_indices.reserve(n_numbers);
+    result.line_starts.reserve(n_lines);
+    result.line_starts.push_back(0);
+    for (auto const &chunk : chunks) {
+        uint32_t base = result.size();
+        result.types.insert(result.types.end(), chunk.types.begin(), chunk.types.end());
+        result.offsets.insert(result.offsets.end(), chunk.offsets.begin(), chunk.offsets.end());
+        result.lengths.insert(result.lengths.end(), chunk.lengths.begin(), chunk.lengths.end());
+        result.symbols.insert(result.symbols.end(), chunk.symbols.begin(), chunk.symbols.end());
+        result.numbers.insert(result.numbers.end(), chunk.numbers.begin(), chunk.numbers.end());
+        for (uint32_t idx : chunk.number_token_indices)
+            result.number_token_indices.push_back(base + idx);
+        result.line_starts.insert(result.line_starts.end(), chunk.line_starts.begin(), chunk.line_starts.end());
+    }
+    pushToken(&result, TokenType::eof, code.length, 0);
+    // brackets can be matched across chunk seams, so this is done once on the concatenated buffer
+    matchBrackets(&result);
+    return result;
+}
+
+RelexResult relex(TokenBuffer *tokens, StringRef new_code, TextEdit edit) {
+    int64_t delta = static_cast<int64_t>(edit.inserted_length) - static_cast<int64_t>(edit.removed_length);
+
+    // restart at the start of the line the edit begins in, stop after the first newline behind the inserted text
+    auto &line_starts = tokens->line_starts;
+    uint32_t restart = *(std::upper_bound(line_starts.begin(), line_starts.end(), edit.offset) - 1);
+    uint32_t inserted_end = edit.offset + edit.inserted_length;
+    auto newline = static_cast<char const *>(std::memchr(new_code.start + inserted_end, '\n', new_code.length - inserted_end));
+    uint32_t new_end = newline ? newline - new_code.start + 1 : new_code.length;
+    uint32_t old_end = static_cast<uint32_t>(new_end - delta);
+
+    TokenBuffer region = {};
+    LexCursor cursor = {
+        .code = new_code,
+        .pos = restart,
+        .end = new_end,
+    };
+    while (cursor.next(&region))
+        ;
+
+    // tokens: [first, last) of the old buffer are replaced by the region, everything from last on is shifted
+    auto &offsets = tokens->offsets;
+    uint32_t first = std::lower_bound(offsets.begin(), offsets.end(), restart) - offsets.begin();
+    uint32_t last = std::lower_bound(offsets.begin(), offsets.end(), old_end) - offsets.begin();
+    tokens->types.erase(tokens->types.begin() + first, tokens->types.begin() + last);
+    tokens->types.insert(tokens->types.begin() + first, region.types.begin(), region.types.end());
+    tokens->lengths.erase(tokens->lengths.begin() + first, tokens->lengths.begin() + last);
+    tokens->lengths.insert(tokens->lengths.begin() + first, region.lengths.begin(), region.lengths.end());
+    tokens->symbols.erase(tokens->symbols.begin() + first, tokens->symbols.begin() + last);
+    tokens->symbols.insert(tokens->symbols.begin() + first, region.symbols.begin(), region.symbols.end());
+    offsets.erase(offsets.begin() + first, offsets.begin() + last);
+    offsets.insert(offsets.begin() + first, region.offsets.begin(), region.offsets.end());
+    for (uint32_t i = first + region.size(); i < offsets.size(); i++)
+        offsets[i] += delta;
+
+    // number side table: same splice, token indices behind the region move by the change in token count
+    int64_t index_delta = static_cast<int64_t>(region.size()) - static_cast<int64_t>(last - first);
+    auto &indices = tokens->number_token_indices;
+    uint32_t first_number = std::lower_bound(indices.begin(), indices.end(), first) - indices.begin();
+    uint32_t last_number = std::lower_bound(indices.begin(), indices.end(), last) - indices.begin();
+    tokens->numbers.erase(tokens->numbers.begin() + first_number, tokens->numbers.begin() + last_number);
+    tokens->numbers.insert(tokens->numbers.begin() + first_number, region.numbers.begin(), region.numbers.end());
+    indices.erase(indices.begin() + first_number, indices.begin() + last_number);
+    indices.insert(indices.begin() + first_number, region.number_token_indices.begin(), region.number_token_indices.end());
+    for (uint32_t i = first_number; i < first_number + region.number_token_indices.size(); i++)
+        indices[i] += first;
+    for (uint32_t i = first_number + region.number_token_indices.size(); i < indices.size(); i++)
+        indices[i] += index_delta;
+
+    // line starts: those inside the region were collected by the cursor (including new_end itself)
+    uint32_t first_line = std::upper_bound(line_starts.begin(), line_starts.end(), restart) - line_starts.begin();
+    uint32_t last_line = std::upper_bound(line_starts.begin(), line_starts.end(), old_end) - line_starts.begin();
+    line_starts.erase(line_starts.begin() + first_line, line_starts.begin() + last_line);
+    line_starts.insert(line_starts.begin() + first_line, region.line_starts.begin(), region.line_starts.end());
+    for (uint32_t i = first_line + region.line_starts.size(); i < line_starts.size(); i++)
+        line_starts[i] += delta;
+
+    // an edit can rebalance brackets anywhere in the file; the splices above are linear anyway
+    matchBrackets(tokens);
+
+    tokens->code = new_code;
+    return RelexResult {
+        .first_token = first,
+        .n_removed = last - first,
+        .n_inserted = region.size(),
+    };
+}
+
+std::vector<Token> tokenize(StringRef file, StringRef code) {
+    TokenBuffer buf = lex(file, code);
+    std::vector<Token> result;
+    result.reserve(buf.size());
+    for (uint32_t i = 0; i < buf.size(); i++) {
         result.push_back(
             Token {
-                .value = StringRef {
-                    .start = code + length - 1,
-                    .length = 1,
-                },
-                .type = TokenType::number,
-                .meta = TokenMeta {.number = 0},
-                .loc = LocationInfo {
-                    .line = line,
-                    .column = column,
-                    .file = file,
-                }
+                .value = buf.value(i),
+                .type = buf.types[i],
+                .meta = buf.types[i] == TokenType::number ? std::optional(TokenMeta {.number = buf.number(i)}) : std::nullopt,
+                .loc = buf.loc(i),
             }
         );
-    result.push_back(
-        Token {
-            .value = StringRef {
-                .start = code,
-                .length = 0,
-            },
-            .type = TokenType::eof,
-            .meta = std::nullopt,
-            .loc = LocationInfo {
-                .line = line,
-                .column = column,
-                .file = file,
-            }
-        }
-    );
+    }
     return result;
 }
 }  // namespace token
@@ -1,14 +1,16 @@
 #pragma once
 
 #include "lib.hpp"
+#include "symbol.hpp"
 
 #include <cstdint>
+#include <initializer_list>
 #include <string>
 #include <vector>
 #include <optional>
 
 namespace token {
-typedef enum class TokenType : uint32_t {
+typedef enum class TokenType : uint8_t {
     eof,
 
     left_paren,
@@ -42,6 +44,23 @@ typedef enum class TokenType : uint32_t {
 
 std::string displayTokenType(TokenType t);
 
+/// set of token types with one bit per type: constexpr, allocation free and O(1) to test (used by the parser to check
+/// what may come next)
+typedef struct TokenTypeSet {
+    uint32_t bits;
+
+    constexpr TokenTypeSet(std::initializer_list<TokenType> types) : bits(0) {
+        for (TokenType t : types)
+            bits |= 1u << static_cast<uint32_t>(t);
+    }
+
+    constexpr bool contains(TokenType t) const {
+        return (bits >> static_cast<uint32_t>(t)) & 1;
+    }
+} TokenTypeSet;
+
+static_assert(static_cast<uint32_t>(TokenType::invalid) < 32, "TokenTypeSet needs one bit per token type");
+
 typedef union TokenMeta {
     uint64_t number;
 } TokenMeta;
@@ -53,5 +72,105 @@ typedef struct Token {
     LocationInfo loc;
 } Token;
 
-std::vector<Token> tokenize(StringRef file, StringRef code_);
+/* Compact struct-of-arrays token stream. Per token only the type (1 byte), the offset into the source, the length and
+ * the interned symbol are stored; number values live in a side table and line/column are recovered from `line_starts`
+ * on demand.
+ * The last token is always eof (offset = code length, length 0).
+ */
+typedef struct TokenBuffer {
+    StringRef file;
+    StringRef code;
+    std::vector<TokenType> types;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    /// interned identifier of every ident token (SYMBOL_NONE for all other tokens)
+    std::vector<symbol::Id> symbols;
+    /// values of the number tokens, sorted by token index
+    std::vector<uint64_t> numbers;
+    std::vector<uint32_t> number_token_indices;
+    /// offset of the first character of every line (line_starts[0] == 0)
+    std::vector<uint32_t> line_starts;
+    /// index of the matching bracket of every `(`, `)`, `{` and `}` token (TOKEN_NO_MATCH for unmatched brackets and
+    /// all other tokens). Parens and braces are matched independently of each other. Filled in by matchBrackets.
+    std::vector<uint32_t> matches;
+
+    uint32_t size() const;
+    StringRef value(uint32_t idx) const;
+    /// value of a number token (O(log n) lookup in the side table)
+    uint64_t number(uint32_t idx) const;
+    symbol::Id sym(uint32_t idx) const;
+    /// line (1-based) and column (0-based) of a source offset (O(log lines))
+    LocationInfo locationOf(uint32_t offset) const;
+    LocationInfo loc(uint32_t idx) const;
+    /// drop all tokens but keep the line table (used when a buffer is reused as a sliding window)
+    void clearTokens();
+} TokenBuffer;
+
+/// lightweight handle to one token of a TokenBuffer, everything except the type is looked up on demand
+typedef struct TokenRef {
+    TokenBuffer const *buffer;
+    uint32_t idx;
+    TokenType type;
+
+    StringRef value() const;
+    uint64_t number() const;
+    symbol::Id sym() const;
+    LocationInfo loc() const;
+} TokenRef;
+
+/// returns the keyword type of an identifier-like slice, or TokenType::ident if it is not a keyword (O(1), allocation free)
+TokenType keywordOrIdent(StringRef ident);
+
+/* Pull-based lexer: produces one token at a time on demand. Comments and `0x` prefixes are recognized with one
+ * character of lookahead, so the only state carried between tokens is the position. Tokens never span a newline,
+ * which means a cursor can start and stop at any line boundary.
+ */
+typedef struct LexCursor {
+    StringRef code;
+    uint32_t pos;
+    uint32_t end;
+
+    /// lex the next token in [pos, end) and append it to out (newlines passed on the way go into out->line_starts);
+    /// returns false without appending anything once the input is exhausted. eof tokens are left to the caller.
+    bool next(TokenBuffer *out);
+} LexCursor;
+
+LexCursor newLexCursor(StringRef code);
+void pushToken(TokenBuffer *buf, TokenType type, uint32_t offset, uint32_t length, symbol::Id sym = SYMBOL_NONE);
+
+#define TOKEN_NO_MATCH UINT32_MAX
+
+/// (re)compute buf->matches in one pass over the token types; done by all lexing entry points, so the parser can
+/// find the end of any block or parenthesized expression in O(1)
+void matchBrackets(TokenBuffer *buf);
+
+/// lex a whole file at once (the result ends on an eof token)
+TokenBuffer lex(StringRef file, StringRef code);
+#define PARALLEL_LEX_MIN_CHUNK_SIZE (1 << 20)
+
+/// lex a file on up to n_threads threads: the code is split into chunks at line boundaries (each at least
+/// min_chunk_size bytes) that are lexed concurrently and then concatenated. Produces exactly the same buffer as lex.
+TokenBuffer lexParallel(StringRef file, StringRef code, uint32_t n_threads, uint32_t min_chunk_size = PARALLEL_LEX_MIN_CHUNK_SIZE);
+typedef struct TextEdit {
+    /// offset of the edit in the old code
+    uint32_t offset;
+    uint32_t removed_length;
+    uint32_t inserted_length;
+} TextEdit;
+
+/// token index range of a buffer that was replaced by relex (all later tokens were only shifted)
+typedef struct RelexResult {
+    uint32_t first_token;
+    uint32_t n_removed;
+    uint32_t n_inserted;
+} RelexResult;
+
+/// update a buffer in place after an edit, new_code being the whole code after the edit. Only the lines touched by
+/// the edit are lexed again (tokens never span a newline, so the stream is back in sync at the next line start);
+/// offsets and line starts of everything after them are shifted. The result is identical to lexing new_code from
+/// scratch.
+RelexResult relex(TokenBuffer *tokens, StringRef new_code, TextEdit edit);
+
+/// materializes the full token structs (convenience wrapper around lex)
+std::vector<Token> tokenize(StringRef file, StringRef code);
 }  // namespace Token
@@ -0,0 +1,291 @@
+#include "lexer_scan.hpp"
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LEXER_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace token {
+namespace scan {
+constexpr std::array<uint8_t, 256> makeCharClassTable() {
+    std::array<uint8_t, 256> table {};
+    table[' '] |= space;
+    table['\n'] |= newline;
+    for (int c = 'a'; c <= 'z'; c++)
+        table[c] |= ident_start;
+    for (int c = 'A'; c <= 'Z'; c++)
+        table[c] |= ident_start;
+    table['_'] |= ident_start;
+    for (int c = '0'; c <= '9'; c++)
+        table[c] |= digit | hex_digit;
+    for (int c = 'a'; c <= 'f'; c++)
+        table[c] |= hex_digit;
+    for (int c = 'A'; c <= 'F'; c++)
+        table[c] |= hex_digit;
+    return table;
+}
+
+std::array<uint8_t, 256> const char_classes = makeCharClassTable();
+
+char const *scalarSkipSpaces(char const *p, char const *end) {
+    while (p < end && *p == ' ')
+        p++;
+    return p;
+}
+
+char const *scalarFindNewline(char const *p, char const *end) {
+    if (p >= end)
+        return end;
+    void const *nl = std::memchr(p, '\n', end - p);
+    return nl ? static_cast<char const*>(nl) : end;
+}
+
+char const *scalarSkipClass(char const *p, char const *end, uint8_t cls) {
+    while (p < end && hasClass(*p, cls))
+        p++;
+    return p;
+}
+
+char const *scalarSkipIdentChars(char const *p, char const *end) {
+    return scalarSkipClass(p, end, ident_start | digit);
+}
+
+char const *scalarSkipDigits(char const *p, char const *end) {
+    return scalarSkipClass(p, end, digit);
+}
+
+char const *scalarSkipHexDigits(char const *p, char const *end) {
+    return scalarSkipClass(p, end, hex_digit);
+}
+
+#ifdef LEXER_SCAN_X86
+/* SSE2 kernels: character ranges are checked with signed byte compares, which conveniently rejects all bytes >= 0x80
+ * (they are negative when interpreted as signed). `mask` has a bit set for every byte that ends the run.
+ */
+
+#define SSE2_SCAN_LOOP(end_mask_expr, scalar_tail) \
+    while (end - p >= 16) { \
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)); \
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(end_mask_expr)); \
+        if (mask) \
+            return p + __builtin_ctz(mask); \
+        p += 16; \
+    } \
+    return scalar_tail(p, end);
+
+inline __m128i sse2InRange(__m128i v, char lo, char hi) {
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+        _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(hi + 1)), v)
+    );
+}
+
+inline __m128i sse2IsDigit(__m128i v) {
+    return sse2InRange(v, '0', '9');
+}
+
+inline __m128i sse2Lower(__m128i v) {
+    return _mm_or_si128(v, _mm_set1_epi8(0x20));
+}
+
+inline __m128i sse2IsIdentChar(__m128i v) {
+    return _mm_or_si128(
+        _mm_or_si128(sse2InRange(sse2Lower(v), 'a', 'z'), sse2IsDigit(v)),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))
+    );
+}
+
+inline __m128i sse2IsHexDigit(__m128i v) {
+    return _mm_or_si128(sse2InRange(sse2Lower(v), 'a', 'f'), sse2IsDigit(v));
+}
+
+inline __m128i sse2Not(__m128i v) {
+    return _mm_xor_si128(v, _mm_set1_epi8(static_cast<char>(0xff)));
+}
+
+char const *sse2SkipSpaces(char const *p, char const *end) {
+    SSE2_SCAN_LOOP(sse2Not(_mm_cmpeq_epi8(v, _mm_set1_epi8(' '))), scalarSkipSpaces)
+}
+
+char const *sse2FindNewline(char const *p, char const *end) {
+    SSE2_SCAN_LOOP(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), scalarFindNewline)
+}
+
+char const *sse2SkipIdentChars(char const *p, char const *end) {
+    SSE2_SCAN_LOOP(sse2Not(sse2IsIdentChar(v)), scalarSkipIdentChars)
+}
+
+char const *sse2SkipDigits(char const *p, char const *end) {
+    SSE2_SCAN_LOOP(sse2Not(sse2IsDigit(v)), scalarSkipDigits)
+}
+
+char const *sse2SkipHexDigits(char const *p, char const *end) {
+    SSE2_SCAN_LOOP(sse2Not(sse2IsHexDigit(v)), scalarSkipHexDigits)
+}
+
+/* AVX2 kernels: classify 32 bytes at once using two 16-entry lookup tables indexed by the low and high nibble of each
+ * byte (vpshufb). A byte is in class X iff (lo_lut[lo] & hi_lut[hi]) has one of the class bits of X set.
+ */
+
+enum NibbleClass : uint8_t {
+    nc_digit = 1 << 0,       // hi 3, lo 0-9
+    nc_hex_letter = 1 << 1,  // hi 4/6, lo 1-6
+    nc_alpha_lo = 1 << 2,    // hi 4/6, lo 1-15 (A-O, a-o)
+    nc_alpha_hi = 1 << 3,    // hi 5/7, lo 0-10 (P-Z, p-z)
+    nc_underscore = 1 << 4,  // hi 5, lo 15
+};
+
+#define AVX2_LO_NIBBLE_LUT \
+    _mm256_setr_epi8( \
+        nc_digit | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_alpha_lo | nc_alpha_hi, \
+        nc_alpha_lo | nc_alpha_hi, \
+        nc_alpha_lo, \
+        nc_alpha_lo, \
+        nc_alpha_lo, \
+        nc_alpha_lo, \
+        nc_alpha_lo | nc_underscore, \
+        nc_digit | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_hex_letter | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_alpha_lo | nc_alpha_hi, \
+        nc_digit | nc_alpha_lo | nc_alpha_hi, \
+        nc_alpha_lo | nc_alpha_hi, \
+        nc_alpha_lo, \
+        nc_alpha_lo, \
+        nc_alpha_lo, \
+        nc_alpha_lo, \
+        nc_alpha_lo | nc_underscore \
+    )
+
+#define AVX2_HI_NIBBLE_LUT \
+    _mm256_setr_epi8( \
+        0, 0, 0, nc_digit, \
+        nc_hex_letter | nc_alpha_lo, nc_alpha_hi | nc_underscore, nc_hex_letter | nc_alpha_lo, nc_alpha_hi, \
+        0, 0, 0, 0, 0, 0, 0, 0, \
+        0, 0, 0, nc_digit, \
+        nc_hex_letter | nc_alpha_lo, nc_alpha_hi | nc_underscore, nc_hex_letter | nc_alpha_lo, nc_alpha_hi, \
+        0, 0, 0, 0, 0, 0, 0, 0 \
+    )
+
+__attribute__((target("avx2")))
+inline char const *avx2SkipNibbleClass(char const *p, char const *end, uint8_t nibble_classes, char const *(*scalar_tail)(char const*, char const*)) {
+    __m256i const lo_lut = AVX2_LO_NIBBLE_LUT;
+    __m256i const hi_lut = AVX2_HI_NIBBLE_LUT;
+    __m256i const low_nibble_mask = _mm256_set1_epi8(0x0f);
+    __m256i const cls = _mm256_set1_epi8(static_cast<char>(nibble_classes));
+    __m256i const zero = _mm256_setzero_si256();
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+        __m256i lo = _mm256_shuffle_epi8(lo_lut, _mm256_and_si256(v, low_nibble_mask));
+        __m256i hi = _mm256_shuffle_epi8(hi_lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble_mask));
+        __m256i not_in_class = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_and_si256(lo, hi), cls), zero);
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(not_in_class));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return scalar_tail(p, end);
+}
+
+__attribute__((target("avx2")))
+char const *avx2SkipSpaces(char const *p, char const *end) {
+    __m256i const spaces = _mm256_set1_epi8(' ');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, spaces)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return sse2SkipSpaces(p, end);
+}
+
+__attribute__((target("avx2")))
+char const *avx2FindNewline(char const *p, char const *end) {
+    __m256i const newlines = _mm256_set1_epi8('\n');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newlines)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return sse2FindNewline(p, end);
+}
+
+__attribute__((target("avx2")))
+char const *avx2SkipIdentChars(char const *p, char const *end) {
+    return avx2SkipNibbleClass(p, end, nc_digit | nc_alpha_lo | nc_alpha_hi | nc_underscore, sse2SkipIdentChars);
+}
+
+__attribute__((target("avx2")))
+char const *avx2SkipDigits(char const *p, char const *end) {
+    return avx2SkipNibbleClass(p, end, nc_digit, sse2SkipDigits);
+}
+
+__attribute__((target("avx2")))
+char const *avx2SkipHexDigits(char const *p, char const *end) {
+    return avx2SkipNibbleClass(p, end, nc_digit | nc_hex_letter, sse2SkipHexDigits);
+}
+#endif
+
+std::vector<Kernels> availableKernels() {
+    std::vector<Kernels> kernels;
+    kernels.push_back(Kernels {scalarSkipSpaces, scalarFindNewline, scalarSkipIdentChars, scalarSkipDigits, scalarSkipHexDigits, "scalar"});
+#ifdef LEXER_SCAN_X86
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back(Kernels {sse2SkipSpaces, sse2FindNewline, sse2SkipIdentChars, sse2SkipDigits, sse2SkipHexDigits, "sse2"});
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(Kernels {avx2SkipSpaces, avx2FindNewline, avx2SkipIdentChars, avx2SkipDigits, avx2SkipHexDigits, "avx2"});
+#endif
+    return kernels;
+}
+
+Kernels const &activeKernels() {
+    static Kernels const kernels = availableKernels().back();
+    return kernels;
+}
+
+char const *skipSpaces(char const *p, char const *end) {
+    return activeKernels().skip_spaces(p, end);
+}
+
+char const *findNewline(char const *p, char const *end) {
+    return activeKernels().find_newline(p, end);
+}
+
+char const *skipIdentChars(char const *p, char const *end) {
+    return activeKernels().skip_ident_chars(p, end);
+}
+
+char const *skipDigits(char const *p, char const *end) {
+    return activeKernels().skip_digits(p, end);
+}
+
+char const *skipHexDigits(char const *p, char const *end) {
+    return activeKernels().skip_hex_digits(p, end);
+}
+
+char const *kernelName() {
+    return activeKernels().name;
+}
+}  // namespace scan
+}  // namespace token
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/* Bulk character scanning for the lexer. Every scan function returns a pointer to the first character in [p, end)
+ * that does *not* belong to the scanned class (or end). The SSE2/AVX2 kernels classify 16/32 bytes at a time and
+ * fall back to scalar code for the tail; the widest kernel supported by the running cpu is picked once at runtime.
+ */
+
+namespace token {
+namespace scan {
+typedef enum CharClass : uint8_t {
+    space = 1 << 0,
+    newline = 1 << 1,
+    ident_start = 1 << 2,
+    digit = 1 << 3,
+    hex_digit = 1 << 4,
+} CharClass;
+
+/// locale-independent replacement for std::isalpha/std::isdigit (indexed by unsigned char)
+extern std::array<uint8_t, 256> const char_classes;
+
+inline bool hasClass(char c, uint8_t cls) {
+    return char_classes[static_cast<unsigned char>(c)] & cls;
+}
+
+inline bool isIdentStart(char c) {
+    return hasClass(c, ident_start);
+}
+
+inline bool isIdentChar(char c) {
+    return hasClass(c, ident_start | digit);
+}
+
+inline bool isDigit(char c) {
+    return hasClass(c, digit);
+}
+
+inline bool isHexDigit(char c) {
+    return hasClass(c, hex_digit);
+}
+
+/// skip a run of ' ' characters
+char const *skipSpaces(char const *p, char const *end);
+/// skip until the next '\n' (used for comment bodies)
+char const *findNewline(char const *p, char const *end);
+/// skip a run of [A-Za-z0-9_]
+char const *skipIdentChars(char const *p, char const *end);
+/// skip a run of [0-9]
+char const *skipDigits(char const *p, char const *end);
+/// skip a run of [0-9A-Fa-f]
+char const *skipHexDigits(char const *p, char const *end);
+
+/// name of the kernel picked by the runtime cpu dispatch ("avx2", "sse2" or "scalar")
+char const *kernelName();
+
+/// one implementation of all scan functions
+typedef struct Kernels {
+    char const *(*skip_spaces)(char const*, char const*);
+    char const *(*find_newline)(char const*, char const*);
+    char const *(*skip_ident_chars)(char const*, char const*);
+    char const *(*skip_digits)(char const*, char const*);
+    char const *(*skip_hex_digits)(char const*, char const*);
+    char const *name;
+} Kernels;
+
+/// every kernel the running cpu supports, from "scalar" to the widest one, which is the one the dispatch picks (eg
+/// to check them all against the scalar one)
+std::vector<Kernels> availableKernels();
+}  // namespace scan
+}  // namespace token
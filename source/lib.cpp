@@ -1 +1,138 @@
+#if defined(__APPLE__)
+// ucontext is only declared for XSI programs there
+#define _XOPEN_SOURCE 700
+#define _DARWIN_C_SOURCE
+#endif
+
 #include "lib.hpp"
+#include <new>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define LIB_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define LIB_ASAN
+#endif
+#endif
+#ifdef LIB_ASAN
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+uintptr_t initStackLimit() {
+    uintptr_t low = 0;
+#if defined(__APPLE__)
+    pthread_t self = pthread_self();
+    low = reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(self)) - pthread_get_stacksize_np(self);
+#else
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+    if (!pthread_getattr_np(pthread_self(), &attr)) {
+        if (!pthread_attr_getstack(&attr, &addr, &size))
+            low = reinterpret_cast<uintptr_t>(addr);
+        pthread_attr_destroy(&attr);
+    }
+#endif
+    // if the bounds are unknown, assume the smallest default stack of the usual platforms (512 KiB) from here on
+    if (!low)
+        low = reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) - 512 * 1024;
+    stack_limit = low + STACK_RED_ZONE;
+    return stack_limit;
+}
+
+/// a mapped stack segment, its lowest page is a guard page
+typedef struct StackSegment {
+    void *base;
+} StackSegment;
+
+/// segments that were left again, kept for the next switch (a walk can go back and forth over the same depth many times)
+typedef struct StackSegmentCache {
+    std::vector<StackSegment> free;
+
+    ~StackSegmentCache() {
+        for (auto segment : free)
+            munmap(segment.base, STACK_SEGMENT_SIZE);
+    }
+} StackSegmentCache;
+
+#define STACK_SEGMENT_CACHE_SIZE 4
+
+thread_local StackSegmentCache stack_segment_cache;
+
+StackSegment takeStackSegment() {
+    auto &free = stack_segment_cache.free;
+    if (!free.empty()) {
+        StackSegment segment = free.back();
+        free.pop_back();
+        return segment;
+    }
+    void *base = mmap(nullptr, STACK_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        throw std::bad_alloc();
+    // running off the end of a segment faults instead of overwriting whatever is mapped below it
+    mprotect(base, static_cast<size_t>(sysconf(_SC_PAGESIZE)), PROT_NONE);
+    return StackSegment {.base = base};
+}
+
+void releaseStackSegment(StackSegment segment) {
+    auto &free = stack_segment_cache.free;
+    if (free.size() < STACK_SEGMENT_CACHE_SIZE)
+        free.push_back(segment);
+    else
+        munmap(segment.base, STACK_SEGMENT_SIZE);
+}
+
+typedef struct NewStackCall {
+    void (*fn)(void *);
+    void *ctx;
+    ucontext_t caller;
+#ifdef LIB_ASAN
+    void const *caller_stack_bottom;
+    size_t caller_stack_size;
+#endif
+} NewStackCall;
+
+/// entry point of a segment; returning switches back to the caller (uc_link). makecontext only passes ints, so the
+/// call arrives as two halves of a pointer.
+void runNewStackCall(unsigned call_hi, unsigned call_lo) {
+    auto *call = reinterpret_cast<NewStackCall*>((static_cast<uintptr_t>(call_hi) << 32) | call_lo);
+#ifdef LIB_ASAN
+    __sanitizer_finish_switch_fiber(nullptr, &call->caller_stack_bottom, &call->caller_stack_size);
+#endif
+    call->fn(call->ctx);
+#ifdef LIB_ASAN
+    __sanitizer_start_switch_fiber(nullptr, call->caller_stack_bottom, call->caller_stack_size);
+#endif
+}
+
+void runOnNewStack(void (*fn)(void *), void *ctx) {
+    StackSegment segment = takeStackSegment();
+    NewStackCall call {};
+    call.fn = fn;
+    call.ctx = ctx;
+    ucontext_t callee;
+    getcontext(&callee);
+    callee.uc_stack.ss_sp = segment.base;
+    callee.uc_stack.ss_size = STACK_SEGMENT_SIZE;
+    callee.uc_link = &call.caller;
+    auto call_bits = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&call));
+    makecontext(&callee, reinterpret_cast<void (*)()>(runNewStackCall), 2, static_cast<unsigned>(call_bits >> 32), static_cast<unsigned>(call_bits));
+
+    // the guard page lies within the red zone
+    uintptr_t caller_stack_limit = stack_limit;
+    stack_limit = reinterpret_cast<uintptr_t>(segment.base) + STACK_RED_ZONE;
+#ifdef LIB_ASAN
+    void *fake_stack = nullptr;
+    __sanitizer_start_switch_fiber(&fake_stack, segment.base, STACK_SEGMENT_SIZE);
+#endif
+    swapcontext(&call.caller, &callee);
+#ifdef LIB_ASAN
+    __sanitizer_finish_switch_fiber(fake_stack, nullptr, nullptr);
+#endif
+    stack_limit = caller_stack_limit;
+    releaseStackSegment(segment);
+}
@@ -2,7 +2,10 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <exception>
+#include <optional>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 template<typename T>
@@ -65,3 +68,60 @@ enum class LTOKind {
     thin,
     full,
 };
+
+/* Recursive descent goes as deep as the input is nested, and machine generated input can nest parentheses or blocks
+ * tens of thousands of levels deep. Every recursive function that is entered once per nesting level (parseExpression,
+ * and the tree walks on the nodes that have children) starts with
+ *
+ *     if (stackIsLow())
+ *         return onNewStack([&] { return <the same call>; });
+ *
+ * so once less than STACK_RED_ZONE bytes of stack are left, the recursion continues on a new STACK_SEGMENT_SIZE stack
+ * mapped from memory, which the current thread switches to and back from (so thread_locals stay the same). The
+ * nesting depth is then only limited by memory, the check costs one comparison, and a segment holds thousands of
+ * nesting levels.
+ */
+#define STACK_RED_ZONE (256 * 1024)
+#define STACK_SEGMENT_SIZE (16 * 1024 * 1024)
+
+/// lowest frame address of the current thread that still leaves STACK_RED_ZONE bytes, 0 until first computed
+inline thread_local uintptr_t stack_limit = 0;
+
+uintptr_t initStackLimit();
+
+inline bool stackIsLow() {
+    uintptr_t limit = stack_limit ? stack_limit : initStackLimit();
+    return reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) < limit;
+}
+
+/// run fn(ctx) on a new stack segment of the current thread and return once it is done. fn must not throw; throws
+/// std::bad_alloc if no segment can be mapped.
+void runOnNewStack(void (*fn)(void *), void *ctx);
+
+/// call f on a new stack segment and return its result; exceptions thrown by f are rethrown on the caller's stack
+template<typename F>
+auto onNewStack(F &&f) -> decltype(f()) {
+    typedef decltype(f()) R;
+    struct Call {
+        F *f;
+        std::optional<std::conditional_t<std::is_void_v<R>, bool, R>> result;
+        std::exception_ptr error;
+    };
+    Call call {};
+    call.f = &f;
+    runOnNewStack([](void *ctx) {
+        auto *pending = static_cast<Call*>(ctx);
+        try {
+            if constexpr (std::is_void_v<R>)
+                (*pending->f)();
+            else
+                pending->result.emplace((*pending->f)());
+        } catch (...) {
+            pending->error = std::current_exception();
+        }
+    }, &call);
+    if (call.error)
+        std::rethrow_exception(call.error);
+    if constexpr (!std::is_void_v<R>)
+        return std::move(call.result.value());
+}
@@ -10,7 +10,13 @@
 #include "lib.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "output_sink.hpp"
+#include "source_manager.hpp"
+#include "flat_ast.hpp"
+#include "flat_ast_file.hpp"
+#include "constant_folding.hpp"
 #include "LLVMCodeGen/codegen.hpp"
+#include "LLVMCodeGen/flat_codegen.hpp"
 #include "LLVMCodeGen/optimization.hpp"
 #include "LLVMCodeGen/lowering.hpp"
 #include "LLVMCodeGen/external_linking.hpp"
@@ -23,6 +29,7 @@
 enum class CompilerOutKind {
     tokens,
     ast,
+    ast_binary,
     llvm_ir,
     optimized_llvm_ir,
     asm_,
@@ -37,7 +44,6 @@ enum class CompilerOutKind {
 // TODO break/continue statements: when adding declaration into declarations block, also optionally add lifetime ends to a `break block` and a `continue block`. these are inserted by loop codegen into state. state contains nullable pointers to these.
 // TODO add comparison operators
 // todo write preprocessor
-// todo write an always-returns analysis pass that determines if a void block return type is fine because there is a return statement that is guaranteed to be executed (kinda like the ! type in rust)
 // TODO fix extern and externc keywords (generate invalid code for some reason)
 // TODO add extern keyword for global vars
 // TODO allow regular LTO using same function that does ThinLTO atm (FIXME that function doesnt work either)
@@ -78,10 +84,9 @@ void printErrLoc(UniversalError const &err) {
         << ":";
 }
 
-void prettyPrintErr(UniversalError const &err, std::vector<StringRef> lines) {
+void prettyPrintErr(UniversalError const &err, LineIndex *lines) {
     uint32_t line = err.loc.line;
     uint32_t column = err.loc.column;
-    auto line_ = lines.at(line);
     uint32_t line_num_len = std::to_string(line).length();
     column += line_num_len + 2;
     printErrLoc(err);
@@ -89,12 +94,12 @@ void prettyPrintErr(UniversalError const &err, std::vector<StringRef> lines) {
     char const *color_esc_seq = err.kind == ErrorKind::codegen_warning ? "\x1b[33m" : "\x1b[91m";
     std::cout << std::endl;
     for (int32_t li = static_cast<int32_t>(line) - n; li <= static_cast<int32_t>(line) + n; li++) {
-        if (li > 0 && li <= lines.size()) {
+        if (li > 0 && li <= lines->lineCount()) {
             auto li_str = std::to_string(li);
             std::cout << li_str;
             for (uint32_t j = li_str.length(); j < line_num_len; j++)
                 std::cout << ' ';
-            auto curline = lines.at(li - 1);
+            auto curline = lines->line(li);
             std::cout  << "| " << std::string(curline.start, curline.length) << std::endl;
         }
         if (li == line) {
@@ -127,11 +132,11 @@ void prettyPrintErr(UniversalError const &err, std::vector<StringRef> lines) {
 
 #define PRINT_ERROR(err_expr) { \
     UniversalError const err(err_expr); \
-    prettyPrintErr(err, code_lines); \
+    prettyPrintErr(err, lines); \
 }
 
 void printErrorsAndWarnings(
-    std::vector<StringRef> const &code_lines,
+    LineIndex *lines,
     SizedArray<parser::Error> pr_errors,
     SizedArray<codegen::Error> cg_errors,
     SizedArray<codegen::Warning> cg_warnings
@@ -151,13 +156,14 @@ void printErrorsAndWarnings(
     }
 }
 
-void printTokens(std::stringstream &out, std::vector<token::Token> const &tokens) {
-    for (auto const &token : tokens) {
-        out << "Token: " << (uint64_t) token.value.start << " " << token.value.length << " " << static_cast<uint32_t>(token.type) << std::endl;
+void printTokens(std::stringstream &out, token::TokenBuffer const &tokens) {
+    for (uint32_t t = 0; t < tokens.size(); t++) {
+        auto value = tokens.value(t);
+        out << "Token: " << (uint64_t) value.start << " " << value.length << " " << static_cast<uint32_t>(tokens.types[t]) << std::endl;
         out << "Token value: ";
-        if (token.value.length == 0) out << "<eof>";
-        for (int i = 0; i < token.value.length; i++) {
-            out << token.value.start[i];
+        if (value.length == 0) out << "<eof>";
+        for (int i = 0; i < value.length; i++) {
+            out << value.start[i];
         }
         out << std::endl;
     }
@@ -167,15 +173,14 @@ void printIR(std::stringstream &out, std::string const &ir) {
     out << ir << std::endl << std::endl;
 }
 
-void printAST(std::stringstream &out, ast::Block *block) {
-    out << block->toJsonString() << std::endl;
+/// the json is streamed into out, without going through an intermediate string
+void printAST(std::string *out, ast::Block *block) {
+    OutputSink sink(out);
+    block->writeJson(&sink);
+    sink.writeChar('\n');
+    sink.flush();
 }
 
-typedef struct SourceFileInfo {
-    StringRef file;
-    StringRef code;
-} SourceFileInfo;
-
 typedef struct OutFileInfo {
     std::string file;
     std::string content;
@@ -192,7 +197,11 @@ std::vector<OutFileInfo> compileAll(
     LTOKind lto_kind,
     std::string out_filename,
     std::vector<std::string> const &link_static_libs,
-    std::vector<std::string> const &link_dynamic_libs
+    std::vector<std::string> const &link_dynamic_libs,
+    uint32_t lex_threads = 1,
+    bool flat_ast = false,
+    uint32_t parse_threads = 1,
+    bool fold_stats = false
 ) {
     uint32_t opt_max_pipeline_runs = 1;
     std::vector<OutFileInfo> outs;
@@ -205,37 +214,84 @@ std::vector<OutFileInfo> compileAll(
         std::stringstream out;
         auto file = file_info.file;
         auto code = file_info.code;
-        auto const tokens = token::tokenize(file, code);
+        // a binary AST file written by -emit-ast: lexing and parsing are skipped, codegen walks the mapped file
+        std::optional<flat::MappedFile> pre_parsed;
+        if (flat::isFile(code)) {
+            if (out_kind == CompilerOutKind::tokens || out_kind == CompilerOutKind::ast || out_kind == CompilerOutKind::ast_binary)
+                throw std::runtime_error(std::string("'") + file.start + "' is a binary AST file, it has no tokens or source AST to output");
+            try {
+                pre_parsed.emplace(code);
+            } catch (std::runtime_error const &e) {
+                // eg a file written by another version of the compiler, it has to be emitted again from its source
+                throw std::runtime_error(std::string("'") + file.start + "': " + e.what());
+            }
+        }
         if (out_kind == CompilerOutKind::tokens) {
-            printTokens(out, tokens);
+            printTokens(out, lex_threads > 1 ? token::lexParallel(file, code, lex_threads) : token::lex(file, code));
             COMPILE_ALL_FILE_DONE();
         }
 
-        std::vector<StringRef> code_lines;
-        uint32_t start_offset = 0;
-        for (uint32_t i = 0; i < code.length; i++) {
-            if (code.start[i] == '\n') {
-                code_lines.push_back(StringRef {.start = code.start + start_offset, .length = i - start_offset});
-                start_offset = i + 1;
-            }
-        }
-        if (start_offset < code.length - 1)
-            code_lines.push_back(StringRef {.start = code.start + start_offset, .length = code.length - 1 - start_offset});
-
+        // filled from the line starts the lexer collects anyway, only ever looked at if there is something to report
+        LineIndex lines(code);
+        std::vector<uint32_t> line_starts;
         std::vector<parser::Error> pr_errors;
         std::vector<codegen::Error> cg_errs;
         std::vector<codegen::Warning> cg_warns;
 
-        std::unique_ptr<ast::Block> block = parser::parse(file, tokens, &pr_errors);
+        // owns the whole tree of this file, freed in one go at the end of the iteration
+        ast::Arena arena;
+        ast::Ptr<ast::Block> block;
+        if (pre_parsed) {
+            // the tree is already in the file, and there are no source lines to show in diagnostics
+        } else if (lex_threads > 1 || parse_threads > 1) {
+            auto tokens = lex_threads > 1 ? token::lexParallel(file, code, lex_threads) : token::lex(file, code);
+            if (parse_threads > 1)
+                block = parser::parseParallel(file, tokens, &pr_errors, &arena, parse_threads);
+            else
+                block = parser::parse(file, tokens, &pr_errors, &arena);
+            line_starts = std::move(tokens.line_starts);
+        } else {
+            // lexing is interleaved with parsing, the full token stream is never materialized
+            token::LexCursor cursor = token::newLexCursor(code);
+            block = parser::parse(file, &cursor, &pr_errors, &arena, &line_starts);
+        }
+        lines.adopt(std::move(line_starts));
         if (out_kind == CompilerOutKind::ast) {
-            printAST(out, block.get());
-            printErrorsAndWarnings(code_lines, pr_errors, cg_errs, cg_warns);
-            COMPILE_ALL_FILE_DONE();
+            std::string json;
+            printAST(&json, block.get());
+            printErrorsAndWarnings(&lines, pr_errors, cg_errs, cg_warns);
+            outs.push_back(OutFileInfo {.file = std::string(file.start, file.length), .content = std::move(json)});
+            continue;
+        }
+        if (!pre_parsed) {
+            uint32_t n_folded = ast::foldConstants(block.get(), &arena);
+            if (fold_stats)
+                llvm::errs() << file.start << ": constant folding eliminated " << n_folded << " ast nodes\n";
+        }
+        if (out_kind == CompilerOutKind::ast_binary) {
+            printErrorsAndWarnings(&lines, pr_errors, cg_errs, cg_warns);
+            // a file with syntax errors is not worth caching, it has to be parsed again anyway
+            if (pr_errors.empty())
+                outs.push_back(OutFileInfo {
+                    .file = std::string(file.start, file.length) + ".ast",
+                    .content = flat::writeFile(flat::flatten(block.get())),
+                });
+            continue;
         }
 
         codegen::State state;
         codegen::Context ctx = codegen::newContext(file, &cg_errs, &cg_warns, &state);
-        block->codegen(&ctx);
+        if (pre_parsed) {
+            codegen::codegenFlat(&ctx, &pre_parsed->view());
+        } else if (flat_ast) {
+            flat::Tree tree = flat::flatten(block.get());
+            // the flat tree is self-contained, the pointer-linked one is not needed anymore
+            block.release();
+            arena.reset();
+            codegen::codegenFlat(&ctx, &tree);
+        } else {
+            codegen::codegenAst(&ctx, block.get());
+        }
 
         codegen::moduleSetTargetMachine(ctx.module.get(), target_machine);
 
@@ -245,7 +301,7 @@ std::vector<OutFileInfo> compileAll(
         if (out_kind == CompilerOutKind::llvm_ir || out_kind == CompilerOutKind::optimized_llvm_ir
             || pr_errors.size() || cg_errs.size() || cg_warns.size()) {
             out << codegen::dumpIR(&ctx);
-            printErrorsAndWarnings(code_lines, pr_errors, cg_errs, cg_warns);
+            printErrorsAndWarnings(&lines, pr_errors, cg_errs, cg_warns);
             COMPILE_ALL_FILE_DONE();
         }
 
@@ -300,25 +356,13 @@ void runTests() {
     OptLevel opt_level = OptLevel::O3;
     LTOKind lto_kind = LTOKind::none;
 
+    SourceManager sources;
     for (auto const &e : std::filesystem::directory_iterator("test/code_samples")) {
         std::string path = e.path();
         std::cout << "RUNNNIG TEST " << path << std::endl << std::endl;
-        std::ifstream in_file(path);
-        std::stringstream content_strm;
-        content_strm << in_file.rdbuf();
-        std::string content(content_strm.str());
-        auto file_sr = StringRef {
-            .start = path.c_str(),
-            .length = static_cast<uint32_t>(path.length()),
-        };
         std::string out_path = std::string("test/llvmir_out") + &path.c_str()[path.find_last_of('/')] + ".out";
         std::string ir = compileAll(
-            {
-                SourceFileInfo {
-                    .file = file_sr,
-                    .code = StringRef {.start = content.c_str(), .length = static_cast<uint32_t>(content.length())}
-                }
-            },
+            {sources.load(path)},
             out_kind,
             opt_level,
             lto_kind,
@@ -367,6 +411,10 @@ int main(int argc, char **argv) {
     bool prev_was_dash_I = false;
     bool prev_was_dash_J = false;
     bool emit_llvm = false;
+    uint32_t lex_threads = 1;
+    uint32_t parse_threads = 1;
+    bool flat_ast = false;
+    bool fold_stats = false;
     std::vector<char const*> user_include_paths;
     std::vector<char const*> sys_include_paths;
 
@@ -377,6 +425,18 @@ int main(int argc, char **argv) {
             SUCCESS();
         } else if (arg == "-emit-llvm") {
             emit_llvm = true;
+        } else if (arg.starts_with("-lex-threads=")) {
+            if (arg.substr(13).getAsInteger(10, lex_threads) || !lex_threads)
+                INVALID_USAGE();
+        } else if (arg.starts_with("-parse-threads=")) {
+            if (arg.substr(15).getAsInteger(10, parse_threads) || !parse_threads)
+                INVALID_USAGE();
+        } else if (arg == "-flat-ast") {
+            flat_ast = true;
+        } else if (arg == "-fold-stats") {
+            fold_stats = true;
+        } else if (arg == "-emit-ast") {
+            out_kind = CompilerOutKind::ast_binary;
         } else if (arg.size() >= 2 && arg[0] == '-' && arg[1] == 'o') {
             if (prev_was_dash_o) {
                 INVALID_USAGE();
@@ -440,7 +500,7 @@ int main(int argc, char **argv) {
             prev_was_dash_J = false;
             sys_include_paths.emplace_back(arg.data());
         } else {
-            if (arg[0] == '-')
+            if (arg[0] == '-' && arg != "-")  // a lone dash reads the source from stdin
                 INVALID_USAGE();
             source_files.emplace_back(arg.data());
         }
@@ -453,34 +513,38 @@ int main(int argc, char **argv) {
         FAILURE();
     }
 
+    // owns the source memory that all tokens and AST locations point into, must outlive compileAll
+    SourceManager sources;
     std::vector<SourceFileInfo> files;
     for (char const *path : source_files) {
-        std::string path_string(path);
-        std::ifstream in_file(path_string);
-        std::stringstream content_strm;
-        content_strm << in_file.rdbuf();
-        std::string content(content_strm.str());
-
-        auto file_sr = StringRef {
-            .start = path,
-            .length = static_cast<uint32_t>(path_string.length()),
-        };
-        auto content_sr = StringRef {.start = content.c_str(), .length = static_cast<uint32_t>(content.length())};
-        files.push_back(SourceFileInfo {
-            .file = file_sr,
-            .code = content_sr,
-        });
+        try {
+            files.push_back(sources.load(path));
+        } catch (std::runtime_error const &e) {
+            llvm::outs() << e.what() << "\n";
+            FAILURE();
+        }
     }
 
-    std::vector<OutFileInfo> outs = compileAll(
-        files,
-        out_kind,
-        opt_level,
-        lto_kind,
-        out_path,
-        link_static_libs,
-        link_dynamic_libs
-    );
+    // unusable inputs (eg a stale binary AST file) are reported as runtime errors, diagnostics in the source are not
+    std::vector<OutFileInfo> outs;
+    try {
+        outs = compileAll(
+            files,
+            out_kind,
+            opt_level,
+            lto_kind,
+            out_path,
+            link_static_libs,
+            link_dynamic_libs,
+            lex_threads,
+            flat_ast,
+            parse_threads,
+            fold_stats
+        );
+    } catch (std::runtime_error const &e) {
+        llvm::outs() << e.what() << "\n";
+        FAILURE();
+    }
 
     for (auto const &out : outs) {
         std::ofstream out_file(std::move(out.file));
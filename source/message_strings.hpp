@@ -4,6 +4,7 @@ static char const *help_msg = R"(Usage: coatc [options] <input_files...> [-o <ou
 
 Options:
   <input_files...>         One or more input files to compile. The files must have a `.ct` extension.
+                           A single `-` reads the source from stdin.
   
   -o <output_file>         Specifies the name of the output file. If not provided, the compiler will default 
                            to a name derived from the first input file.
@@ -14,6 +15,18 @@ Options:
                              -O2  Further optimization, including inlining and loop transformations.
                              -O3  Maximum optimization, including aggressive inlining and vectorization.
                              
+  -lex-threads=<n>         Lex large files on up to n threads (chunks of at least 1 MiB each).
+
+  -parse-threads=<n>       Parse the functions and globals of a file on up to n threads.
+
+  -flat-ast                Convert the AST to the compact flat representation before code generation.
+
+  -fold-stats              Print how many AST nodes constant folding eliminated in every input file.
+
+  -emit-ast                Only parse, and write the AST of every input file to `<input_file>.ast` in a binary
+                           format. Such a file can be passed as an input file in place of its source, which skips
+                           lexing and parsing.
+  
   -h, --help               Show this help message and exit.
 
 Description:
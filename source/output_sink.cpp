@@ -0,0 +1,87 @@
+#include "output_sink.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+OutputSink::OutputSink(std::string *target) : m_target(target), m_fd(-1), m_used(0)
+{}
+
+OutputSink::OutputSink(int fd) : m_target(nullptr), m_fd(fd), m_used(0)
+{}
+
+OutputSink::~OutputSink() {
+    try {
+        flush();
+    } catch (...) {
+        // also reached while unwinding from an error during the dump, which is the one that gets reported
+    }
+}
+
+void OutputSink::flush() {
+    if (m_target) {
+        m_target->append(m_buffer, m_used);
+    } else {
+        char const *p = m_buffer;
+        size_t remaining = m_used;
+        while (remaining) {
+            ssize_t n = ::write(m_fd, p, remaining);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw std::runtime_error(std::string("could not write output: ") + std::strerror(errno));
+            p += n;
+            remaining -= n;
+        }
+    }
+    m_used = 0;
+}
+
+void OutputSink::write(char const *data, size_t length) {
+    if (m_used + length > OUTPUT_SINK_BUFFER_SIZE) {
+        flush();
+        // too large to be worth copying into the buffer first
+        if (length > OUTPUT_SINK_BUFFER_SIZE / 2) {
+            if (m_target) {
+                m_target->append(data, length);
+                return;
+            }
+            // make the chunks the buffer size, writes to a descriptor are flushed (and thus written) one by one
+            while (length > OUTPUT_SINK_BUFFER_SIZE) {
+                std::memcpy(m_buffer, data, OUTPUT_SINK_BUFFER_SIZE);
+                m_used = OUTPUT_SINK_BUFFER_SIZE;
+                flush();
+                data += OUTPUT_SINK_BUFFER_SIZE;
+                length -= OUTPUT_SINK_BUFFER_SIZE;
+            }
+        }
+    }
+    std::memcpy(m_buffer + m_used, data, length);
+    m_used += length;
+}
+
+void OutputSink::write(StringRef str) {
+    write(str.start, str.length);
+}
+
+void OutputSink::write(std::string const &str) {
+    write(str.data(), str.size());
+}
+
+void OutputSink::writeCString(char const *str) {
+    write(str, std::strlen(str));
+}
+
+void OutputSink::writeChar(char c) {
+    if (m_used == OUTPUT_SINK_BUFFER_SIZE)
+        flush();
+    m_buffer[m_used++] = c;
+}
+
+void OutputSink::writeUint(uint64_t value) {
+    char digits[20];
+    auto res = std::to_chars(digits, digits + sizeof(digits), value);
+    write(digits, res.ptr - digits);
+}
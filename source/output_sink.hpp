@@ -0,0 +1,41 @@
+#pragma once
+
+#include "lib.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define OUTPUT_SINK_BUFFER_SIZE (64 * 1024)
+
+/* Buffered destination for large text dumps (eg the json of an AST). Writes are collected in a fixed buffer that is
+ * handed on in one piece when it is full: appended to a growable string, or written to a file descriptor. Writing a
+ * dump is then linear in its size, and the only allocations are the growth steps of the target string.
+ */
+class OutputSink {
+    std::string *m_target;
+    int m_fd;
+    size_t m_used;
+    char m_buffer[OUTPUT_SINK_BUFFER_SIZE];
+
+public:
+    /// append everything to *target
+    explicit OutputSink(std::string *target);
+    /// write everything to fd (which stays open); throws std::runtime_error if a write fails
+    explicit OutputSink(int fd);
+    OutputSink(OutputSink const &) = delete;
+    OutputSink &operator=(OutputSink const &) = delete;
+    /// flushes what is left, ignoring errors (a destructor must not throw): call flush() first to know it was written
+    ~OutputSink();
+
+    void write(char const *data, size_t length);
+    void write(StringRef str);
+    void write(std::string const &str);
+    /// a NUL-terminated string
+    void writeCString(char const *str);
+    void writeChar(char c);
+    /// decimal
+    void writeUint(uint64_t value);
+    /// hand the buffered output on to the target; throws std::runtime_error if a write fails
+    void flush();
+};
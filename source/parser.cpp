@@ -1,25 +1,7 @@
 #include "parser.hpp"
 
 namespace parser {
-std::vector<std::vector<std::vector<token::TokenType>>> operators_by_prec = {
-    {
-        {},
-        {token::TokenType::minus},
-        {token::TokenType::minus}
-    },
-    {
-        {token::TokenType::asterisk, token::TokenType::slash, token::TokenType::percent},
-        {},
-        {token::TokenType::asterisk, token::TokenType::slash, token::TokenType::percent}
-    },
-    {
-        {token::TokenType::plus, token::TokenType::minus},
-        {},
-        {token::TokenType::plus, token::TokenType::minus},
-    }
-};
-
-std::vector<token::TokenType> const operators = {
+constexpr token::TokenTypeSet operators = {
     token::TokenType::asterisk,
     token::TokenType::slash,
     token::TokenType::percent,
@@ -27,7 +9,7 @@ std::vector<token::TokenType> const operators = {
     token::TokenType::minus
 };
 
-std::vector<token::TokenType> const puncts = {
+constexpr token::TokenTypeSet puncts = {
     token::TokenType::comma,
     token::TokenType::semicolon,
     token::TokenType::equals,
@@ -35,151 +17,197 @@ std::vector<token::TokenType> const puncts = {
     token::TokenType::right_brace
 };
 
-std::vector<token::TokenType> createEndOfBlockNonExpressionBreakers() {
-    std::vector<token::TokenType> result = {
-        token::TokenType::else_kwd,
+token::TokenRef tokenAt(token::TokenBuffer const *buffer, uint32_t idx) {
+    return token::TokenRef {
+        .buffer = buffer,
+        .idx = idx,
+        .type = buffer->types[idx],
     };
-    result.insert(result.end(), operators.begin(), operators.end());
-    result.insert(result.end(), puncts.begin(), puncts.end());
-    return result;
-}
-
-std::vector<token::TokenType> const end_of_block_non_expression_breakers = createEndOfBlockNonExpressionBreakers();
-
-UnexpectedTokenError::UnexpectedTokenError(std::string const &message, std::optional<token::Token> const &unexpected_token, char const *note) {
-    if (unexpected_token) {
-        m_message = std::string("unexpected token of type \"")
-            + token::displayTokenType(unexpected_token.value().type)
-            + "\" - error: "
-            + message;
-        if (note)
-            m_message = m_message + " - note: " + note;
-    } else {
-        m_message = std::string("ran out of tokens unexpectedly - info: ") + message;
-        if (note)
-            m_message = m_message + " - note: " + note;
-    }
-}
-
-std::string const &UnexpectedTokenError::getMessage() {
-    return m_message;
-}
-
-char const *UnexpectedTokenError::what() {
-    return m_message.c_str();
 }
 
 // consume next token and return
-std::optional<token::Token> TokenIter::next() {
+std::optional<token::TokenRef> TokenIter::next() {
     if (n_remain == 0) return std::nullopt;
     n_remain--;
-    return *(tokens++);
+    return tokenAt(buffer, pos++);
 }
 
 // return next token without consuming
-std::optional<token::Token> TokenIter::peek() const {
+std::optional<token::TokenRef> TokenIter::peek() const {
     if (n_remain == 0) return std::nullopt;
-    return *tokens;
+    return tokenAt(buffer, pos);
 }
 
-std::optional<token::Token> TokenIter::peek(uint32_t n) const {
+std::optional<token::TokenRef> TokenIter::peek(uint32_t n) const {
     if (n_remain <= n) return std::nullopt;
-    return tokens[n];
+    return tokenAt(buffer, pos + n);
 }
 
-std::optional<token::Token> TokenIter::peekLast() const {
+std::optional<token::TokenRef> TokenIter::peekLast() const {
     if (n_remain)
-        return tokens[n_remain - 1];
+        return tokenAt(buffer, pos + n_remain - 1);
     return std::nullopt;
 }
 
-std::optional<token::Token> ParseState::next() {
+bool TokenIter::peekIs(token::TokenType ty) const {
+    return n_remain && buffer->types[pos] == ty;
+}
+
+token::TokenType TokenIter::typeAt(uint32_t n) const {
+    return buffer->types[pos + n];
+}
+
+uint32_t TokenIter::matchAt(uint32_t n) const {
+    uint32_t match = buffer->matches[pos + n];
+    if (match == TOKEN_NO_MATCH)
+        return TOKEN_NO_MATCH;
+    // a match before pos wraps around and is rejected by the same comparison
+    uint32_t rel = match - pos;
+    return rel < n_remain ? rel : TOKEN_NO_MATCH;
+}
+
+std::optional<token::TokenRef> ParseState::next() {
     return iter.next();
 }
 
-std::optional<token::Token> ParseState::peek() const {
+std::optional<token::TokenRef> ParseState::peek() const {
     return iter.peek();
 }
 
-std::optional<token::Token> ParseState::peek(uint32_t n) const {
+std::optional<token::TokenRef> ParseState::peek(uint32_t n) const {
     return iter.peek(n);
 }
 
-std::optional<token::Token> ParseState::peekLast() const {
+std::optional<token::TokenRef> ParseState::peekLast() const {
     return iter.peekLast();
 }
 
+bool ParseState::peekIs(token::TokenType ty) const {
+    return iter.peekIs(ty);
+}
+
 struct ParseState ParseState::clone() const {
     return ParseState {
         .info = info,
         .iter = iter,
         .errors = errors,
-        .file = file
+        .file = file,
+        .arena = arena
     };
 }
 
-token::Token expect(token::TokenType expected_type, std::optional<token::Token> tok, char const *note = nullptr) {
-    if (!tok) 
-        throw UnexpectedTokenError(std::string("expected token of type \"") + token::displayTokenType(expected_type) + "\", but got nullopt", tok, note);
+/// record a syntax error at tok, or at the token the iterator of ps stopped on if tok is nullopt (ran out of tokens).
+/// Returns nullptr so parse functions can fail with `return fail(...)`: errors travel up as null results, not as
+/// exceptions, and the block that contains the failed statement resynchronizes (see resynchronize).
+std::nullptr_t fail(ParseState *ps, std::string const &message, std::optional<token::TokenRef> tok, char const *note = nullptr) {
+    std::string msg;
+    LocationInfo loc;
+    if (tok) {
+        msg = std::string("unexpected token of type \"") + token::displayTokenType(tok.value().type) + "\" - error: " + message;
+        loc = tok.value().loc();
+    } else {
+        msg = std::string("ran out of tokens unexpectedly - info: ") + message;
+        auto const *buffer = ps->iter.buffer;
+        loc = buffer->loc(std::min(ps->iter.pos, buffer->size() - 1));
+    }
+    if (note)
+        msg = msg + " - note: " + note;
+    ps->errors->push_back(Error {.loc = loc, .msg = std::move(msg)});
+    return nullptr;
+}
+
+std::optional<token::TokenRef> expect(ParseState *ps, token::TokenType expected_type, std::optional<token::TokenRef> tok, char const *note = nullptr) {
+    if (!tok) {
+        fail(ps, std::string("expected token of type \"") + token::displayTokenType(expected_type) + "\", but got nullopt", tok, note);
+        return std::nullopt;
+    }
     if (tok.value().type == expected_type)
-        return tok.value();
-    throw UnexpectedTokenError(std::string("expected type \"") + token::displayTokenType(expected_type) + "\"", tok.value(), note);
+        return tok;
+    fail(ps, std::string("expected type \"") + token::displayTokenType(expected_type) + "\"", tok, note);
+    return std::nullopt;
 }
 
-token::Token expectOneOf(std::vector<token::TokenType> expected_types, std::optional<token::Token> tok, char const *note = nullptr) {
-    if (!tok) 
-        throw UnexpectedTokenError(std::string("expected token of one of some types, but got nullopt"), tok, note);
-    if (std::count(expected_types.begin(), expected_types.end(), tok.value().type))
-        return tok.value();
-    std::string msg = "expected token of one of types { ";
+/// the types in set, formatted for an error message
+std::string displayTokenTypes(token::TokenTypeSet set) {
+    std::string out;
     std::string prefix = "\"";
-    for (auto const &expected_type : expected_types)
-        msg += prefix + token::displayTokenType(expected_type) + "\",";
-    throw UnexpectedTokenError(msg + " }", tok.value(), note);
+    for (uint32_t t = 0; t <= static_cast<uint32_t>(token::TokenType::invalid); t++)
+        if (set.contains(static_cast<token::TokenType>(t)))
+            out += prefix + token::displayTokenType(static_cast<token::TokenType>(t)) + "\",";
+    return out;
 }
 
-token::Token expectNot(token::TokenType unexpected_type, std::optional<token::Token> tok, char const *note = nullptr) {
-    if (!tok) 
-        throw UnexpectedTokenError(std::string("expected token **not** of type \"") + token::displayTokenType(unexpected_type) + "\", but got nullopt", tok, note);
+std::optional<token::TokenRef> expectOneOf(ParseState *ps, token::TokenTypeSet expected_types, std::optional<token::TokenRef> tok, char const *note = nullptr) {
+    if (!tok) {
+        fail(ps, std::string("expected token of one of some types, but got nullopt"), tok, note);
+        return std::nullopt;
+    }
+    if (expected_types.contains(tok.value().type))
+        return tok;
+    fail(ps, "expected token of one of types { " + displayTokenTypes(expected_types) + " }", tok, note);
+    return std::nullopt;
+}
+
+std::optional<token::TokenRef> expectNot(ParseState *ps, token::TokenType unexpected_type, std::optional<token::TokenRef> tok, char const *note = nullptr) {
+    if (!tok) {
+        fail(ps, std::string("expected token **not** of type \"") + token::displayTokenType(unexpected_type) + "\", but got nullopt", tok, note);
+        return std::nullopt;
+    }
     if (tok.value().type != unexpected_type)
-        return tok.value();
-    throw UnexpectedTokenError(std::string("did not expect token of type \"") + token::displayTokenType(unexpected_type) + "\"", tok.value(), note);
+        return tok;
+    fail(ps, std::string("did not expect token of type \"") + token::displayTokenType(unexpected_type) + "\"", tok, note);
+    return std::nullopt;
 }
 
-token::Token expectNoneOf(std::vector<token::TokenType> unexpected_types, std::optional<token::Token> tok, char const *note = nullptr) {
-    if (!tok) 
-        throw UnexpectedTokenError(std::string("expected token **not** of one of some types, but got nullopt"), tok, note);
-    if (std::count(unexpected_types.begin(), unexpected_types.end(), tok.value().type) == 0)
-        return tok.value();
-    std::string msg = "did not expect token of one of types {";
-    std::string prefix = "\"";
-    for (auto const &unexpected_type : unexpected_types)
-        msg += prefix + token::displayTokenType(unexpected_type) + "\",";
-    throw UnexpectedTokenError(msg + "}", tok.value(), note);
-}
-
-/// basically just a .value that raises my own custom error and is thus caught
-token::Token expectSome(std::optional<token::Token> tok, char const *note = nullptr) {
-    if (!tok)
-        throw UnexpectedTokenError(std::string("expected token, but got nullopt"), tok, note);
-    return tok.value();
-}
-
-void unexpectedEof(StringRef file, char const *note = nullptr) {
-    token::Token eof_tok = {
-        .value = StringRef {
-            .start = 0,
-            .length = 0,
-        },
-        .type = token::TokenType::eof,
-        .meta = std::nullopt,
-        .loc = LocationInfo {
-            .line = 0,
-            .column = 0,
-            .file = file,
-        },
-    };
-    throw UnexpectedTokenError(std::string("unexpected end of file"), eof_tok, note);
+std::optional<token::TokenRef> expectNoneOf(ParseState *ps, token::TokenTypeSet unexpected_types, std::optional<token::TokenRef> tok, char const *note = nullptr) {
+    if (!tok) {
+        fail(ps, std::string("expected token **not** of one of some types, but got nullopt"), tok, note);
+        return std::nullopt;
+    }
+    if (!unexpected_types.contains(tok.value().type))
+        return tok;
+    fail(ps, "did not expect token of one of types {" + displayTokenTypes(unexpected_types) + "}", tok, note);
+    return std::nullopt;
+}
+
+/// like fail, but the offending token is the end of the file
+std::nullptr_t unexpectedEof(ParseState *ps, char const *note = nullptr) {
+    std::string msg = std::string("unexpected token of type \"") + token::displayTokenType(token::TokenType::eof) + "\" - error: unexpected end of file";
+    if (note)
+        msg = msg + " - note: " + note;
+    auto const *buffer = ps->iter.buffer;
+    ps->errors->push_back(Error {.loc = buffer->loc(buffer->size() - 1), .msg = std::move(msg)});
+    return nullptr;
+}
+
+/* Skip the rest of a statement that failed to parse, so parsing can go on with the next one: advances to just behind
+ * the next `;` or `}` that is not nested in brackets opened after the current position (a `}` followed by else does
+ * not count, the else belongs to the same statement). Bracketed ranges are skipped in one step using the bracket side
+ * table. Never moves past the absolute token position limit.
+ */
+void resynchronize(ParseState *ps, uint32_t limit) {
+    auto *iter = &ps->iter;
+    while (iter->n_remain && iter->pos < limit) {
+        token::TokenType ty = iter->typeAt(0);
+        if (ty == token::TokenType::left_paren || ty == token::TokenType::left_brace) {
+            uint32_t match = iter->matchAt(0);
+            if (match == TOKEN_NO_MATCH || iter->pos + match >= limit) {
+                // never closed before the limit, so everything up to it belongs to the broken statement
+                uint32_t skip = std::min(limit - iter->pos, iter->n_remain);
+                iter->pos += skip;
+                iter->n_remain -= skip;
+                return;
+            }
+            iter->pos += match;
+            iter->n_remain -= match;
+        }
+        ty = iter->typeAt(0);
+        iter->next();
+        if (ty == token::TokenType::semicolon)
+            return;
+        if (ty == token::TokenType::right_brace && !(iter->n_remain && iter->typeAt(0) == token::TokenType::else_kwd))
+            return;
+    }
 }
 
 // typedef struct SplitIterAtTTOut {
@@ -226,404 +254,319 @@ void unexpectedEof(StringRef file, char const *note = nullptr) {
 //     return out;
 // }
 
-ParseState splitIterAtTTInplace(token::TokenType delimit_type, ParseState *in_ps) {
-    std::vector<token::Token> paren_stack;
+/// advance in_ps to the first delimit_type token outside of any brackets and return a ParseState limited to the tokens
+/// before it. Bracketed ranges are skipped in one step using the bracket side table of the token buffer. Returns
+/// nullopt (after recording the error) on a closing bracket that was never opened.
+std::optional<ParseState> splitIterAtTTInplace(token::TokenType delimit_type, ParseState *in_ps) {
     auto ps = in_ps->clone();
-    uint32_t i = 0;
-    for (std::optional<token::Token> tok_; (tok_ = in_ps->peek()); in_ps->next()) {
-        auto tok = tok_.value();
-        token::TokenType ty = tok.type;
-
-        if (paren_stack.empty() && ty == delimit_type) {
+    auto *iter = &in_ps->iter;
+    while (iter->n_remain) {
+        token::TokenType ty = iter->typeAt(0);
+        if (ty == delimit_type)
             break;
-        }
 
         if (ty == token::TokenType::left_paren || ty == token::TokenType::left_brace) {
-            paren_stack.push_back(tok);
-        } else if (ty == token::TokenType::right_paren) {
-            std::optional<token::Token> top = std::nullopt;
-            if (!paren_stack.empty()) {
-                top = paren_stack.back();
-                paren_stack.pop_back();
+            uint32_t match = iter->matchAt(0);
+            if (match == TOKEN_NO_MATCH) {
+                // never closed, so everything up to the end is inside the brackets
+                iter->pos += iter->n_remain;
+                iter->n_remain = 0;
+                break;
             }
-            expect(token::TokenType::left_paren, top, "unmatched opening paren (\"(\")");
+            iter->pos += match;
+            iter->n_remain -= match;
+        } else if (ty == token::TokenType::right_paren) {
+            expect(in_ps, token::TokenType::left_paren, std::nullopt, "unmatched opening paren (\"(\")");
+            return std::nullopt;
         } else if (ty == token::TokenType::right_brace) {
-            std::optional<token::Token> top = std::nullopt;
-            if (!paren_stack.empty()) {
-                top = paren_stack.back();
-                paren_stack.pop_back();
-            }
-            expect(token::TokenType::left_brace, top, "unmatched opening brace (\"{\")");
+            expect(in_ps, token::TokenType::left_brace, std::nullopt, "unmatched opening brace (\"{\")");
+            return std::nullopt;
         }
+        iter->next();
     }
-    ps.iter.n_remain -= in_ps->iter.n_remain;
+    ps.iter.n_remain -= iter->n_remain;
     return ps;
 }
 
-typedef struct ExpressionParsingNodeInfo {
-    uint32_t idx;
-    bool is_operator;
-    LocationInfo loc;
-} EPNI;
-
-std::unique_ptr<ast::Expr> parseExpression(ParseState *ps) {
-    std::vector<ParseState> parse_states;
-    std::vector<EPNI> epnis;
-    token::Token const *operand_start = ps->iter.tokens;
-    token::Token const *const first_tok = ps->iter.tokens;
-    std::vector<token::Token> paren_stack;
-    bool last_was_operator = true;
-    auto last_ty = token::TokenType::invalid;
-    bool entirely_wrapped_in_parens = true;
-
-    for (std::optional<token::Token> tok_; (tok_ = ps->peek()); ps->next()) {
-        auto tok = tok_.value();  // this doesn't have to be checked because loop condition
-        token::TokenType ty = tok.type;
-
-        if (paren_stack.empty()
-            && last_ty == token::TokenType::right_brace 
-            && !std::count(
-                end_of_block_non_expression_breakers.begin(),
-                end_of_block_non_expression_breakers.end(),
-                ty
-            )
-        )
-            break;
-        if (ty == token::TokenType::left_paren || ty == token::TokenType::left_brace) {
-            paren_stack.push_back(tok);
-            entirely_wrapped_in_parens = entirely_wrapped_in_parens && paren_stack.front().type == token::TokenType::left_paren;
-            last_was_operator = false;
-            last_ty = ty;
-            continue;
-        } else if (ty == token::TokenType::right_paren) {
-            std::optional<token::Token> top = std::nullopt;
-            if (!paren_stack.empty()) {
-                top = paren_stack.back();
-                paren_stack.pop_back();
-            } else {
-                last_was_operator = false;
-                break;
-            }
-            expect(token::TokenType::left_paren, top, "unmatched opening paren (\"(\")");
-            last_was_operator = false;
-            last_ty = ty;
-            continue;
-        } else if (ty == token::TokenType::right_brace) {
-            std::optional<token::Token> top = std::nullopt;
-            if (!paren_stack.empty()) {
-                top = paren_stack.back();
-                paren_stack.pop_back();
-            } else {
-                last_was_operator = false;
-                break;
-            }
-            expect(token::TokenType::left_brace, top, "unmatched opening brace (\"{\")");
-            last_was_operator = false;
-            last_ty = ty;
-            continue;
-        } else
-            entirely_wrapped_in_parens = entirely_wrapped_in_parens && !paren_stack.empty() && paren_stack.front().type == token::TokenType::left_paren;
-
-        if (paren_stack.empty() && std::count(operators.begin(), operators.end(), ty)) {
-            if (!last_was_operator) {
-                ParseState new_ps = {
-                    .info = ps->info,
-                    .iter = TokenIter {
-                        .tokens = operand_start,
-                        .n_remain = static_cast<uint32_t>(ps->iter.tokens - operand_start),
-                    },
-                    .errors = ps->errors,
-                    .file = ps->file
-                };
-                parse_states.push_back(new_ps);
-                epnis.push_back(EPNI {
-                    .idx = static_cast<uint32_t>(parse_states.size() - 1),
-                    .is_operator = false,
-                    .loc = tok.loc,
-                });
-            }
-            epnis.push_back(EPNI {
-                .idx = static_cast<uint32_t>(ty),
-                .is_operator = true,
-                .loc = tok.loc,
-            });
-            last_was_operator = true;
-            operand_start = ps->iter.tokens + 1;
-        } else if (paren_stack.empty() && std::count(puncts.begin(), puncts.end(), ty)) {
-            // encountered unexpected punctuation like `,` -> end of expression
-            if (last_was_operator)
-                // expect always throws
-                expectNoneOf(
-                    puncts,
-                    tok, 
-                    (ps->iter.tokens - first_tok)
-                        ? "an operator must always be followed by an expression to its right" 
-                        :  "expected an expression, but found none (immediately hit terminator like semicolon or equals)"
-                );
-            last_was_operator = false;
-            break;
-        } else {
-            last_was_operator = false;
-        }
-
-        last_ty = ty;
-    }
-
-    // add the very last operand as well
-    if (operand_start < ps->iter.tokens) {
-        ParseState new_ps = {
-            .info = ps->info,
-            .iter = TokenIter {
-                .tokens = operand_start,
-                .n_remain = static_cast<uint32_t>(ps->iter.tokens - operand_start)
-            },
-            .errors = ps->errors,
-            .file = ps->file
-        };
-        parse_states.push_back(new_ps);
-        epnis.push_back(EPNI {
-            .idx = static_cast<uint32_t>(parse_states.size() - 1),
-            .is_operator = false,
-            .loc = operand_start->loc,
-        });
+/// binding power of a binary operator (higher binds tighter), 0 if ty is not a binary operator
+uint32_t binaryPrecedence(token::TokenType ty) {
+    switch (ty) {
+        case token::TokenType::asterisk:
+        case token::TokenType::slash:
+        case token::TokenType::percent:
+            return 2;
+        case token::TokenType::plus:
+        case token::TokenType::minus:
+            return 1;
+        default:
+            return 0;
     }
-    if (!paren_stack.empty())
-        unexpectedEof(ps->file, "unclosed parentheses");
+}
 
-    if (parse_states.empty()) {
-        throw UnexpectedTokenError("found empty expression (immediately hit an expression terminator)", ps->peek(), "expected an expression, but found none");
+/// a single operand: block, constant, identifier, function call, if condition, loop or parenthesized expression
+ast::Ptr<ast::Expr> parseOperand(ParseState *ps, bool after_operator) {
+    auto tok_ = ps->peek();
+    if (!tok_ || puncts.contains(tok_.value().type)) {
+        if (!after_operator && (!tok_ || tok_.value().type == token::TokenType::right_paren || tok_.value().type == token::TokenType::right_brace))
+            return fail(ps, "found empty expression (immediately hit an expression terminator)", tok_, "expected an expression, but found none");
+        // always fails
+        expectNoneOf(
+            ps,
+            puncts,
+            tok_,
+            after_operator
+                ? "an operator must always be followed by an expression to its right"
+                : "expected an expression, but found none (immediately hit terminator like semicolon or equals)"
+        );
+        return nullptr;
     }
-
-    if (entirely_wrapped_in_parens) {
-        // TODO handle tuples if I add them
-        if (parse_states.size() != 1)
-            throw std::runtime_error("unreachable: if expression is entirely wrapped in parens, it should be parsed as one thing and recursed into");
-        auto &trunc_ps = parse_states.front();
-        trunc_ps.iter.tokens++;
-        trunc_ps.iter.n_remain -= 2;
-        return parseExpression(&trunc_ps);
-    } else if (epnis.size() == 1) {
-        // no operators, determine what parsing function to call (eg parseIfCond)
-        ps = &parse_states.front();
-        // first one must not be paren
-        // TODO the problem is that, if multiple expressions are written after one another like f(x) {1} then the parser doesn't stop after the first one but tries to parse them all
-        // -> find cases when it has to stop
-        if (expectSome(ps->peek(), "unexpected end of file").type == token::TokenType::left_paren)
-            throw std::runtime_error("unreachable: it is not syntactically possible that a single-operand expression starts with a paren and is not fully wrapped in them; probably a bug with full wrap checking");
-
-        auto tok = expectOneOf({
-            token::TokenType::left_brace,
-            token::TokenType::number,
-            token::TokenType::ident,
-            token::TokenType::if_kwd,
-            token::TokenType::while_kwd,  // TODO support loop results on break statements
-            token::TokenType::for_kwd
-        }, ps->peek(), "an operand must be one of these expressions: block, constant, identifier, if condition, while loop");
-        auto loc = tok.loc;
-        auto ty = tok.type;
-        if (ty == token::TokenType::left_brace)
+    auto tok = tok_.value();
+    if (after_operator && operators.contains(tok.type))
+        return fail(ps, "expected an operand to the right of an operator, but got another operator.", tok);
+
+    if (!expectOneOf(ps, {
+        token::TokenType::left_paren,
+        token::TokenType::left_brace,
+        token::TokenType::number,
+        token::TokenType::ident,
+        token::TokenType::if_kwd,
+        token::TokenType::while_kwd,  // TODO support loop results on break statements
+        token::TokenType::for_kwd
+    }, tok, "an operand must be one of these expressions: parenthesized expression, block, constant, identifier, if condition, while loop"))
+        return nullptr;
+    auto loc = tok.loc();
+    switch (tok.type) {
+        case token::TokenType::left_paren: {
+            // TODO handle tuples if I add them
+            ps->next();
+            auto expr = parseExpression(ps);
+            if (!expr)
+                return nullptr;
+            if (!ps->peek())
+                return unexpectedEof(ps, "unclosed parentheses");
+            if (!expect(ps, token::TokenType::right_paren, ps->next(), "unclosed parentheses"))
+                return nullptr;
+            return expr;
+        }
+        case token::TokenType::left_brace:
             return parseBlock(ps);
-        else if (ty == token::TokenType::number) {
-            if (!tok.meta)
-                throw std::runtime_error("unreachable: number token was not assigned a meta");
-            auto meta = tok.meta.value();
-            std::unique_ptr<ast::Expr> expr = std::make_unique<ast::Constant>(loc, meta.number);
+        case token::TokenType::number: {
+            ps->next();
+            ast::Ptr<ast::Expr> expr = ps->arena->make<ast::Constant>(loc, tok.number());
             return expr;
-        } else if (ty == token::TokenType::ident) {
+        }
+        case token::TokenType::ident: {
             auto tok2 = ps->peek(1);
-            std::unique_ptr<ast::Expr> expr;
-            if (!tok2 || tok2.value().type != token::TokenType::left_paren)
-                expr = std::make_unique<ast::VarRef>(loc, std::move(std::string(tok.value.start, tok.value.length)));
-            else
-                expr = parseFunctionCall(ps);
+            if (tok2 && tok2.value().type == token::TokenType::left_paren)
+                return parseFunctionCall(ps);
+            ps->next();
+            ast::Ptr<ast::Expr> expr = ps->arena->make<ast::VarRef>(loc, tok.sym());
             return expr;
-        } else if (ty == token::TokenType::if_kwd) {
+        }
+        case token::TokenType::if_kwd:
             return parseIfCond(ps);
-        } else if (ty == token::TokenType::while_kwd) {
+        case token::TokenType::while_kwd:
             return parseWhileLoop(ps);
-        } else if (ty == token::TokenType::for_kwd) {
+        case token::TokenType::for_kwd:
             return parseForLoop(ps);
-        } else {
-            throw std::runtime_error("unreachable: should have been checked for and should have thrown");
-        }
-    } else {
-        // resolve all operands
-        std::vector<std::unique_ptr<ast::Expr>> operands;
-        for (auto &operand_ps : parse_states) {
-            operands.push_back(parseExpression(&operand_ps));
-        }
-        std::vector<EPNI> new_epnis;
-        for (auto const &bin_un_all_ops : operators_by_prec) {
-            bool prev_was_operator = true;
-            auto const &binops = bin_un_all_ops.at(0);
-            auto const &unops = bin_un_all_ops.at(1);
-            auto const &ops = bin_un_all_ops.at(2);
-            for (uint32_t i = 0; i < epnis.size(); i++) {
-                auto epni = epnis[i];
-                if (epni.is_operator && std::count(ops.begin(), ops.end(), static_cast<token::TokenType>(epni.idx))) {
-                    // fuse left and right operators (or just right if left is itself operator -> unary op)
-                    if (prev_was_operator && std::count(unops.begin(), unops.end(), static_cast<token::TokenType>(epni.idx))) {
-                        if (i + 1 >= epnis.size())
-                            throw std::runtime_error("unreachable: syntax error should have already been caught somewhere else");
-                        auto next_epni = epnis[i + 1];
-                        if (next_epni.is_operator) {
-                            auto fake_token = token::Token {
-                                .value = StringRef {
-                                    .start = 0,
-                                    .length = 0
-                                },
-                                .type = token::TokenType::invalid,
-                                .meta = std::nullopt,
-                                .loc = epni.loc,
-                            };
-                            throw UnexpectedTokenError("expected an operand to the right of an operator, but got another operator.", fake_token);
-                        }
-                        auto rhs = std::move(operands[next_epni.idx]);
-                        std::unique_ptr<ast::Expr> unary_op = std::make_unique<ast::UnaryOp>(
-                            epni.loc,
-                            std::move(rhs),
-                            ast::unaryOpTypeFromTokenType(static_cast<token::TokenType>(epni.idx))
-                        );
-                        operands.push_back(std::move(unary_op));
-                        new_epnis.push_back(EPNI {.idx = static_cast<uint32_t>(operands.size() - 1), .is_operator = false});
-                    } else if (!prev_was_operator && std::count(binops.begin(), binops.end(), static_cast<token::TokenType>(epni.idx))) {
-                        if (i + 1 >= epnis.size() || i == 0)
-                            throw std::runtime_error("unreachable: syntax error should have already been caught somewhere else");
-                        auto prev_epni = new_epnis.back();
-                        auto next_epni = epnis[i + 1];
-                        if (next_epni.is_operator) {
-                            auto fake_token = token::Token {
-                                .value = StringRef {
-                                    .start = 0,
-                                    .length = 0
-                                },
-                                .type = token::TokenType::invalid,
-                                .meta = std::nullopt,
-                                .loc = epni.loc,
-                            };
-                            throw UnexpectedTokenError("expected an operand to the right of an operator, but got another operator.", fake_token);
-                        }
-                        if (prev_epni.is_operator)
-                            throw std::runtime_error("unreachable: should be interpreted as unary not binary op");
-
-                        auto lhs = std::move(operands[prev_epni.idx]);
-                        auto rhs = std::move(operands[next_epni.idx]);
-                        std::unique_ptr<ast::Expr> binary_op = std::make_unique<ast::BinaryOp>(
-                            epni.loc,
-                            std::move(lhs),
-                            std::move(rhs),
-                            ast::binaryOpTypeFromTokenType(static_cast<token::TokenType>(epni.idx))
-                        );
-                        operands.push_back(std::move(binary_op));
-                        new_epnis[new_epnis.size() - 1] = EPNI {.idx = static_cast<uint32_t>(operands.size() - 1), .is_operator = false};
-                    }
-                    i++;
-                } else {
-                    new_epnis.push_back(epni);
-                }
-                prev_was_operator = epni.is_operator && !std::count(ops.begin(), ops.end(), static_cast<token::TokenType>(epni.idx));
-            }
-            epnis = std::move(new_epnis);
-            new_epnis = std::vector<EPNI>();
-        }
+        default:
+            throw std::runtime_error("unreachable: should have been checked for and should have failed");
+    }
+}
 
-        if (epnis.size() != 1)
-            throw std::runtime_error("unreachable: operation fusion bug, fused into " + std::to_string(epnis.size()) + " operations instead of 1");
-        auto epni = epnis[0];
-        if (epni.is_operator)
-            throw std::runtime_error("unreachable: operation fusion bug, result EPNI is marked as operator");
-        auto result = std::move(operands[epni.idx]);
-        return result;
+/// an operand with an optional prefix operator (unary minus binds tighter than any binary operator)
+ast::Ptr<ast::Expr> parseUnary(ParseState *ps, bool after_operator) {
+    auto tok = ps->peek();
+    if (!tok || tok.value().type != token::TokenType::minus)
+        return parseOperand(ps, after_operator);
+    ps->next();
+    auto rhs = parseOperand(ps, true);
+    if (!rhs)
+        return nullptr;
+    ast::Ptr<ast::Expr> unary_op = ps->arena->make<ast::UnaryOp>(
+        tok.value().loc(),
+        std::move(rhs),
+        ast::unaryOpTypeFromTokenType(token::TokenType::minus)
+    );
+    return unary_op;
+}
+
+/* Precedence climbing: parses an operand and then folds in binary operators of at least min_precedence, left to
+ * right. Operators binding tighter than the current one are handled by the recursive call for the right-hand side,
+ * so every token is looked at exactly once and the recursion depth is bounded by the number of precedence levels
+ * (plus the nesting of parentheses and blocks). The expression ends at the first token that is not a binary operator.
+ */
+ast::Ptr<ast::Expr> parseBinary(ParseState *ps, uint32_t min_precedence, bool after_operator) {
+    auto lhs = parseUnary(ps, after_operator);
+    if (!lhs)
+        return nullptr;
+    while (true) {
+        auto tok = ps->peek();
+        uint32_t precedence = tok ? binaryPrecedence(tok.value().type) : 0;
+        if (!precedence || precedence < min_precedence)
+            break;
+        ps->next();
+        auto rhs = parseBinary(ps, precedence + 1, true);
+        if (!rhs)
+            return nullptr;
+        lhs = ps->arena->make<ast::BinaryOp>(
+            tok.value().loc(),
+            std::move(lhs),
+            std::move(rhs),
+            ast::binaryOpTypeFromTokenType(tok.value().type)
+        );
     }
+    return lhs;
+}
+
+ast::Ptr<ast::Expr> parseExpression(ParseState *ps) {
+    // every level of nesting (parentheses, blocks, conditions, loop headers) passes through here
+    if (stackIsLow())
+        return onNewStack([&] { return parseExpression(ps); });
+    return parseBinary(ps, 1, false);
 }
 
-std::unique_ptr<ast::If> parseIfCond(ParseState *ps) {
-    auto loc = expect(token::TokenType::if_kwd, ps->next(), "if condition must start with an if keyword").loc;
-    expectNot(token::TokenType::left_brace, ps->peek(), "an if keyword must not be followed by a left brace immediately but by a condition");
+/// the condition of an if or while: a single expression followed by the opening brace of the body
+ast::Ptr<ast::Expr> parseCondition(ParseState *ps) {
     auto limited_ps = splitIterAtTTInplace(token::TokenType::left_brace, ps);
-    auto cond = parseExpression(&limited_ps);
+    if (!limited_ps)
+        return nullptr;
+    auto cond = parseExpression(&limited_ps.value());
+    if (!cond)
+        return nullptr;
+    if (limited_ps->peek())
+        return fail(ps, "expected the condition to end here", limited_ps->peek(), "a condition must be a single expression followed by the opening brace of the body");
+    return cond;
+}
+
+ast::Ptr<ast::If> parseIfCond(ParseState *ps) {
+    auto if_tok = expect(ps, token::TokenType::if_kwd, ps->next(), "if condition must start with an if keyword");
+    if (!if_tok || !expectNot(ps, token::TokenType::left_brace, ps->peek(), "an if keyword must not be followed by a left brace immediately but by a condition"))
+        return nullptr;
+    auto cond = parseCondition(ps);
+    if (!cond)
+        return nullptr;
     auto branch = parseBlock(ps);
-    std::optional<std::unique_ptr<ast::Expr>> else_branch = std::nullopt;
-    if (ps->peek() && ps->peek().value().type == token::TokenType::else_kwd) {
+    if (!branch)
+        return nullptr;
+    std::optional<ast::Ptr<ast::Expr>> else_branch = std::nullopt;
+    if (ps->peekIs(token::TokenType::else_kwd)) {
         ps->next();
-        expectOneOf({token::TokenType::left_brace, token::TokenType::if_kwd}, ps->peek(), "an else keyword must be followed by either a block or another if keyword");
+        if (!expectOneOf(ps, {token::TokenType::left_brace, token::TokenType::if_kwd}, ps->peek(), "an else keyword must be followed by either a block or another if keyword"))
+            return nullptr;
         else_branch = parseExpression(ps);
+        if (!else_branch.value())
+            return nullptr;
     }
-    auto if_cond = std::make_unique<ast::If>(loc, std::move(cond), std::move(branch), std::move(else_branch));
+    auto if_cond = ps->arena->make<ast::If>(if_tok.value().loc(), std::move(cond), std::move(branch), std::move(else_branch));
     return if_cond;
 }
 
-std::unique_ptr<ast::While> parseWhileLoop(ParseState *ps) {
-    auto loc = expect(token::TokenType::while_kwd, ps->next(), "while loop must start with a while keyword").loc;
-    auto limited_ps = splitIterAtTTInplace(token::TokenType::left_brace, ps);
-    auto cond = parseExpression(&limited_ps);
+ast::Ptr<ast::While> parseWhileLoop(ParseState *ps) {
+    auto while_tok = expect(ps, token::TokenType::while_kwd, ps->next(), "while loop must start with a while keyword");
+    if (!while_tok)
+        return nullptr;
+    auto cond = parseCondition(ps);
+    if (!cond)
+        return nullptr;
     auto branch = parseBlock(ps, false, false);
-    auto while_loop = std::make_unique<ast::While>(loc, std::move(cond), std::move(branch));
+    if (!branch)
+        return nullptr;
+    auto while_loop = ps->arena->make<ast::While>(while_tok.value().loc(), std::move(cond), std::move(branch));
     return while_loop;
 }
 
-std::unique_ptr<ast::For> parseForLoop(ParseState *ps) {
-    auto loc = expect(token::TokenType::for_kwd, ps->next(), "for loop must start with a for keyword").loc;
-    auto limited_ps = splitIterAtTTInplace(token::TokenType::left_brace, ps);
-    auto init = parseStatement(&limited_ps);
-    auto cond = parseExpression(&limited_ps);
-    expect(token::TokenType::semicolon, limited_ps.next(), "condition must be followed by semicolon");
-    auto update = parseStatement(&limited_ps);
+ast::Ptr<ast::For> parseForLoop(ParseState *ps) {
+    auto for_tok = expect(ps, token::TokenType::for_kwd, ps->next(), "for loop must start with a for keyword");
+    if (!for_tok)
+        return nullptr;
+    auto limited_ps_ = splitIterAtTTInplace(token::TokenType::left_brace, ps);
+    if (!limited_ps_)
+        return nullptr;
+    auto *limited_ps = &limited_ps_.value();
+    auto init = parseStatement(limited_ps);
+    if (!init)
+        return nullptr;
+    auto cond = parseExpression(limited_ps);
+    if (!cond || !expect(limited_ps, token::TokenType::semicolon, limited_ps->next(), "condition must be followed by semicolon"))
+        return nullptr;
+    auto update = parseStatement(limited_ps);
+    if (!update)
+        return nullptr;
     auto branch = parseBlock(ps, false, false);
-    auto for_loop = std::make_unique<ast::For>(loc, std::move(init), std::move(cond), std::move(update), std::move(branch));
+    if (!branch)
+        return nullptr;
+    auto for_loop = ps->arena->make<ast::For>(for_tok.value().loc(), std::move(init), std::move(cond), std::move(update), std::move(branch));
     return for_loop;
 }
 
-std::unique_ptr<ast::FunctionCall> parseFunctionCall(ParseState *ps) {
-    auto ident_tok = expect(token::TokenType::ident, ps->next(), "function call must start with a function name");
-    auto name = std::string(ident_tok.value.start, ident_tok.value.length);
-    expect(token::TokenType::left_paren, ps->next(), "function call must contain opening paren after function name");
-    std::vector<std::unique_ptr<ast::Expr>> args;
+ast::Ptr<ast::FunctionCall> parseFunctionCall(ParseState *ps) {
+    auto ident_tok = expect(ps, token::TokenType::ident, ps->next(), "function call must start with a function name");
+    if (!ident_tok || !expect(ps, token::TokenType::left_paren, ps->next(), "function call must contain opening paren after function name"))
+        return nullptr;
+    symbol::Id name = ident_tok.value().sym();
+    auto args = ps->arena->vec<ast::Ptr<ast::Expr>>();
     bool last_was_comma = true;
     while (true) {
         if (last_was_comma) {
             auto expr = parseExpression(ps);
+            if (!expr)
+                return nullptr;
             args.push_back(std::move(expr));
             last_was_comma = false;
         } else {
-            auto next_tok = expectOneOf({token::TokenType::comma, token::TokenType::right_paren}, ps->next(), "after an argument was declared in a function definition, it must be followed by either a comma (to specify more arguments) or a closing paren");
-            if (next_tok.type == token::TokenType::right_paren) break;
+            auto next_tok = expectOneOf(ps, {token::TokenType::comma, token::TokenType::right_paren}, ps->next(), "after an argument was declared in a function definition, it must be followed by either a comma (to specify more arguments) or a closing paren");
+            if (!next_tok)
+                return nullptr;
+            if (next_tok.value().type == token::TokenType::right_paren) break;
             last_was_comma = true;
         }
     }
-    auto fc = std::make_unique<ast::FunctionCall>(ident_tok.loc, std::move(name), std::move(args));
+    auto fc = ps->arena->make<ast::FunctionCall>(ident_tok.value().loc(), name, std::move(args));
     return fc;
 }
 
-std::unique_ptr<ast::DeclAssignment> parseDeclAssignment(ParseState *ps) {
-    auto loc = expect(token::TokenType::let_kwd, ps->next(), "variable declaration must start with a let keyword").loc;
-    auto ident_tok = expect(token::TokenType::ident, ps->next(), "variable declaration must provide a variable name after let keyword");
-    auto name = std::string(ident_tok.value.start, ident_tok.value.length);
-    auto equals_or_semi = expectOneOf({token::TokenType::equals, token::TokenType::semicolon}, ps->next(), "the name in a variable declaration must be followed by either an equals or a semicolon");
-    std::optional<std::unique_ptr<ast::Expr>> value = std::nullopt;
-    if (equals_or_semi.type == token::TokenType::equals) {
+ast::Ptr<ast::DeclAssignment> parseDeclAssignment(ParseState *ps) {
+    auto let_tok = expect(ps, token::TokenType::let_kwd, ps->next(), "variable declaration must start with a let keyword");
+    if (!let_tok)
+        return nullptr;
+    auto ident_tok = expect(ps, token::TokenType::ident, ps->next(), "variable declaration must provide a variable name after let keyword");
+    if (!ident_tok)
+        return nullptr;
+    auto equals_or_semi = expectOneOf(ps, {token::TokenType::equals, token::TokenType::semicolon}, ps->next(), "the name in a variable declaration must be followed by either an equals or a semicolon");
+    if (!equals_or_semi)
+        return nullptr;
+    std::optional<ast::Ptr<ast::Expr>> value = std::nullopt;
+    if (equals_or_semi.value().type == token::TokenType::equals) {
         value = parseExpression(ps);
-        expect(token::TokenType::semicolon, ps->next(), "variable declaration must end with a semicolon");
+        if (!value.value() || !expect(ps, token::TokenType::semicolon, ps->next(), "variable declaration must end with a semicolon"))
+            return nullptr;
     }
-    auto stmt = std::make_unique<ast::DeclAssignment>(loc, std::move(name), std::move(value));
+    auto stmt = ps->arena->make<ast::DeclAssignment>(let_tok.value().loc(), ident_tok.value().sym(), std::move(value));
     return stmt;
 }
 
-std::unique_ptr<ast::Return> parseReturn(ParseState *ps) {
-    auto loc = expect(token::TokenType::return_kwd, ps->next(), "return statement must start with return keyword").loc;
-    expectNot(token::TokenType::semicolon, ps->peek(), "return statement expects a value to return (void currently not supported)");  // TODO remove once void supported
+ast::Ptr<ast::Return> parseReturn(ParseState *ps) {
+    auto return_tok = expect(ps, token::TokenType::return_kwd, ps->next(), "return statement must start with return keyword");
+    if (!return_tok || !expectNot(ps, token::TokenType::semicolon, ps->peek(), "return statement expects a value to return (void currently not supported)"))  // TODO remove once void supported
+        return nullptr;
     auto expr = parseExpression(ps);
-    expect(token::TokenType::semicolon, ps->next(), "return statement must end with a semicolon");
-    auto stmt = std::make_unique<ast::Return>(loc, std::move(expr));
+    if (!expr || !expect(ps, token::TokenType::semicolon, ps->next(), "return statement must end with a semicolon"))
+        return nullptr;
+    auto stmt = ps->arena->make<ast::Return>(return_tok.value().loc(), std::move(expr));
     return stmt;
 }
 
-std::unique_ptr<ast::FunctionDef> parseFunctionDef(ParseState *ps) {
-    auto first_tok = expectOneOf(
+ast::Ptr<ast::FunctionDef> parseFunctionDef(ParseState *ps) {
+    auto first_tok_ = expectOneOf(
+        ps,
         {token::TokenType::fn_kwd, token::TokenType::extern_kwd, token::TokenType::externc_kwd},
         ps->next(),
         "function definition must start with 'fn', 'extern' or 'externc' keyword"
     );
+    if (!first_tok_)
+        return nullptr;
+    auto first_tok = first_tok_.value();
 
     bool is_extern = true;
     bool is_fastcc = true;
@@ -632,45 +575,60 @@ std::unique_ptr<ast::FunctionDef> parseFunctionDef(ParseState *ps) {
     if (first_tok.type == token::TokenType::externc_kwd)
         is_fastcc = false;
 
-    auto loc = first_tok.loc;
-    if (first_tok.type != token::TokenType::fn_kwd)
-        expect(token::TokenType::fn_kwd, ps->next(), "extern/externc keyword must be followed by 'fn' keyword");
-
-    auto ident_tok = expect(token::TokenType::ident, ps->next(), "function definitions must provide a function name after fn keyword");
-    auto name = std::string(ident_tok.value.start, ident_tok.value.length);
-
-    expect(token::TokenType::left_paren, ps->next(), "function definition must have an opening paren after function name");
-    std::vector<std::string> args;
-    expectOneOf({token::TokenType::ident, token::TokenType::right_paren}, ps->peek(), "the opening paren after the function name must be followed by either a closing paren or one or more argument/s");
-    if (ps->peek().value().type == token::TokenType::ident) {
+    auto loc = first_tok.loc();
+    if (first_tok.type != token::TokenType::fn_kwd && !expect(ps, token::TokenType::fn_kwd, ps->next(), "extern/externc keyword must be followed by 'fn' keyword"))
+        return nullptr;
+
+    auto ident_tok = expect(ps, token::TokenType::ident, ps->next(), "function definitions must provide a function name after fn keyword");
+    if (!ident_tok)
+        return nullptr;
+    symbol::Id name = ident_tok.value().sym();
+
+    if (!expect(ps, token::TokenType::left_paren, ps->next(), "function definition must have an opening paren after function name"))
+        return nullptr;
+    auto args = ps->arena->vec<symbol::Id>();
+    if (!expectOneOf(ps, {token::TokenType::ident, token::TokenType::right_paren}, ps->peek(), "the opening paren after the function name must be followed by either a closing paren or one or more argument/s"))
+        return nullptr;
+    if (ps->peekIs(token::TokenType::ident)) {
         bool last_was_comma = true;
         while (true) {
             if (last_was_comma) {
-                auto arg = expect(token::TokenType::ident, ps->next(), "after a comma in the argument list of a function definition, an argument must be named");
-                args.push_back(std::string(arg.value.start, arg.value.length));
+                auto arg = expect(ps, token::TokenType::ident, ps->next(), "after a comma in the argument list of a function definition, an argument must be named");
+                if (!arg)
+                    return nullptr;
+                args.push_back(arg.value().sym());
                 last_was_comma = false;
             } else {
-                auto next_tok = expectOneOf({token::TokenType::comma, token::TokenType::right_paren}, ps->next(), "an argument declaration must be followed by either a comma (to list more arguments) or a closing paren");
-                if (next_tok.type == token::TokenType::right_paren) break;
+                auto next_tok = expectOneOf(ps, {token::TokenType::comma, token::TokenType::right_paren}, ps->next(), "an argument declaration must be followed by either a comma (to list more arguments) or a closing paren");
+                if (!next_tok)
+                    return nullptr;
+                if (next_tok.value().type == token::TokenType::right_paren) break;
                 last_was_comma = true;
             }
         }
     } else
         ps->next();
     
-    expect(token::TokenType::left_brace, ps->peek(), "function definition must provide a function body after the argument list");
-    std::unique_ptr<ast::Block> block = parseBlock(ps);
-    auto stmt = std::make_unique<ast::FunctionDef>(loc, std::move(name), std::move(args), std::move(block), is_extern, is_fastcc);
+    if (!expect(ps, token::TokenType::left_brace, ps->peek(), "function definition must provide a function body after the argument list"))
+        return nullptr;
+    ast::Ptr<ast::Block> block = parseBlock(ps);
+    if (!block)
+        return nullptr;
+    auto stmt = ps->arena->make<ast::FunctionDef>(loc, name, std::move(args), std::move(block), is_extern, is_fastcc);
     return stmt;
 }
 
-std::unique_ptr<ast::Statement> parseStatement(ParseState *ps, bool is_toplevel) {
-    auto keyword_tok = expectSome(ps->peek(), "unexpected end of file");
+ast::Ptr<ast::Statement> parseStatement(ParseState *ps, bool is_toplevel) {
+    auto keyword_tok_ = ps->peek();
+    if (!keyword_tok_)
+        return fail(ps, "expected token, but got nullopt", keyword_tok_, "unexpected end of file");
+    auto keyword_tok = keyword_tok_.value();
     auto ty = keyword_tok.type;
-    if (is_toplevel)
-        expectOneOf({token::TokenType::let_kwd, token::TokenType::fn_kwd, token::TokenType::extern_kwd, token::TokenType::externc_kwd}, keyword_tok, "in the global (toplevel) scope, only function definitions and global variable declarations (using the let keyword) are allowed");
-    else
-        expectNoneOf({token::TokenType::fn_kwd, token::TokenType::extern_kwd, token::TokenType::externc_kwd}, keyword_tok, "function definitions are only allowed in the global (toplevel) scope");
+    if (is_toplevel) {
+        if (!expectOneOf(ps, {token::TokenType::let_kwd, token::TokenType::fn_kwd, token::TokenType::extern_kwd, token::TokenType::externc_kwd}, keyword_tok, "in the global (toplevel) scope, only function definitions and global variable declarations (using the let keyword) are allowed"))
+            return nullptr;
+    } else if (!expectNoneOf(ps, {token::TokenType::fn_kwd, token::TokenType::extern_kwd, token::TokenType::externc_kwd}, keyword_tok, "function definitions are only allowed in the global (toplevel) scope"))
+        return nullptr;
 
     if (ty == token::TokenType::let_kwd)
         return parseDeclAssignment(ps);  // TODO also accept extern keyword here
@@ -681,110 +639,104 @@ std::unique_ptr<ast::Statement> parseStatement(ParseState *ps, bool is_toplevel)
 
     // expression as a statement (eg `function(xyz);`)
     auto expr = parseExpression(ps);
-    std::unique_ptr<ast::Statement> stmt;
-    if (expectSome(ps->peek(), "unexpected end of file").type == token::TokenType::equals) {
+    if (!expr)
+        return nullptr;
+    if (!ps->peek())
+        return fail(ps, "expected token, but got nullopt", std::nullopt, "unexpected end of file");
+    ast::Ptr<ast::Statement> stmt;
+    if (ps->peekIs(token::TokenType::equals)) {
         // parse an expr assignment: `x = 5; *((char *)y[0]) = 6;` and so on (replaces parseAssignment function for efficiency)
         ps->next();
-        expectNot(token::TokenType::semicolon, ps->peek(), "assignment is missing right-hand-side expression");
+        if (!expectNot(ps, token::TokenType::semicolon, ps->peek(), "assignment is missing right-hand-side expression"))
+            return nullptr;
         auto value = parseExpression(ps);
-        expect(token::TokenType::semicolon, ps->next(), "an assignment must end with a semicolon");
-        stmt = std::make_unique<ast::Assignment>(keyword_tok.loc, std::move(expr), std::move(value));
+        if (!value || !expect(ps, token::TokenType::semicolon, ps->next(), "an assignment must end with a semicolon"))
+            return nullptr;
+        stmt = ps->arena->make<ast::Assignment>(keyword_tok.loc(), std::move(expr), std::move(value));
     } else {
         // those statements with an attached block don't need semicolons
         if (ty != token::TokenType::if_kwd
             && ty != token::TokenType::while_kwd
             && ty != token::TokenType::for_kwd
-            && ty != token::TokenType::left_brace)
-            expect(token::TokenType::semicolon, ps->next(), "statements without a trailing block attached (if conditions, while loops, ...) must end on semicolon");
-        stmt = std::make_unique<ast::ExprStmt>(keyword_tok.loc, std::move(expr));
+            && ty != token::TokenType::left_brace
+            && !expect(ps, token::TokenType::semicolon, ps->next(), "statements without a trailing block attached (if conditions, while loops, ...) must end on semicolon"))
+            return nullptr;
+        stmt = ps->arena->make<ast::ExprStmt>(keyword_tok.loc(), std::move(expr));
     }
     return stmt;
 }
 
-std::unique_ptr<ast::Block> parseBlock(ParseState *ps, bool is_toplevel/* = false*/, bool allow_implicit_return/* = true*/) {
+ast::Ptr<ast::Block> parseBlock(ParseState *ps, bool is_toplevel/* = false*/, bool allow_implicit_return/* = true*/) {
     // this is safe when parsing toplevel because of eof token
-    auto loc = expectSome(ps->peek(), "unexpected end of file").loc;
+    if (!ps->peek())
+        return fail(ps, "expected token, but got nullopt", std::nullopt, "unexpected end of file");
+    auto loc = ps->peek().value().loc();
     uint32_t block_result_start = -1;
     uint32_t init_remain = ps->iter.n_remain;
     bool block_has_result;
+    // absolute position of the closing brace (the eof token at toplevel)
+    uint32_t block_end_pos = ps->iter.pos + ps->iter.n_remain - 1;
 
     if (is_toplevel) {
         block_result_start = ps->iter.n_remain - 1;
         block_has_result = false;
-        if (expectSome(ps->peek(), "unexpected end of file").type == token::TokenType::eof) {
-            std::vector<std::unique_ptr<ast::Statement>> stmts;
-            std::optional<std::unique_ptr<ast::Expr>> result = std::nullopt;
-            return std::make_unique<ast::Block>(loc, std::move(stmts), std::move(result), true);
+        if (ps->peekIs(token::TokenType::eof)) {
+            auto stmts = ps->arena->vec<ast::Ptr<ast::Statement>>();
+            std::optional<ast::Ptr<ast::Expr>> result = std::nullopt;
+            return ps->arena->make<ast::Block>(loc, std::move(stmts), std::move(result), true);
         }
     } else {
-        expect(token::TokenType::left_brace, ps->next(), "a block must start with an opening brace (\"{\")");
-        if (expectSome(ps->peek(), "unexpected end of file").type == token::TokenType::right_brace) {
-            std::vector<std::unique_ptr<ast::Statement>> stmts;
-            std::optional<std::unique_ptr<ast::Expr>> result = std::nullopt;
-            return std::make_unique<ast::Block>(loc, std::move(stmts), std::move(result), false);
+        auto open_tok = expect(ps, token::TokenType::left_brace, ps->next(), "a block must start with an opening brace (\"{\")");
+        if (!open_tok)
+            return nullptr;
+        if (!ps->peek())
+            return fail(ps, "expected token, but got nullopt", std::nullopt, "unexpected end of file");
+        if (ps->peekIs(token::TokenType::right_brace)) {
+            ps->next();
+            auto stmts = ps->arena->vec<ast::Ptr<ast::Statement>>();
+            std::optional<ast::Ptr<ast::Expr>> result = std::nullopt;
+            return ps->arena->make<ast::Block>(loc, std::move(stmts), std::move(result), false);
         }
         init_remain--;
-        uint32_t n_braces = 0;
-        uint32_t block_end = -1;
-        bool broke_out = false;
-        
-        // find block end
-        for (uint32_t i = 0; i < ps->iter.n_remain - 1; i++) {
-            auto ty = ps->iter.tokens[i].type;
-            if (ty == token::TokenType::left_brace)
-                n_braces++;
-            else if (ty == token::TokenType::right_brace) {
-                if (n_braces)
-                    n_braces--;
-                else {
-                    block_end = i;
-                    broke_out = true;
-                    break;
-                }
-            }
-        }
-        if (!n_braces && !broke_out)
-            block_end = ps->iter.n_remain - 1;  // eof token
-
-        if (block_end == -1)
-            throw std::runtime_error("block_end has invalid value, this is probably a parser bug. Please report to developer.");
 
-        // now go backwards from block end to find border between block result and statements
-        bool last_was_else_kwd = false;
-        uint32_t n_parens = 0;
-        n_braces = 0;
+        // the block ends on the brace matching the opening one, or on the last token (eof) if it is never closed
+        uint32_t block_end = ps->iter.n_remain - 1;
+        uint32_t match = ps->info.buffer->matches[open_tok.value().idx];
+        if (match != TOKEN_NO_MATCH && match - ps->iter.pos < block_end)
+            block_end = match - ps->iter.pos;
+        block_end_pos = ps->iter.pos + block_end;
+
+        // now go backwards from block end to find border between block result and statements: the result starts
+        // behind the last `;` or `}` (unless it is followed by else) that is not nested in any brackets. Nested
+        // brackets are skipped in one step, an opening bracket or a closing one that is not matched inside the
+        // block means the brackets are unbalanced and the whole rest of the block is treated as the result.
         for (uint32_t i = block_end - 1; i != -1; i--) {
-            auto ty = ps->iter.tokens[i].type;
-
-            if (ty == token::TokenType::else_kwd)
-                last_was_else_kwd = true;
-            else
-                last_was_else_kwd = false;
-
-            if (!n_braces && !n_parens && (ty == token::TokenType::semicolon || (ty == token::TokenType::right_brace && !last_was_else_kwd))) {
+            auto ty = ps->iter.typeAt(i);
+            if (ty == token::TokenType::semicolon
+                || (ty == token::TokenType::right_brace && ps->iter.typeAt(i + 1) != token::TokenType::else_kwd)) {
                 block_result_start = i + 1;
                 break;
             }
-
-            if (ty == token::TokenType::left_brace)
-                n_braces--;
-            else if (ty == token::TokenType::right_brace)
-                n_braces++;
-            else if (ty == token::TokenType::left_paren)
-                n_parens--;
-            else if (ty == token::TokenType::right_paren)
-                n_parens++;
+            if (ty == token::TokenType::right_paren || ty == token::TokenType::right_brace) {
+                uint32_t opening = ps->iter.matchAt(i);
+                if (opening == TOKEN_NO_MATCH)
+                    break;
+                i = opening;
+            } else if (ty == token::TokenType::left_paren || ty == token::TokenType::left_brace) {
+                break;
+            }
         }
 
         if (block_result_start == -1)
             block_result_start = 0;
         block_has_result = block_result_start != block_end;
     }
+    uint32_t statements_end_pos = ps->iter.pos + block_result_start;
 
-    std::vector<std::unique_ptr<ast::Statement>> statements;
+    auto statements = ps->arena->vec<ast::Ptr<ast::Statement>>();
     while (init_remain - ps->iter.n_remain < block_result_start) {
         // consume redundant semicolons
-        while (ps->peek() && ps->peek().value().type == token::TokenType::semicolon)
+        while (ps->peekIs(token::TokenType::semicolon))
             ps->next();
         auto current_tok_ = ps->peek();
         if (!current_tok_ || current_tok_.value().type == token::TokenType::eof) {
@@ -799,52 +751,293 @@ std::unique_ptr<ast::Block> parseBlock(ParseState *ps, bool is_toplevel/* = fals
             ps->errors->push_back(std::move(err));
             break;
         }
-        auto current_tok = current_tok_.value();
-        try {
-            auto stmt = parseStatement(ps, is_toplevel);
+        auto stmt = parseStatement(ps, is_toplevel);
+        if (stmt) {
             statements.push_back(std::move(stmt));
-        } catch (UnexpectedTokenError e) {
-            auto err = Error {
-                .loc = current_tok.loc,
-                .msg = e.getMessage()
-            };
-            ps->errors->push_back(std::move(err));
+        } else if (ps->iter.pos > statements_end_pos) {
+            // the broken statement ran into the result or the closing brace of the block, give those back
+            ps->iter.n_remain += ps->iter.pos - statements_end_pos;
+            ps->iter.pos = statements_end_pos;
+        } else {
+            resynchronize(ps, statements_end_pos);
         }
     }
-    while (ps->peek() && ps->peek().value().type == token::TokenType::semicolon)
+    while (ps->peekIs(token::TokenType::semicolon))
         ps->next();
 
     auto current_tok_ = ps->peek();
-    std::optional<std::unique_ptr<ast::Expr>> result = std::nullopt;
+    std::optional<ast::Ptr<ast::Expr>> result = std::nullopt;
     if (block_has_result && allow_implicit_return && current_tok_ && current_tok_.value().type != token::TokenType::eof) {
-        auto current_tok = current_tok_.value();
         if (init_remain - ps->iter.n_remain == block_result_start) {
-            try {
-                result = parseExpression(ps);
-            } catch (UnexpectedTokenError e) {
-                auto err = Error {
-                    .loc = current_tok.loc,
-                    .msg = e.getMessage()
-                };
-                ps->errors->push_back(std::move(err));
+            auto expr = parseExpression(ps);
+            if (expr) {
+                result = std::move(expr);
+            } else if (ps->iter.pos < block_end_pos) {
+                // skip the rest of the broken result, the block itself is still closed properly
+                ps->iter.n_remain -= block_end_pos - ps->iter.pos;
+                ps->iter.pos = block_end_pos;
             }
         }
     }
 
-    if (!is_toplevel)
-        expect(token::TokenType::right_brace, ps->next(), "a block must end on a closing brace (\"}\")");
+    if (!is_toplevel && !expect(ps, token::TokenType::right_brace, ps->next(), "a block must end on a closing brace (\"}\")"))
+        return nullptr;
 
-    auto block = std::make_unique<ast::Block>(loc, std::move(statements), std::move(result), is_toplevel);
+    auto block = ps->arena->make<ast::Block>(loc, std::move(statements), std::move(result), is_toplevel);
     return block;
 }
 
-std::unique_ptr<ast::Block> parse(StringRef file, std::vector<token::Token> const &tokens, std::vector<Error> *errors) {
+ast::Ptr<ast::Block> parse(StringRef file, token::TokenBuffer const &tokens, std::vector<Error> *errors, ast::Arena *arena) {
     ParseState ps = {
-        .info = TokenInfo {.start = tokens.data(), .length = static_cast<uint32_t>(tokens.size())},
-        .iter = TokenIter {.tokens = tokens.data(), .n_remain = static_cast<uint32_t>(tokens.size())},
+        .info = TokenInfo {.buffer = &tokens, .length = tokens.size()},
+        .iter = TokenIter {.buffer = &tokens, .pos = 0, .n_remain = tokens.size()},
         .errors = errors,
-        .file = file
+        .file = file,
+        .arena = arena
     };
     return parseBlock(&ps, true);
 }
+
+void ToplevelItemScanner::start(token::TokenType first) {
+    brace_depth = 0;
+    ends_on_brace = first != token::TokenType::let_kwd;
+}
+
+bool ToplevelItemScanner::endsAt(token::TokenType ty) {
+    if (ty == token::TokenType::left_brace) {
+        brace_depth++;
+    } else if (ty == token::TokenType::right_brace) {
+        brace_depth--;
+        if (brace_depth < 0 || (brace_depth == 0 && ends_on_brace))
+            return true;
+    } else if (ty == token::TokenType::semicolon && brace_depth <= 0) {
+        return true;
+    }
+    return false;
+}
+
+/// lex the next toplevel item (a global declaration or a function definition, or whatever is there until the next
+/// toplevel `;` or `}` in case of a syntax error) into window, followed by an eof token. Returns false at end of input.
+bool lexToplevelItem(token::LexCursor *cursor, token::TokenBuffer *window) {
+    window->clearTokens();
+    ToplevelItemScanner scanner = {};
+    while (cursor->next(window)) {
+        auto ty = window->types.back();
+        if (window->size() == 1) {
+            if (ty == token::TokenType::semicolon) {
+                // redundant semicolons between items
+                window->clearTokens();
+                continue;
+            }
+            scanner.start(ty);
+        }
+        if (scanner.endsAt(ty))
+            break;
+    }
+    if (!window->size())
+        return false;
+    token::pushToken(window, token::TokenType::eof, cursor->pos, 0);
+    token::matchBrackets(window);
+    return true;
+}
+
+ast::Ptr<ast::Block> parse(StringRef file, token::LexCursor *cursor, std::vector<Error> *errors, ast::Arena *arena, std::vector<uint32_t> *line_starts) {
+    // reused for every item; the line table is kept across items because locations are computed from it
+    token::TokenBuffer window = {};
+    window.file = file;
+    window.code = cursor->code;
+    window.line_starts.push_back(0);
+    std::optional<LocationInfo> loc = std::nullopt;
+    auto statements = arena->vec<ast::Ptr<ast::Statement>>();
+    while (lexToplevelItem(cursor, &window)) {
+        if (!loc)
+            loc = window.loc(0);
+        ParseState ps = {
+            .info = TokenInfo {.buffer = &window, .length = window.size()},
+            .iter = TokenIter {.buffer = &window, .pos = 0, .n_remain = window.size()},
+            .errors = errors,
+            .file = file,
+            .arena = arena
+        };
+        // a broken item needs no resynchronization, the next one starts in a fresh window anyway
+        auto stmt = parseStatement(&ps, true);
+        if (stmt)
+            statements.push_back(std::move(stmt));
+    }
+    if (!loc)
+        loc = window.locationOf(cursor->pos);
+    if (line_starts)
+        *line_starts = std::move(window.line_starts);
+    return arena->make<ast::Block>(loc.value(), std::move(statements), std::nullopt, true);
+}
+
+typedef struct TokenRange {
+    uint32_t start;
+    uint32_t end;
+} TokenRange;
+
+/// the next toplevel item of tokens from *pos on (which must be the start of an item or lie between two), exactly as
+/// the streaming parse would lex it, except that an item that runs to the end of the file includes the eof token.
+/// Advances *pos past the item, returns false if there is none left.
+bool nextToplevelItem(token::TokenBuffer const &tokens, uint32_t *pos, TokenRange *item) {
+    uint32_t n_tokens = tokens.size() - 1;
+    // redundant semicolons between items
+    while (*pos < n_tokens && tokens.types[*pos] == token::TokenType::semicolon)
+        (*pos)++;
+    if (*pos >= n_tokens)
+        return false;
+    ToplevelItemScanner scanner = {};
+    scanner.start(tokens.types[*pos]);
+    item->start = *pos;
+    item->end = n_tokens + 1;
+    for (uint32_t i = *pos; i < n_tokens; i++) {
+        if (scanner.endsAt(tokens.types[i])) {
+            item->end = i + 1;
+            break;
+        }
+    }
+    *pos = item->end;
+    return true;
+}
+
+std::vector<TokenRange> splitToplevelItems(token::TokenBuffer const &tokens) {
+    std::vector<TokenRange> items;
+    uint32_t pos = 0;
+    TokenRange item;
+    while (nextToplevelItem(tokens, &pos, &item))
+        items.push_back(item);
+    return items;
+}
+
+/// parse one item of splitToplevelItems. Like in the streaming parse, a broken item needs no resynchronization.
+ast::Ptr<ast::Statement> parseToplevelItem(StringRef file, token::TokenBuffer const &tokens, TokenRange item, std::vector<Error> *errors, ast::Arena *arena) {
+    ParseState ps = {
+        .info = TokenInfo {.buffer = &tokens, .length = tokens.size()},
+        .iter = TokenIter {.buffer = &tokens, .pos = item.start, .n_remain = item.end - item.start},
+        .errors = errors,
+        .file = file,
+        .arena = arena
+    };
+    return parseStatement(&ps, true);
+}
+
+ast::Ptr<ast::Block> parseParallel(StringRef file, token::TokenBuffer const &tokens, std::vector<Error> *errors, ast::Arena *arena, uint32_t n_threads) {
+    std::vector<TokenRange> items = splitToplevelItems(tokens);
+    uint32_t n_batches = (items.size() + PARALLEL_PARSE_BATCH_SIZE - 1) / PARALLEL_PARSE_BATCH_SIZE;
+    uint32_t n_workers = std::min(n_threads, n_batches);
+    if (n_workers <= 1)
+        return parse(file, tokens, errors, arena);
+
+    // every item is written by exactly one thread, into its own slot
+    std::vector<ast::Ptr<ast::Statement>> results(items.size());
+    std::vector<std::vector<Error>> worker_errors(n_workers);
+    std::vector<ast::Arena *> worker_arenas;
+    for (uint32_t k = 0; k < n_workers; k++)
+        worker_arenas.push_back(arena->spawn());
+    std::atomic<uint32_t> next_item = 0;
+    std::vector<std::thread> workers;
+    for (uint32_t k = 0; k < n_workers; k++) {
+        workers.emplace_back([&, k]() {
+            while (true) {
+                uint32_t first = next_item.fetch_add(PARALLEL_PARSE_BATCH_SIZE, std::memory_order_relaxed);
+                if (first >= items.size())
+                    break;
+                uint32_t last = std::min<uint32_t>(first + PARALLEL_PARSE_BATCH_SIZE, items.size());
+                for (uint32_t i = first; i < last; i++)
+                    results[i] = parseToplevelItem(file, tokens, items[i], &worker_errors[k], worker_arenas[k]);
+            }
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    auto statements = arena->vec<ast::Ptr<ast::Statement>>();
+    statements.reserve(items.size());
+    for (auto &stmt : results)
+        if (stmt)
+            statements.push_back(std::move(stmt));
+
+    // every worker reports in source order, but the batches of the workers interleave
+    size_t n_old_errors = errors->size();
+    for (auto &errs : worker_errors)
+        errors->insert(errors->end(), std::make_move_iterator(errs.begin()), std::make_move_iterator(errs.end()));
+    std::stable_sort(errors->begin() + n_old_errors, errors->end(), [](Error const &a, Error const &b) {
+        return a.loc.line < b.loc.line || (a.loc.line == b.loc.line && a.loc.column < b.loc.column);
+    });
+    return arena->make<ast::Block>(tokens.loc(0), std::move(statements), std::nullopt, true);
+}
+
+void reparse(IncrementalParse *parsed, StringRef file, token::TokenBuffer const &tokens, token::RelexResult const *change, std::vector<Error> *errors, ast::Arena *arena) {
+    std::vector<ToplevelItem> const &old_items = parsed->items;
+    std::vector<ToplevelItem> items;
+    items.reserve(old_items.size() + 1);
+    auto statements = arena->vec<ast::Ptr<ast::Statement>>();
+    statements.reserve(old_items.size() + 1);
+    parsed->n_reused = 0;
+    parsed->n_parsed = 0;
+    auto parse_item = [&](TokenRange range) {
+        size_t n_old_errors = errors->size();
+        ast::Statement *stmt = parseToplevelItem(file, tokens, range, errors, arena).release();
+        if (stmt)
+            statements.push_back(ast::Ptr<ast::Statement>(stmt));
+        // an item with syntax errors still ends up in the tree (parts of it may have been recovered), but is never
+        // taken over, so its errors are reported again by every reparse
+        items.push_back(ToplevelItem {
+            .start = range.start,
+            .end = range.end,
+            .line = tokens.loc(range.start).line,
+            .stmt = errors->size() == n_old_errors ? stmt : nullptr,
+        });
+        parsed->n_parsed++;
+    };
+    // item is already moved to where it is in tokens now
+    auto take_over = [&](ToplevelItem const &item) {
+        if (!item.stmt)
+            return parse_item(TokenRange {.start = item.start, .end = item.end});
+        statements.push_back(ast::Ptr<ast::Statement>(item.stmt));
+        items.push_back(item);
+        parsed->n_reused++;
+    };
+
+    if (!change || old_items.empty()) {
+        for (auto range : splitToplevelItems(tokens))
+            parse_item(range);
+    } else {
+        // the items that end before the relexed tokens are untouched
+        size_t i = 0;
+        while (i < old_items.size() && old_items[i].end <= change->first_token)
+            take_over(old_items[i++]);
+
+        // split again from there until the new split runs into a start of the old one after the relexed tokens
+        // (the items from there on are the same, their tokens were only shifted)
+        int64_t token_shift = static_cast<int64_t>(change->n_inserted) - change->n_removed;
+        uint32_t changed_end = change->first_token + change->n_inserted;
+        uint32_t pos = i < old_items.size() ? std::min(old_items[i].start, change->first_token) : change->first_token;
+        TokenRange range;
+        bool in_sync = false;
+        while (!in_sync && nextToplevelItem(tokens, &pos, &range)) {
+            if (range.start >= changed_end) {
+                while (i < old_items.size() && old_items[i].start + token_shift < range.start)
+                    i++;
+                in_sync = i < old_items.size() && old_items[i].start + token_shift == range.start;
+            }
+            if (!in_sync)
+                parse_item(range);
+        }
+        if (in_sync) {
+            int32_t line_shift = static_cast<int32_t>(tokens.loc(range.start).line - old_items[i].line);
+            for (; i < old_items.size(); i++) {
+                ToplevelItem item = old_items[i];
+                item.start = static_cast<uint32_t>(item.start + token_shift);
+                item.end = static_cast<uint32_t>(item.end + token_shift);
+                item.line += line_shift;
+                if (item.stmt && line_shift)
+                    item.stmt->shiftLines(line_shift);
+                take_over(item);
+            }
+        }
+    }
+    parsed->items = std::move(items);
+    parsed->block = arena->make<ast::Block>(tokens.loc(0), std::move(statements), std::nullopt, true);
+}
 }  // namespace parser
@@ -11,37 +11,51 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <thread>
+#include <atomic>
 
 namespace parser {
-// TODO add a required LocationInfo field to this
-class UnexpectedTokenError : public std::exception {
-    std::string m_message;
-
-public:
-    UnexpectedTokenError(std::string const &message, std::optional<token::Token> const &unexpected_token, char const *note = nullptr);
-    char const *what();
-    std::string const &getMessage();
-};
-
 typedef struct TokenInfo {
-    token::Token const *start;
+    token::TokenBuffer const *buffer;
     uint32_t length;
 } TokenInfo;
 
 typedef struct TokenIter {
-    token::Token const *tokens;
+    token::TokenBuffer const *buffer;
+    /// index of the next token in buffer
+    uint32_t pos;
     uint32_t n_remain;
 
     /// consume next token and return
-    std::optional<token::Token> next();
+    std::optional<token::TokenRef> next();
     /// return next token without consuming
-    std::optional<token::Token> peek() const;
+    std::optional<token::TokenRef> peek() const;
     /// return nth next token without consuming
-    std::optional<token::Token> peek(uint32_t n) const;
+    std::optional<token::TokenRef> peek(uint32_t n) const;
     /// return last item
-    std::optional<token::Token> peekLast() const;
+    std::optional<token::TokenRef> peekLast() const;
+    /// whether the next token exists and is of type ty (cheaper than checking the result of peek)
+    bool peekIs(token::TokenType ty) const;
+    /// type of the nth next token (n must be < n_remain)
+    token::TokenType typeAt(uint32_t n) const;
+    /// position (relative to pos, like n) of the bracket matching the nth next token, TOKEN_NO_MATCH if it has
+    /// none or the match lies outside of the remaining tokens
+    uint32_t matchAt(uint32_t n) const;
 } TokenIter;
 
+/// tracks the brace depth while the tokens of one toplevel item go by and tells where the item ends: on a `;` that
+/// is not nested in braces, or, for function definitions, on the `}` that closes the body. A closing brace that was
+/// never opened ends an item as well. Parens are not counted, so an unbalanced paren only breaks its own item.
+typedef struct ToplevelItemScanner {
+    int32_t brace_depth;
+    bool ends_on_brace;
+
+    /// begin a new item with its first token (which must then also be passed to endsAt)
+    void start(token::TokenType first);
+    /// whether ty is the last token of the current item
+    bool endsAt(token::TokenType ty);
+} ToplevelItemScanner;
+
 // TODO replace line and file by LocationInfo loc field
 typedef struct Error {
     LocationInfo loc;
@@ -53,29 +67,83 @@ typedef struct ParseState {
     TokenIter iter;
     std::vector<Error> *errors;
     StringRef file;
+    /// all nodes are allocated from here
+    ast::Arena *arena;
 
     /// consume next token and return
-    std::optional<token::Token> next();
+    std::optional<token::TokenRef> next();
     /// return next token without consuming
-    std::optional<token::Token> peek() const;
+    std::optional<token::TokenRef> peek() const;
     /// return nth next token without consuming
-    std::optional<token::Token> peek(uint32_t n) const;
+    std::optional<token::TokenRef> peek(uint32_t n) const;
     /// return last item
-    std::optional<token::Token> peekLast() const;
+    std::optional<token::TokenRef> peekLast() const;
+    /// whether the next token exists and is of type ty
+    bool peekIs(token::TokenType ty) const;
     struct ParseState clone() const;
 } ParseState;
 
+/* Syntax errors do not throw: a parse function that fails records the error (located at the offending token) in
+ * ParseState::errors and returns null, its callers pass the null on up to the enclosing block, which skips to the end
+ * of the broken statement (the next `;` or `}` outside of brackets) and goes on parsing from there. A file with many
+ * errors thus costs about as much to parse as a correct one.
+ */
 // TODO do I actually need to export all of these?
-std::unique_ptr<ast::Expr> parseExpression(ParseState *ps);
-std::unique_ptr<ast::If> parseIfCond(ParseState *ps);
-std::unique_ptr<ast::While> parseWhileLoop(ParseState *ps);
-std::unique_ptr<ast::For> parseForLoop(ParseState *ps);
-std::unique_ptr<ast::FunctionCall> parseFunctionCall(ParseState *ps);
-// std::unique_ptr<ast::Assignment> parseAssignment(ParseState *ps);  // replaced for efficiency reasons by direct parsing in parseStatement
-std::unique_ptr<ast::DeclAssignment> parseDeclAssignment(ParseState *ps);
-std::unique_ptr<ast::Return> parseReturn(ParseState *ps);
-std::unique_ptr<ast::FunctionDef> parseFunctionDef(ParseState *ps);
-std::unique_ptr<ast::Statement> parseStatement(ParseState *ps, bool is_toplevel = false);
-std::unique_ptr<ast::Block> parseBlock(ParseState *ps, bool is_toplevel = false, bool allow_implicit_return = true);
-std::unique_ptr<ast::Block> parse(StringRef file, std::vector<token::Token> const &tokens, std::vector<Error> *errors);
+ast::Ptr<ast::Expr> parseExpression(ParseState *ps);
+ast::Ptr<ast::If> parseIfCond(ParseState *ps);
+ast::Ptr<ast::While> parseWhileLoop(ParseState *ps);
+ast::Ptr<ast::For> parseForLoop(ParseState *ps);
+ast::Ptr<ast::FunctionCall> parseFunctionCall(ParseState *ps);
+// ast::Ptr<ast::Assignment> parseAssignment(ParseState *ps);  // replaced for efficiency reasons by direct parsing in parseStatement
+ast::Ptr<ast::DeclAssignment> parseDeclAssignment(ParseState *ps);
+ast::Ptr<ast::Return> parseReturn(ParseState *ps);
+ast::Ptr<ast::FunctionDef> parseFunctionDef(ParseState *ps);
+ast::Ptr<ast::Statement> parseStatement(ParseState *ps, bool is_toplevel = false);
+ast::Ptr<ast::Block> parseBlock(ParseState *ps, bool is_toplevel = false, bool allow_implicit_return = true);
+/// the returned tree lives in arena and is freed together with it
+ast::Ptr<ast::Block> parse(StringRef file, token::TokenBuffer const &tokens, std::vector<Error> *errors, ast::Arena *arena);
+/// streaming variant: lexes and parses one toplevel item at a time, so only the tokens of the current item are kept
+/// in memory. A syntax error in a toplevel item skips the rest of that item. The cursor must start at offset 0.
+/// If line_starts is given, it receives the line table that was collected while lexing.
+ast::Ptr<ast::Block> parse(StringRef file, token::LexCursor *cursor, std::vector<Error> *errors, ast::Arena *arena, std::vector<uint32_t> *line_starts = nullptr);
+
+/// number of toplevel items a thread of parseParallel takes at once
+#define PARALLEL_PARSE_BATCH_SIZE 64
+
+/// parallel variant: a pre-scan over the token types splits tokens into its toplevel items (see ToplevelItemScanner),
+/// which are handed out to up to n_threads threads in batches and parsed independently. The toplevel block is
+/// assembled in source order and the errors are sorted by location. Files with few items are parsed serially. For
+/// a file without syntax errors the tree is the same as the one of the serial parse.
+ast::Ptr<ast::Block> parseParallel(StringRef file, token::TokenBuffer const &tokens, std::vector<Error> *errors, ast::Arena *arena, uint32_t n_threads);
+
+/// a toplevel item of an incremental parse
+typedef struct ToplevelItem {
+    /// token range in the buffer of the last parse
+    uint32_t start;
+    uint32_t end;
+    /// line of the first token
+    uint32_t line;
+    /// the parsed item, nullptr if it has syntax errors (those items are parsed again every time, to report them)
+    ast::Statement *stmt;
+} ToplevelItem;
+
+/// what reparse keeps between the parses of a file that is edited over and over (eg in watch mode). Starts out empty.
+typedef struct IncrementalParse {
+    ast::Ptr<ast::Block> block;
+    std::vector<ToplevelItem> items;
+    /// how many items the last reparse took over from the previous tree and how many it had to parse
+    uint32_t n_reused;
+    uint32_t n_parsed;
+} IncrementalParse;
+
+/* Incremental variant: parses tokens item by item like parseParallel, but takes over the subtree of every function
+ * definition or global whose tokens were not touched by the edit since the previous call instead of parsing it again,
+ * only moving it to its new line. change is what relex returned for that edit. Items are only split again from the
+ * first one that overlaps the relexed tokens up to the first boundary of the previous split after them, so the
+ * lexing and parsing work is proportional to the edit, plus a copy of each untouched item. Without change (tokens
+ * lexed from scratch, or more than one edit since the previous call) the whole file is parsed. Every call for a
+ * file must use the same arena, which keeps the nodes of replaced items until it is reset (start over with an empty
+ * IncrementalParse then).
+ */
+void reparse(IncrementalParse *parsed, StringRef file, token::TokenBuffer const &tokens, token::RelexResult const *change, std::vector<Error> *errors, ast::Arena *arena);
 }  // namespace parser
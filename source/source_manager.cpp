@@ -0,0 +1,177 @@
+#include "source_manager.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SOURCE_MANAGER_MMAP
+#endif
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+static char const empty_source[] = "";
+
+typedef struct LoadedFileBuffer {
+    std::unique_ptr<char[]> data;
+    uint32_t length;
+} LoadedFileBuffer;
+
+std::runtime_error sourceLoadError(std::string const &path) {
+    return std::runtime_error("could not read source file '" + path + "': " + std::strerror(errno));
+}
+
+/// fallback for everything that cannot be mapped: read the whole stream into one growing buffer (closes f)
+LoadedFileBuffer readAll(FILE *f, std::string const &path) {
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t length = 0;
+    std::unique_ptr<char[]> buffer(new char[capacity]);
+    while (true) {
+        if (length == capacity) {
+            std::unique_ptr<char[]> grown(new char[capacity * 2]);
+            std::memcpy(grown.get(), buffer.get(), length);
+            buffer = std::move(grown);
+            capacity *= 2;
+        }
+        size_t n = std::fread(buffer.get() + length, 1, capacity - length, f);
+        length += n;
+        if (n == 0)
+            break;
+    }
+    bool failed = std::ferror(f);
+    if (f != stdin)
+        std::fclose(f);
+    if (failed)
+        throw sourceLoadError(path);
+    if (length > UINT32_MAX)
+        throw std::runtime_error("source file '" + path + "' is too large (4 GiB max)");
+    return LoadedFileBuffer {.data = std::move(buffer), .length = static_cast<uint32_t>(length)};
+}
+
+SourceFileInfo SourceManager::load(std::string const &path) {
+    auto file = std::make_unique<LoadedFile>();
+    file->path = path;
+    file->data = empty_source;
+    file->length = 0;
+    file->is_mapped = false;
+
+    if (path == "-") {
+        LoadedFileBuffer buf = readAll(stdin, path);
+        file->buffer = std::move(buf.data);
+        file->data = file->buffer.get();
+        file->length = buf.length;
+    } else {
+#ifdef SOURCE_MANAGER_MMAP
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw sourceLoadError(path);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw sourceLoadError(path);
+        }
+        if (S_ISREG(st.st_mode) && st.st_size > UINT32_MAX) {
+            close(fd);
+            throw std::runtime_error("source file '" + path + "' is too large (4 GiB max)");
+        }
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                file->data = static_cast<char const *>(mapped);
+                file->length = static_cast<uint32_t>(st.st_size);
+                file->is_mapped = true;
+            }
+        }
+        if (!file->is_mapped) {
+            FILE *f = fdopen(fd, "rb");
+            if (!f) {
+                close(fd);
+                throw sourceLoadError(path);
+            }
+            fd = -1;  // owned (and closed) by f now
+            LoadedFileBuffer buf = readAll(f, path);
+            file->buffer = std::move(buf.data);
+            file->data = file->buffer.get();
+            file->length = buf.length;
+        }
+        // the mapping stays valid after the descriptor is closed
+        if (fd >= 0)
+            close(fd);
+#else
+        FILE *f = std::fopen(path.c_str(), "rb");
+        if (!f)
+            throw sourceLoadError(path);
+        LoadedFileBuffer buf = readAll(f, path);
+        file->buffer = std::move(buf.data);
+        file->data = file->buffer.get();
+        file->length = buf.length;
+#endif
+    }
+
+    m_files.push_back(std::move(file));
+    auto const &loaded = *m_files.back();
+    return SourceFileInfo {
+        .file = StringRef {.start = loaded.path.c_str(), .length = static_cast<uint32_t>(loaded.path.length())},
+        .code = StringRef {.start = loaded.data, .length = loaded.length},
+    };
+}
+
+SourceManager::~SourceManager() {
+#ifdef SOURCE_MANAGER_MMAP
+    for (auto const &file : m_files)
+        if (file->is_mapped)
+            munmap(const_cast<char *>(file->data), file->length);
+#endif
+}
+
+LineIndex::LineIndex(StringRef code) : m_code(code)
+{}
+
+void LineIndex::build() {
+    if (m_built)
+        return;
+    m_line_starts.push_back(0);
+    char const *p = m_code.start;
+    char const *end = m_code.start + m_code.length;
+    while (auto newline = static_cast<char const *>(std::memchr(p, '\n', end - p))) {
+        p = newline + 1;
+        m_line_starts.push_back(p - m_code.start);
+    }
+    m_built = true;
+}
+
+void LineIndex::adopt(std::vector<uint32_t> line_starts) {
+    m_line_starts = std::move(line_starts);
+    m_built = true;
+}
+
+uint32_t LineIndex::lineCount() {
+    build();
+    // a trailing newline does not open another line
+    if (m_line_starts.size() > 1 && m_line_starts.back() == m_code.length)
+        return m_line_starts.size() - 1;
+    return m_line_starts.size();
+}
+
+StringRef LineIndex::line(uint32_t line) {
+    build();
+    if (line == 0 || line > m_line_starts.size())
+        throw std::out_of_range("line " + std::to_string(line) + " is out of range");
+    uint32_t start = m_line_starts[line - 1];
+    uint32_t end = line < m_line_starts.size() ? m_line_starts[line] - 1 : m_code.length;
+    return StringRef {
+        .start = m_code.start + start,
+        .length = end - start,
+    };
+}
+
+uint32_t LineIndex::lineOf(uint32_t offset) {
+    build();
+    return std::upper_bound(m_line_starts.begin(), m_line_starts.end(), offset) - m_line_starts.begin();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "lib.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef struct SourceFileInfo {
+    StringRef file;
+    StringRef code;
+} SourceFileInfo;
+
+/* Line table of one source file, only needed to print diagnostics. Nothing is computed until the first lookup, and
+ * line starts the lexer collected anyway can be handed over instead, so a file is scanned for newlines at most once
+ * and a clean compile never builds it at all.
+ */
+class LineIndex {
+    StringRef m_code;
+    /// offset of the first character of every line (m_line_starts[0] == 0), valid once m_built is set
+    std::vector<uint32_t> m_line_starts;
+    bool m_built = false;
+
+    void build();
+
+public:
+    explicit LineIndex(StringRef code);
+
+    /// use the line starts collected by the lexer (see token::TokenBuffer::line_starts) instead of scanning again
+    void adopt(std::vector<uint32_t> line_starts);
+    uint32_t lineCount();
+    /// contents of a line (1-based) without the trailing newline
+    StringRef line(uint32_t line);
+    /// 1-based line of a source offset (O(log lines))
+    uint32_t lineOf(uint32_t offset);
+};
+
+/* Owns the contents of all loaded source files. Regular files are memory mapped (no copy at all), anything that
+ * cannot be mapped (pipes, stdin, ...) is read once into a heap buffer. The returned StringRefs (and thus all tokens
+ * and AST locations pointing into them) stay valid until the SourceManager is destroyed.
+ */
+class SourceManager {
+    typedef struct LoadedFile {
+        std::string path;
+        char const *data;
+        uint32_t length;
+        bool is_mapped;
+        std::unique_ptr<char[]> buffer;
+    } LoadedFile;
+
+    // LoadedFile is heap allocated so that path.c_str() is stable when the vector grows
+    std::vector<std::unique_ptr<LoadedFile>> m_files;
+
+public:
+    SourceManager() = default;
+    SourceManager(SourceManager const &) = delete;
+    SourceManager &operator=(SourceManager const &) = delete;
+    ~SourceManager();
+
+    /// load a source file ("-" reads stdin); throws std::runtime_error if the file cannot be read
+    SourceFileInfo load(std::string const &path);
+};
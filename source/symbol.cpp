@@ -0,0 +1,85 @@
+#include "symbol.hpp"
+
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace symbol {
+typedef struct Interner {
+    std::shared_mutex mutex;
+    // a deque never moves its elements, so the string_view keys of ids stay valid as names grows
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, Id> ids;
+
+    Interner() {
+        names.emplace_back();
+        ids.emplace(names.back(), SYMBOL_NONE);
+    }
+} Interner;
+
+Interner &interner() {
+    static Interner instance;
+    return instance;
+}
+
+#define SYMBOL_CACHE_SIZE 1024
+
+// per-thread direct mapped cache in front of the shared table: names are never freed, so a cached pointer can be
+// compared against without taking the lock
+typedef struct CacheEntry {
+    std::string const *name;
+    Id id;
+} CacheEntry;
+
+thread_local CacheEntry cache[SYMBOL_CACHE_SIZE] = {};
+
+Id intern(StringRef name) {
+    Interner &in = interner();
+    std::string_view key(name.start, name.length);
+    CacheEntry &entry = cache[std::hash<std::string_view>{}(key) % SYMBOL_CACHE_SIZE];
+    if (entry.name && *entry.name == key)
+        return entry.id;
+    {
+        // a cache miss on an already known name only needs the shared lock
+        std::shared_lock lock(in.mutex);
+        auto it = in.ids.find(key);
+        if (it != in.ids.end()) {
+            entry = CacheEntry {.name = &in.names[it->second], .id = it->second};
+            return it->second;
+        }
+    }
+    std::unique_lock lock(in.mutex);
+    auto it = in.ids.find(key);
+    if (it == in.ids.end()) {
+        Id id = in.names.size();
+        in.names.emplace_back(key);
+        it = in.ids.emplace(in.names.back(), id).first;
+    }
+    entry = CacheEntry {.name = &in.names[it->second], .id = it->second};
+    return it->second;
+}
+
+Id intern(char const *name) {
+    return intern(StringRef {
+        .start = name,
+        .length = static_cast<uint32_t>(std::strlen(name)),
+    });
+}
+
+std::string const &name(Id id) {
+    Interner &in = interner();
+    std::shared_lock lock(in.mutex);
+    if (id >= in.names.size())
+        throw std::runtime_error("unreachable: invalid symbol id " + std::to_string(id));
+    return in.names[id];
+}
+
+uint32_t count() {
+    Interner &in = interner();
+    std::shared_lock lock(in.mutex);
+    return in.names.size();
+}
+}  // namespace symbol
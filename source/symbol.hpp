@@ -0,0 +1,26 @@
+#pragma once
+
+#include "lib.hpp"
+
+#include <cstdint>
+#include <string>
+
+/* Process-wide identifier interner. Every distinct identifier gets a dense 32-bit id the first time the lexer sees
+ * it, and from then on the parser, the AST and codegen pass ids around instead of strings (the spelling is only
+ * looked up for diagnostics, json output and llvm names). Interning is thread safe so the parallel lexer can use it.
+ */
+
+namespace symbol {
+typedef uint32_t Id;
+
+/// the id of the empty string, never produced for an identifier token
+#define SYMBOL_NONE 0u
+
+/// returns the id of name, registering it on first use (O(1) amortized)
+Id intern(StringRef name);
+Id intern(char const *name);
+/// spelling of an interned id; the reference stays valid for the lifetime of the process
+std::string const &name(Id id);
+/// number of distinct symbols interned so far (including the empty one)
+uint32_t count();
+}  // namespace symbol
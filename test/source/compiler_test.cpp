@@ -1,9 +1,870 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include "LLVMCodeGen/codegen.hpp"
+#include "LLVMCodeGen/flat_codegen.hpp"
+#include "ast_visitor.hpp"
+#include "constant_folding.hpp"
+#include "flat_ast.hpp"
+#include "flat_ast_file.hpp"
 #include "lib.hpp"
+#include "lexer.hpp"
+#include "lexer_scan.hpp"
+#include "output_sink.hpp"
+#include "parser.hpp"
+#include "source_manager.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+
+// every heap allocation of the test binary is counted, so tests can check that a code path does not allocate
+static std::atomic<uint64_t> n_allocations = 0;
+
+void *operator new(std::size_t size)
+{
+  n_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+// the arena gets its blocks from std::pmr::new_delete_resource, which uses the aligned variants
+void *operator new(std::size_t size, std::align_val_t align)
+{
+  n_allocations.fetch_add(1, std::memory_order_relaxed);
+  std::size_t const alignment = static_cast<std::size_t>(align);
+  if (void *p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+  std::free(p);
+}
 
 TEST_CASE("Test test", "[library]")
 {
   auto const name = "hello";
   REQUIRE(name == "hello");
 }
+
+TEST_CASE("Every scan kernel agrees with the scalar one", "[lexer]")
+{
+  using ScanFn = char const *(*)(char const *, char const *);
+  auto const kernels = token::scan::availableKernels();
+  REQUIRE(std::string(kernels.front().name) == "scalar");
+  REQUIRE(std::string(kernels.back().name) == token::scan::kernelName());
+
+  // runs of each class, broken up now and then by an arbitrary byte (which includes bytes >= 0x80)
+  char const *const runs[] = {" ", "ab_Zz09x", "a b\tc", "0123456789", "09afAF", "gG@`[{/:", "xyz  \n"};
+  alignas(64) char buf[256];
+  uint32_t rng = 12345;
+  auto const next = [&rng]() {
+    rng = rng * 1103515245u + 12345u;
+    return rng >> 16;
+  };
+  uint64_t mismatches = 0;
+  for (int trial = 0; trial < 300; trial++) {
+    char const *const run = runs[trial % (sizeof(runs) / sizeof(runs[0]))];
+    size_t const run_length = std::strlen(run);
+    for (char &c : buf)
+      c = next() % 48 ? run[next() % run_length] : static_cast<char>(next() | (trial & 1 ? 0x80 : 0));
+    for (auto const &kernel : kernels) {
+      ScanFn const fns[] = {kernel.skip_spaces, kernel.find_newline, kernel.skip_ident_chars, kernel.skip_digits, kernel.skip_hex_digits};
+      ScanFn const scalar_fns[] = {kernels[0].skip_spaces, kernels[0].find_newline, kernels[0].skip_ident_chars, kernels[0].skip_digits, kernels[0].skip_hex_digits};
+      for (size_t f = 0; f < 5; f++)
+        for (size_t start = 0; start < 64; start++)
+          for (size_t length = 0; start + length <= sizeof(buf) && length <= 130; length++)
+            mismatches += fns[f](buf + start, buf + start + length) != scalar_fns[f](buf + start, buf + start + length);
+    }
+  }
+  REQUIRE(mismatches == 0);
+}
+
+TEST_CASE("Token buffer recovers locations from the line table", "[lexer]")
+{
+  char const code[] = "let x = 0x1f;\n// comment\n  fn f() { x }\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  auto const tokens = token::lex(file, StringRef {.start = code, .length = sizeof(code) - 1});
+
+  REQUIRE(tokens.line_starts == std::vector<uint32_t> {0, 14, 25, 40});
+  REQUIRE(tokens.types[3] == token::TokenType::number);
+  REQUIRE(tokens.number(3) == 0x1f);
+  REQUIRE(tokens.types[5] == token::TokenType::fn_kwd);
+  REQUIRE(tokens.loc(5).line == 3);
+  REQUIRE(tokens.loc(5).column == 2);
+  REQUIRE(tokens.types.back() == token::TokenType::eof);
+}
+
+TEST_CASE("Line index agrees with the lexer line table", "[diagnostics]")
+{
+  char const code[] = "fn f() {\n  1\n}\n\nlast";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  LineIndex lazy(code_sr);
+  LineIndex adopted(code_sr);
+  adopted.adopt(token::lex(file, code_sr).line_starts);
+  for (LineIndex *lines : {&lazy, &adopted}) {
+    REQUIRE(lines->lineCount() == 5);
+    REQUIRE(std::string(lines->line(2).start, lines->line(2).length) == "  1");
+    REQUIRE(lines->line(4).length == 0);
+    REQUIRE(std::string(lines->line(5).start, lines->line(5).length) == "last");
+    REQUIRE(lines->lineOf(11) == 2);
+  }
+}
+
+TEST_CASE("Identifiers are interned once at lex time", "[lexer]")
+{
+  char const code[] = "fn interned_f(interned_a) { interned_a + interned_f(interned_a) }";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  auto const tokens = token::lex(file, StringRef {.start = code, .length = sizeof(code) - 1});
+
+  auto const f = symbol::intern("interned_f");
+  auto const a = symbol::intern("interned_a");
+  REQUIRE(f != a);
+  REQUIRE(symbol::name(a) == "interned_a");
+  REQUIRE(tokens.sym(0) == SYMBOL_NONE);
+  REQUIRE(tokens.sym(1) == f);
+  REQUIRE(tokens.sym(3) == a);
+  REQUIRE(tokens.sym(6) == a);
+  REQUIRE(tokens.sym(8) == f);
+  REQUIRE(tokens.sym(10) == a);
+}
+
+TEST_CASE("Bracket table pairs parens and braces", "[lexer]")
+{
+  // the second `}` and the trailing `(` and `{` are unmatched, the last entry is the eof token
+  char const code[] = "f ( { ( ) } } ) ( {";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  auto const tokens = token::lex(file, StringRef {.start = code, .length = sizeof(code) - 1});
+
+  std::vector<uint32_t> const expected = {
+      TOKEN_NO_MATCH, 7, 5, 4, 3, 2, TOKEN_NO_MATCH, 1, TOKEN_NO_MATCH, TOKEN_NO_MATCH, TOKEN_NO_MATCH};
+  REQUIRE(tokens.matches == expected);
+}
+
+TEST_CASE("Streaming parse matches parsing the full token buffer", "[parser]")
+{
+  char const code[] = "let g = 3;\nfn f(a, b) {\n  let x = a * (b + 0x10);\n  if x { x } else { -b }\n}\n;;\nfn main() { f(g, 2) }\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const tokens = token::lex(file, code_sr);
+  auto const full = parser::parse(file, tokens, &errors, &arena);
+  token::LexCursor cursor = token::newLexCursor(code_sr);
+  auto const streamed = parser::parse(file, &cursor, &errors, &arena);
+
+  REQUIRE(errors.empty());
+  REQUIRE(streamed->toJsonString() == full->toJsonString());
+}
+
+TEST_CASE("Binary operators follow precedence and associativity", "[parser]")
+{
+  char const implicit[] = "fn f(a, b) { return a - b * 2 - -a % (b - 1) / 3; }\n";
+  char const explicit_[] = "fn f(a, b) { return ((a - (b * 2)) - (((-a) % (b - 1)) / 3)); }\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const parseCode = [&](char const *code) {
+    StringRef const code_sr = {.start = code, .length = (uint32_t)strlen(code)};
+    return parser::parse(file, token::lex(file, code_sr), &errors, &arena)->toJsonString();
+  };
+  auto const json = parseCode(implicit);
+
+  REQUIRE(errors.empty());
+  REQUIRE(json.find("\"op\": \"sub\"") != std::string::npos);
+  REQUIRE(json == parseCode(explicit_));
+  REQUIRE(errors.empty());
+}
+
+TEST_CASE("Parsing a valid file does not allocate per token", "[parser]")
+{
+  std::string code = "let g;\n";
+  for (int i = 0; i < 200; i++)
+    code += "fn f" + std::to_string(i) + "(a, b) {\n"
+      "  let x = (a + 0x1f) * -b % 3;\n"
+      "  if x { g = f0(x, 2); } else { x = x - 1; }\n"
+      "  while x { x = x - 1; }\n"
+      "  for let i = 0; i; i = i - 1; { print(i); }\n"
+      "  return { let y = x; y / 2 };\n"
+      "}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code.c_str(), .length = (uint32_t)code.size()};
+  auto const tokens = token::lex(file, code_sr);
+
+  // nodes go to a preallocated buffer, so anything else the parser allocates shows up in the count
+  std::vector<std::byte> memory(4 << 20);
+  ast::Arena arena(memory.data(), memory.size());
+  std::vector<parser::Error> errors;
+  uint64_t const before = n_allocations;
+  auto const block = parser::parse(file, tokens, &errors, &arena);
+  uint64_t const allocations = n_allocations - before;
+
+  REQUIRE(errors.empty());
+  REQUIRE(tokens.size() > 10000);
+  REQUIRE(allocations == 0);
+}
+
+TEST_CASE("Parser resynchronizes after syntax errors", "[parser]")
+{
+  char const code[] = "fn f(a) {\n  let = 1;\n  let x = a + ;\n  print(a);\n  g(a,, 2);\n  return x;\n}\nfn h() { 0 }\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const json = parser::parse(file, token::lex(file, code_sr), &errors, &arena)->toJsonString();
+
+  // one error per broken statement, located at the offending token
+  REQUIRE(errors.size() == 3);
+  REQUIRE(errors[0].loc.line == 2);
+  REQUIRE(errors[0].loc.column == 6);
+  REQUIRE(errors[1].loc.line == 3);
+  REQUIRE(errors[1].loc.column == 14);
+  REQUIRE(errors[2].loc.line == 5);
+  REQUIRE(errors[2].loc.column == 6);
+  // the statements around the broken ones are still there
+  REQUIRE(json.find("\"name\": \"print\"") != std::string::npos);
+  REQUIRE(json.find("\"kind\": \"return\"") != std::string::npos);
+  REQUIRE(json.find("\"name\": \"h\"") != std::string::npos);
+
+  std::vector<parser::Error> stream_errors;
+  token::LexCursor cursor = token::newLexCursor(code_sr);
+  REQUIRE(parser::parse(file, &cursor, &stream_errors, &arena)->toJsonString() == json);
+  REQUIRE(stream_errors.size() == errors.size());
+}
+
+TEST_CASE("Streaming parse keeps the items after an unbalanced paren", "[parser]")
+{
+  std::string code = "let g;\n";
+  for (int i = 0; i < 300; i++)
+    code += "fn f" + std::to_string(i) + "(a) { " + (i == 250 ? "let y = (a * 2;" : "let y = a * 2;") + " y }\n";
+  code += "fn h(a) {\n  let x = (a + ;\n  x\n}\nfn k(a) { g(a,, (2) }\nlet = 1;\nfn m() { 0 }\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code.c_str(), .length = (uint32_t)code.size()};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const full = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(full->getStatements().size() == 304);
+  std::vector<parser::Error> stream_errors;
+  token::LexCursor cursor = token::newLexCursor(code_sr);
+  auto const streamed = parser::parse(file, &cursor, &stream_errors, &arena);
+  REQUIRE(streamed->toJsonString() == full->toJsonString());
+
+  auto const describe = [](std::vector<parser::Error> const &errs) {
+    std::vector<std::string> out;
+    for (auto const &err : errs)
+      out.push_back(std::to_string(err.loc.line) + ":" + std::to_string(err.loc.column) + " " + err.msg);
+    return out;
+  };
+  REQUIRE(errors.size() >= 4);
+  REQUIRE(describe(stream_errors) == describe(errors));
+}
+
+TEST_CASE("Flattened AST keeps the shape of the tree in post order", "[ast]")
+{
+  char const code[] = "let g;\nfn f(a) {\n  return a + g * 2;\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const block = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(errors.empty());
+  flat::Tree const tree = flat::flatten(block.get());
+  arena.reset();
+
+  using flat::NodeKind;
+  REQUIRE(tree.kinds == std::vector<NodeKind> {
+    NodeKind::decl_assignment,
+    NodeKind::var_ref, NodeKind::var_ref, NodeKind::constant, NodeKind::binary_op, NodeKind::binary_op,
+    NodeKind::return_, NodeKind::block, NodeKind::function_def, NodeKind::block,
+  });
+  REQUIRE(tree.root == tree.size() - 1);
+  REQUIRE(tree.ops[tree.root] == FLAT_BLOCK_TOPLEVEL);
+  REQUIRE(tree.childCount(tree.root) == 2);
+  REQUIRE(tree.childCount(0) == 0);
+  REQUIRE(tree.child(5, 0) == 1);
+  REQUIRE(tree.child(5, 1) == 4);
+  REQUIRE(tree.constants[tree.payloads[3]] == 2);
+  REQUIRE(symbol::name(tree.protos[tree.payloads[8]].name) == "f");
+  REQUIRE(tree.loc(6).line == 3);
+  REQUIRE(tree.loc(6).file.start == file.start);
+}
+
+// number of nodes in a subtree, as a minimal pass
+class NodeCounter : public ast::Visitor<NodeCounter, uint32_t> {
+public:
+  uint32_t visitBinaryOp(ast::BinaryOp const *node) { return 1 + visit(node->getLhs()) + visit(node->getRhs()); }
+  uint32_t visitUnaryOp(ast::UnaryOp const *node) { return 1 + visit(node->getRhs()); }
+  uint32_t visitVarRef(ast::VarRef const *) { return 1; }
+  uint32_t visitConstant(ast::Constant const *) { return 1; }
+  uint32_t visitFunctionCall(ast::FunctionCall const *node)
+  {
+    uint32_t n = 1;
+    for (auto const &arg : node->getArgs())
+      n += visit(arg.get());
+    return n;
+  }
+  uint32_t visitBlock(ast::Block const *node)
+  {
+    uint32_t n = 1;
+    for (auto const &stmt : node->getStatements())
+      n += visit(stmt.get());
+    return node->getResult() ? n + visit(node->getResult()) : n;
+  }
+  uint32_t visitIf(ast::If const *node)
+  {
+    uint32_t n = 1 + visit(node->getCondition()) + visit(node->getBranch());
+    return node->getElseBranch() ? n + visit(node->getElseBranch()) : n;
+  }
+  uint32_t visitWhile(ast::While const *node) { return 1 + visit(node->getCondition()) + visit(node->getBranch()); }
+  uint32_t visitFor(ast::For const *node)
+  {
+    return 1 + visit(node->getInit()) + visit(node->getCondition()) + visit(node->getUpdate()) + visit(node->getBranch());
+  }
+  uint32_t visitFunctionDef(ast::FunctionDef const *node) { return 1 + visit(node->getBlock()); }
+  uint32_t visitDeclAssignment(ast::DeclAssignment const *node)
+  {
+    return node->getValue() ? 1 + visit(node->getValue()) : 1;
+  }
+  uint32_t visitAssignment(ast::Assignment const *node) { return 1 + visit(node->getKey()) + visit(node->getValue()); }
+  uint32_t visitReturn(ast::Return const *node) { return 1 + visit(node->getValue()); }
+  uint32_t visitExprStmt(ast::ExprStmt const *node) { return 1 + visit(node->getExpr()); }
+};
+
+TEST_CASE("Visitors reach every node of the tree", "[ast]")
+{
+  char const code[] = "let g;\nfn f(a, b) {\n  let x = -a;\n  if x { g = f(x, 2); } else { x = 1; }\n"
+    "  while x { x = x - 1; }\n  for let i = 0; i; i = i - 1; { print(i); }\n  return { b };\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const block = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(errors.empty());
+  REQUIRE(block->getKind() == ast::ExprKind::block);
+  REQUIRE(NodeCounter().visit(block.get()) == flat::flatten(block.get()).size());
+}
+
+TEST_CASE("Constant folding wraps at 8 bits and keeps effects and diagnostics", "[ast]")
+{
+  // a and b are found, g is a global and u is undeclared, so x - x only folds for the former
+  char const code[] = "let g;\nfn f(a) {\n  let b = 0xff + 2 * 3;\n  b = a * 1 + 0 - (a - a) + -(1 - 2) / 0;\n"
+    "  b = f(a) * 0 + (g - g) + (u * 0) + (a + b) % 1 + 300 - 0x2c;\n  return b - 1 - 1;\n}\n";
+  char const folded[] = "let g;\nfn f(a) {\n  let b = 5;\n  b = a + 1 / 0;\n"
+    "  b = f(a) * 0 + (g - g) + (u * 0) + 300 - 0x2c;\n  return b - 1 - 1;\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const parseCode = [&](char const *source) {
+    StringRef const code_sr = {.start = source, .length = (uint32_t)strlen(source)};
+    return parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  };
+  auto const block = parseCode(code);
+  auto const expected = parseCode(folded);
+  REQUIRE(errors.empty());
+  uint32_t const n_nodes = flat::flatten(block.get()).size();
+
+  uint32_t const n_eliminated = ast::foldConstants(block.get(), &arena);
+  auto const tree = flat::flatten(block.get());
+  auto const expected_tree = flat::flatten(expected.get());
+  REQUIRE(tree.size() == n_nodes - n_eliminated);
+  REQUIRE(tree.kinds == expected_tree.kinds);
+  REQUIRE(tree.ops == expected_tree.ops);
+  REQUIRE(tree.children == expected_tree.children);
+  REQUIRE(tree.constants == expected_tree.constants);
+  REQUIRE(ast::foldConstants(expected.get(), &arena) == 0);
+}
+
+TEST_CASE("Always-returns analysis follows every path through the function", "[ast]")
+{
+  char const code[] = "fn a(x) { if x { return 1; } else { return 2; } }\nfn b(x) { if x { return 1; } }\n"
+    "fn c(x) { while x { return 1; } }\nfn d(x) { let y = { return x; }; }\n"
+    "fn e(x) { for let i = 0; i; i = i - 1; { return i; } }\nfn f(x) { x = 1 + { return 2; }; }\n"
+    "fn g(x) { while ({ return x; }) { } }\nfn h(x) { print(x); { { return x; } } }\n";
+  std::vector<bool> const expected = {true, false, false, true, false, true, true, true};
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const block = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(errors.empty());
+  std::vector<bool> bodies;
+  for (auto const &stmt : block->getStatements())
+    bodies.push_back(static_cast<ast::FunctionDef const *>(stmt.get())->getBlock()->alwaysReturns());
+  REQUIRE(bodies == expected);
+  REQUIRE(!block->alwaysReturns());
+
+  // the flat tree computes the same from its node arrays
+  flat::Tree const tree = flat::flatten(block.get());
+  std::vector<bool> const flat_returns = flat::alwaysReturns(tree.view());
+  std::vector<bool> flat_bodies;
+  for (uint32_t id = 0; id < tree.size(); id++)
+    if (tree.kinds[id] == flat::NodeKind::function_def)
+      flat_bodies.push_back(flat_returns[tree.child(id, 0)]);
+  REQUIRE(flat_bodies == expected);
+}
+
+TEST_CASE("Returns that fail to generate still end their block", "[codegen]")
+{
+  char const code[] = "fn f(a) { return undeclared_var; }\nfn g(a) { if a { return 1; } else { return nope; } }\n"
+    "fn h(a) { a = 1 + { return missing; }; a }\nfn k(a) { while a { return zz; } a }\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const block = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(errors.empty());
+  flat::Tree const tree = flat::flatten(block.get());
+  for (bool const flat_backend : {false, true}) {
+    std::vector<codegen::Error> cg_errors;
+    std::vector<codegen::Warning> cg_warnings;
+    codegen::State state;
+    codegen::Context ctx = codegen::newContext(file, &cg_errors, &cg_warnings, &state);
+    if (flat_backend)
+      codegen::codegenFlat(&ctx, &tree);
+    else
+      codegen::codegenAst(&ctx, block.get());
+    // only the undeclared variables are reported, the module itself is well-formed
+    std::vector<uint32_t> lines;
+    for (auto const &err : cg_errors)
+      lines.push_back(err.loc.line);
+    REQUIRE(lines == std::vector<uint32_t> {1, 2, 3, 4});
+    REQUIRE_FALSE(llvm::verifyModule(*ctx.module));
+  }
+}
+
+TEST_CASE("Deeply nested input does not overflow the stack", "[parser]")
+{
+  // far deeper than the recursion of the parser and the tree walks fits into a default stack
+  uint32_t const depth = 100000;
+  std::string code = "fn f(a) {\n  return ";
+  for (uint32_t i = 0; i < depth; i++)
+    code += "{-(a + ";
+  code += "1";
+  for (uint32_t i = 0; i < depth; i++)
+    code += ")}";
+  code += ";\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code.data(), .length = static_cast<uint32_t>(code.size())};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const block = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(errors.empty());
+
+  block->shiftLines(1);
+  // every level is a block, a negation, an addition and a reference to a, around them the constant, the return, the
+  // function body, the function and the toplevel block
+  flat::Tree const tree = flat::flatten(block.get());
+  REQUIRE(tree.size() == 4 * depth + 5);
+  REQUIRE(tree.kinds[tree.root - 3] == flat::NodeKind::return_);
+  REQUIRE(tree.loc(tree.root - 3).line == 3);
+}
+
+TEST_CASE("A new stack segment runs on the calling thread", "[lib]")
+{
+  // thread_locals (the symbol intern cache, the stack limit) must be the same inside and outside of the segment
+  std::thread::id const outer = std::this_thread::get_id();
+  uintptr_t const limit_before = stack_limit;
+  auto const inner = onNewStack([] { return std::this_thread::get_id(); });
+  REQUIRE(inner == outer);
+  REQUIRE(stack_limit == limit_before);
+}
+
+TEST_CASE("AST json is streamed into an output sink", "[ast]")
+{
+  uint32_t const depth = 10000;
+  std::string code = "fn f(a) {\n  return ";
+  for (uint32_t i = 0; i < depth; i++)
+    code += "{-(a + ";
+  code += "1";
+  for (uint32_t i = 0; i < depth; i++)
+    code += ")}";
+  code += ";\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code.data(), .length = static_cast<uint32_t>(code.size())};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const block = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(errors.empty());
+  auto const json = block->toJsonString();
+  REQUIRE(json.rfind("{\"line\": 1, \"file\": \"test.bpl\", \"kind\": \"block\", \"statements\": [", 0) == 0);
+
+  // into a buffer with room for everything, the sink itself does not allocate
+  std::string buffered;
+  buffered.reserve(json.size());
+  uint64_t const before = n_allocations;
+  {
+    OutputSink out(&buffered);
+    block->writeJson(&out);
+    out.flush();
+  }
+  REQUIRE(n_allocations - before == 0);
+  REQUIRE(buffered == json);
+
+  std::FILE *tmp = std::tmpfile();
+  REQUIRE(tmp);
+  {
+    OutputSink out(fileno(tmp));
+    block->writeJson(&out);
+    out.flush();
+  }
+  std::string written(json.size() + 1, '\0');
+  std::rewind(tmp);
+  written.resize(std::fread(written.data(), 1, written.size(), tmp));
+  std::fclose(tmp);
+  REQUIRE(written == json);
+}
+
+TEST_CASE("Symbol table restores shadowed variables when a scope is left", "[codegen]")
+{
+  // the table never dereferences the slots, any distinct pointers do
+  llvm::AllocaInst *slots[4];
+  for (uintptr_t i = 0; i < 4; i++)
+    slots[i] = reinterpret_cast<llvm::AllocaInst *>(0x1000 * (i + 1));
+  auto const x = symbol::intern("scoped_x");
+  auto const y = symbol::intern("scoped_y");
+
+  codegen::SymbolTable symbols;
+  REQUIRE(symbols.local(x) == nullptr);
+  symbols.enterScope();
+  symbols.declare(x, slots[0]);
+  symbols.enterScope();
+  symbols.declare(x, slots[1]);
+  symbols.declare(y, slots[2]);
+  symbols.declare(x, slots[3]);
+  REQUIRE(symbols.local(x) == slots[3]);
+  symbols.leaveScope();
+  REQUIRE(symbols.local(x) == slots[0]);
+  REQUIRE(symbols.local(y) == nullptr);
+
+  // an error unwinding through scopes leaves them all at once
+  uint32_t const depth = symbols.depth();
+  symbols.enterScope();
+  symbols.declare(y, slots[1]);
+  symbols.enterScope();
+  symbols.declare(x, slots[2]);
+  symbols.leaveScopesUntil(depth);
+  REQUIRE(symbols.depth() == 1);
+  REQUIRE(symbols.local(x) == slots[0]);
+  REQUIRE(symbols.local(y) == nullptr);
+
+  symbols.declareGlobal(y);
+  REQUIRE(symbols.isGlobal(y));
+  REQUIRE_FALSE(symbols.isGlobal(x));
+}
+
+TEST_CASE("Binary AST files are read in place", "[ast]")
+{
+  char const code[] = "let g;\nfn f(a, b) {\n  return a + g * 300;\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const block = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(errors.empty());
+  flat::Tree const tree = flat::flatten(block.get());
+  std::string bytes = flat::writeFile(tree);
+  StringRef const data = {.start = bytes.data(), .length = static_cast<uint32_t>(bytes.size())};
+  REQUIRE(flat::isFile(data));
+  REQUIRE_FALSE(flat::isFile(code_sr));
+
+  flat::MappedFile const mapped(data);
+  flat::TreeView const &view = mapped.view();
+  REQUIRE(view.size() == tree.size());
+  REQUIRE(view.root == tree.root);
+  REQUIRE(std::string(view.file.start, view.file.length) == "test.bpl");
+  for (flat::NodeId id = 0; id < tree.size(); id++) {
+    REQUIRE(view.kinds[id] == tree.kinds[id]);
+    REQUIRE(view.loc(id).line == tree.loc(id).line);
+    REQUIRE(view.loc(id).column == tree.loc(id).column);
+    REQUIRE(view.childCount(id) == tree.childCount(id));
+    for (uint32_t i = 0; i < tree.childCount(id); i++)
+      REQUIRE(view.child(id, i) == tree.child(id, i));
+  }
+  // the nodes point into the file itself, only names are translated back to symbols
+  REQUIRE(reinterpret_cast<char const *>(view.kinds) >= bytes.data());
+  REQUIRE(reinterpret_cast<char const *>(view.kinds) < bytes.data() + bytes.size());
+  REQUIRE(symbol::name(view.symbol(0)) == "g");
+  REQUIRE(view.constants[view.payloads[3]] == 300);
+  REQUIRE(symbol::name(view.protos[0].name) == "f");
+  REQUIRE(view.protos[0].args.size() == 2);
+  REQUIRE(symbol::name(view.protos[0].args[1]) == "b");
+
+  // a stale or foreign file is rejected with a message instead of being read
+  auto *const header = reinterpret_cast<flat::FileHeader *>(bytes.data());
+  header->version = FLAT_FILE_VERSION + 1;
+  REQUIRE_THROWS_WITH(flat::MappedFile(data), "binary AST file has version " + std::to_string(FLAT_FILE_VERSION + 1) + ", expected " + std::to_string(FLAT_FILE_VERSION));
+  header->version = FLAT_FILE_VERSION;
+  header->byte_order = 0x04030201u;
+  REQUIRE_THROWS_AS(flat::MappedFile(data), std::runtime_error);
+  header->byte_order = FLAT_FILE_BYTE_ORDER;
+  header->sections[static_cast<uint32_t>(flat::FileSection::strings)] = bytes.size();
+  REQUIRE_THROWS_AS(flat::MappedFile(data), std::runtime_error);
+}
+
+TEST_CASE("Binary AST files with corrupt nodes are rejected", "[ast]")
+{
+  char const code[] = "let g;\nfn f(a, b) {\n  return a + g * 300;\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code, .length = sizeof(code) - 1};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const block = parser::parse(file, token::lex(file, code_sr), &errors, &arena);
+  REQUIRE(errors.empty());
+  std::string const bytes = flat::writeFile(flat::flatten(block.get()));
+  auto const *const header = reinterpret_cast<flat::FileHeader const *>(bytes.data());
+  auto const section = [&](flat::FileSection s) { return header->sections[static_cast<uint32_t>(s)]; };
+  flat::NodeId const ret = header->root - 3;
+
+  // every corruption is made on a fresh copy, which is rejected by opening it, before any walk reads it
+  auto const rejects = [&](auto &&corrupt) {
+    std::string copy = bytes;
+    corrupt(copy.data());
+    StringRef const data = {.start = copy.data(), .length = static_cast<uint32_t>(copy.size())};
+    REQUIRE_THROWS_AS(flat::MappedFile(data), std::runtime_error);
+  };
+  REQUIRE_NOTHROW(flat::MappedFile({.start = bytes.data(), .length = static_cast<uint32_t>(bytes.size())}));
+  rejects([&](char *p) { p[section(flat::FileSection::kinds) + ret] = 0x7f; });
+  rejects([&](char *p) { p[section(flat::FileSection::kinds) + ret] = static_cast<char>(flat::NodeKind::var_ref); });
+  rejects([&](char *p) { reinterpret_cast<uint32_t *>(p + section(flat::FileSection::children_end))[0] = header->n_children + 1; });
+  rejects([&](char *p) { reinterpret_cast<flat::NodeId *>(p + section(flat::FileSection::children))[0] = header->n_nodes; });
+  rejects([&](char *p) { reinterpret_cast<flat::NodeId *>(p + section(flat::FileSection::children))[header->n_children - 1] = header->root; });
+  rejects([&](char *p) { reinterpret_cast<uint32_t *>(p + section(flat::FileSection::payloads))[0] = header->n_strings; });
+}
+
+TEST_CASE("Parallel parsing matches the serial parse", "[parser]")
+{
+  std::string code = "let g;\n";
+  std::string broken = code;
+  for (int i = 0; i < 300; i++) {
+    std::string name = "f" + std::to_string(i);
+    code += (i % 5 ? "fn " : ";\nfn ") + name + "(a) {\n  let x = a * (g + 2);\n  if x { x } else { " + name + "(x - 1) }\n}\n";
+    broken += "fn " + name + "(a) {\n  let x = a * ;\n  x\n}\n" + (i % 7 ? "" : "let = 1;\n");
+  }
+  StringRef const file = {.start = "test.bpl", .length = 8};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const tokens = token::lex(file, StringRef {.start = code.c_str(), .length = (uint32_t)code.size()});
+  auto const serial = parser::parse(file, tokens, &errors, &arena)->toJsonString();
+  REQUIRE(parser::parseParallel(file, tokens, &errors, &arena, 4)->toJsonString() == serial);
+  REQUIRE(errors.empty());
+
+  // broken items are reported just like by the streaming parse, which also parses item by item
+  StringRef const broken_sr = {.start = broken.c_str(), .length = (uint32_t)broken.size()};
+  std::vector<parser::Error> stream_errors;
+  token::LexCursor cursor = token::newLexCursor(broken_sr);
+  auto const streamed = parser::parse(file, &cursor, &stream_errors, &arena)->toJsonString();
+  auto const broken_tokens = token::lex(file, broken_sr);
+  REQUIRE(parser::parseParallel(file, broken_tokens, &errors, &arena, 4)->toJsonString() == streamed);
+  auto const describe = [](std::vector<parser::Error> const &errs) {
+    std::vector<std::string> out;
+    for (auto const &err : errs)
+      out.push_back(std::to_string(err.loc.line) + ":" + std::to_string(err.loc.column) + " " + err.msg);
+    return out;
+  };
+  REQUIRE(errors.size() == 300 + 43);
+  REQUIRE(describe(errors) == describe(stream_errors));
+}
+
+TEST_CASE("Parallel parsing keeps the items after an unbalanced paren", "[parser]")
+{
+  // several batches, so the items really are split up and parsed on multiple threads
+  std::string code;
+  for (int i = 0; i < 4 * PARALLEL_PARSE_BATCH_SIZE; i++)
+    code += "fn f" + std::to_string(i) + "(a) { " + (i == 150 ? "let y = (a * 2;" : "let y = a * 2;") + " y }\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto const tokens = token::lex(file, StringRef {.start = code.c_str(), .length = (uint32_t)code.size()});
+  auto const serial = parser::parse(file, tokens, &errors, &arena);
+  REQUIRE(serial->getStatements().size() == 4 * PARALLEL_PARSE_BATCH_SIZE);
+  std::vector<parser::Error> parallel_errors;
+  auto const parallel = parser::parseParallel(file, tokens, &parallel_errors, &arena, 4);
+  REQUIRE(parallel->getStatements().size() == 4 * PARALLEL_PARSE_BATCH_SIZE);
+  REQUIRE(parallel->toJsonString() == serial->toJsonString());
+  REQUIRE(errors.size() == 1);
+  REQUIRE(parallel_errors.size() == 1);
+  REQUIRE(parallel_errors[0].loc.line == 151);
+  REQUIRE(parallel_errors[0].msg == errors[0].msg);
+}
+
+TEST_CASE("Incremental reparse only parses the edited items", "[parser]")
+{
+  std::string code = "let g;\n";
+  for (int i = 0; i < 20; i++)
+    code += "fn f" + std::to_string(i) + "(a) {\n  let x = a * 2;\n  x + g\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+
+  std::vector<parser::Error> errors;
+  ast::Arena arena;
+  auto tokens = token::lex(file, StringRef {.start = code.c_str(), .length = (uint32_t)code.size()});
+  parser::IncrementalParse parsed = {};
+  parser::reparse(&parsed, file, tokens, nullptr, &errors, &arena);
+  REQUIRE(parsed.n_parsed == 21);
+  REQUIRE(parsed.n_reused == 0);
+
+  // add a line to the body of f5, which moves all later functions down by one line
+  std::string const inserted = "  g = x;\n";
+  uint32_t const offset = code.find("fn f5(a) {\n") + 11;
+  std::string new_code = code;
+  new_code.insert(offset, inserted);
+  StringRef const new_code_sr = {.start = new_code.c_str(), .length = (uint32_t)new_code.size()};
+  auto const change = token::relex(&tokens, new_code_sr, token::TextEdit {.offset = offset, .removed_length = 0, .inserted_length = (uint32_t)inserted.size()});
+  parser::reparse(&parsed, file, tokens, &change, &errors, &arena);
+  REQUIRE(parsed.n_parsed == 1);
+  REQUIRE(parsed.n_reused == 20);
+
+  // the reused functions were moved to their new lines
+  token::LexCursor cursor = token::newLexCursor(new_code_sr);
+  REQUIRE(parsed.block->toJsonString() == parser::parse(file, &cursor, &errors, &arena)->toJsonString());
+  REQUIRE(errors.empty());
+}
+
+TEST_CASE("Incremental reparse matches a full parse after every edit", "[parser]")
+{
+  std::string code = "let g;\n";
+  for (int i = 0; i < 20; i++)
+    code += "fn f" + std::to_string(i) + "(a) {\n  let x = a * 2;\n  x + g\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  auto const describe = [](std::vector<parser::Error> const &errs) {
+    std::vector<std::string> out;
+    for (auto const &err : errs)
+      out.push_back(std::to_string(err.loc.line) + ":" + std::to_string(err.loc.column) + " " + err.msg);
+    return out;
+  };
+
+  // every version of the code stays alive, as the token buffer points into the latest one
+  std::vector<std::string> versions = {code};
+  versions.reserve(16);
+  ast::Arena arena;
+  auto tokens = token::lex(file, StringRef {.start = versions.back().c_str(), .length = (uint32_t)versions.back().size()});
+  parser::IncrementalParse parsed = {};
+  std::vector<parser::Error> errors;
+  parser::reparse(&parsed, file, tokens, nullptr, &errors, &arena);
+
+  auto const at = [&](char const *text) {
+    size_t const offset = versions.back().find(text);
+    REQUIRE(offset != std::string::npos);
+    return static_cast<uint32_t>(offset);
+  };
+  auto const edit = [&](uint32_t offset, uint32_t removed, std::string const &inserted) {
+    std::string next = versions.back();
+    next.replace(offset, removed, inserted);
+    versions.push_back(std::move(next));
+    StringRef const code_sr = {.start = versions.back().c_str(), .length = (uint32_t)versions.back().size()};
+    auto const change = token::relex(&tokens, code_sr, token::TextEdit {.offset = offset, .removed_length = removed, .inserted_length = (uint32_t)inserted.size()});
+    errors.clear();
+    parser::reparse(&parsed, file, tokens, &change, &errors, &arena);
+
+    std::vector<parser::Error> full_errors;
+    token::LexCursor cursor = token::newLexCursor(code_sr);
+    REQUIRE(parsed.block->toJsonString() == parser::parse(file, &cursor, &full_errors, &arena)->toJsonString());
+    REQUIRE(describe(errors) == describe(full_errors));
+  };
+
+  edit(at("fn f6") - 8, 0, "  g = x;\n");
+  REQUIRE(parsed.n_parsed == 1);
+  // without its closing brace, f8 runs up to the end of the file
+  edit(at("fn f9") - 2, 1, "");
+  REQUIRE(parsed.n_reused == 9);
+  edit(at("fn f9") - 1, 0, "}");
+  // relexing covers the whole line of the edit, so f3 is parsed again as well
+  edit(at("fn f3"), 0, "fn inserted(a) { a }\n// a comment\n");
+  REQUIRE(parsed.n_parsed == 2);
+  // an unbalanced paren only breaks its own item
+  edit(at("fn f16") - 22, 5, "a * (2");
+  REQUIRE(parsed.n_parsed == 1);
+  REQUIRE(errors.size() == 1);
+  // the broken item is parsed again (and reported again) although the edit is elsewhere
+  edit(at("// a comment"), 13, "");
+  REQUIRE(parsed.n_parsed == 2);
+  REQUIRE(errors.size() == 1);
+  edit(at("fn f0"), at("fn f1") - at("fn f0"), "");
+  edit(at("fn f19"), 0, ";;\n");
+  edit(static_cast<uint32_t>(versions.back().size()), 0, "let h = 1;\n");
+  REQUIRE(parsed.n_parsed == 2);
+}
+
+TEST_CASE("Parallel lexing matches serial lexing token for token", "[lexer]")
+{
+  std::string code;
+  for (int i = 0; i < 200; i++)
+    code += "fn f" + std::to_string(i) + "(a) { // comment " + std::to_string(i) + "\n  let x = 0x" + std::to_string(i) + " + 0" + std::to_string(i % 7) + ";\n  x * a / 2\n}\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  StringRef const code_sr = {.start = code.c_str(), .length = static_cast<uint32_t>(code.size())};
+
+  auto const serial = token::lex(file, code_sr);
+  auto const parallel = token::lexParallel(file, code_sr, 7, 1);
+
+  REQUIRE(parallel.types == serial.types);
+  REQUIRE(parallel.offsets == serial.offsets);
+  REQUIRE(parallel.lengths == serial.lengths);
+  REQUIRE(parallel.symbols == serial.symbols);
+  REQUIRE(parallel.matches == serial.matches);
+  REQUIRE(parallel.numbers == serial.numbers);
+  REQUIRE(parallel.number_token_indices == serial.number_token_indices);
+  REQUIRE(parallel.line_starts == serial.line_starts);
+}
+
+TEST_CASE("Incremental relexing matches lexing from scratch", "[lexer]")
+{
+  std::string code = "fn f(a) {\n  let x = 0x1f; // note\n  x * a\n}\nfn g() { f(2) }\n";
+  StringRef const file = {.start = "test.bpl", .length = 8};
+  auto tokens = token::lex(file, StringRef {.start = code.c_str(), .length = static_cast<uint32_t>(code.size())});
+
+  auto edit = [&](uint32_t offset, uint32_t removed_length, std::string const &inserted) {
+    code.replace(offset, removed_length, inserted);
+    StringRef const new_code = {.start = code.c_str(), .length = static_cast<uint32_t>(code.size())};
+    token::relex(&tokens, new_code, token::TextEdit {.offset = offset, .removed_length = removed_length, .inserted_length = static_cast<uint32_t>(inserted.size())});
+    auto const fresh = token::lex(file, new_code);
+    REQUIRE(tokens.types == fresh.types);
+    REQUIRE(tokens.offsets == fresh.offsets);
+    REQUIRE(tokens.lengths == fresh.lengths);
+    REQUIRE(tokens.symbols == fresh.symbols);
+    REQUIRE(tokens.matches == fresh.matches);
+    REQUIRE(tokens.numbers == fresh.numbers);
+    REQUIRE(tokens.number_token_indices == fresh.number_token_indices);
+    REQUIRE(tokens.line_starts == fresh.line_starts);
+  };
+
+  edit(20, 4, "12");            // change a number
+  edit(10, 0, "//");            // comment out a line
+  edit(10, 2, "let y = 0;\n");  // and insert a new one instead
+  edit(0, 10, "");              // remove across a line break
+}